@@ -41,6 +41,13 @@ namespace qi {
   /// Type of callback invoked by serializer when it encounters an object.
   using SerializeObjectCallback = boost::function<ObjectSerializationInfo(const AnyObject&)>;
 
+  namespace detail {
+    /** @return true if a value of signature \p sig may contain objects.
+     * Their encoding depends on the connection, and so does their decoding.
+     */
+    QI_API bool needsStreamContext(const Signature& sig);
+  }
+
   template <typename T>
   AnyReference decodeBinary(qi::BufferReader *buf, T* value,
                             DeserializeObjectCallback onObject=DeserializeObjectCallback(),
@@ -56,6 +63,12 @@ namespace qi {
     */
   QI_API void encodeBinary(qi::Buffer *buf, const AutoAnyReference &gvp, SerializeObjectCallback onObject=SerializeObjectCallback(), StreamContext* ctx=0);
 
+  /** Compute the number of bytes encodeBinary() appends when encoding \p gvp,
+   * so that the destination buffer can be allocated once.
+   * Objects are not accounted for, their encoding depends on the connection.
+   */
+  QI_API size_t encodedBinarySize(const AutoAnyReference &gvp);
+
 
   /** Decode content of \p buf into \p gvp.
    * @param buf buffer with serialized data
@@ -68,6 +81,23 @@ namespace qi {
    */
   QI_API AnyReference decodeBinary(qi::BufferReader *buf, AnyReference gvp, DeserializeObjectCallback onObject=DeserializeObjectCallback(), StreamContext* ctx = 0);
 
+  /** Make a tuple whose fields are decoded from \p buf when first accessed.
+   * @param buf buffer with serialized data, starting with the tuple
+   * @param signature signature of the tuple
+   * @param onObject callback invoked each time an object is encountered.
+   * @param ctx connection context
+   * @return a new value, to be destroyed by the caller
+   *
+   * Accessed fields must be treated as read-only, change them with the
+   * tuple's set(). Encoding the result while no field was set copies the
+   * bytes of \p buf. Fields can be accessed from several threads.
+   * Tuples that may contain objects depend on the connection state, and
+   * are decoded immediately.
+   * @throw std::runtime_error when the signature is not a tuple, or when the
+   * decoding of an accessed field fails
+   */
+  QI_API AnyReference decodeBinaryLazy(const qi::Buffer& buf, const qi::Signature& signature, DeserializeObjectCallback onObject=DeserializeObjectCallback(), StreamContext* ctx = 0);
+
   template <typename T>
   AnyReference decodeBinary(qi::BufferReader *buf, T* value, DeserializeObjectCallback onObject, StreamContext* ctx) {
     return decodeBinary(buf, AnyReference::fromPtr(value), onObject, ctx);
@@ -10,7 +10,9 @@
 # include <qi/api.hpp>
 # include <qi/types.hpp>
 # include <boost/shared_ptr.hpp>
+# include <boost/function.hpp>
 # include <vector>
+# include <string>
 # include <cstddef>
 
 #ifdef _MSC_VER
@@ -109,6 +111,16 @@ namespace qi
      */
     Buffer& operator = (Buffer&& buffer);
 
+    /**
+     * \brief Construct a buffer on memory it does not own, without copying it.
+     * \param data The content of the buffer, which must stay valid and
+     * writable until \a release is called.
+     * \param size The size of the content.
+     * \param release Called once the buffer stops using \a data: on
+     * destruction, or when it grows and moves its content to its own storage.
+     */
+    Buffer(void* data, size_t size, boost::function<void()> release);
+
     /**
      * \brief Write data in the buffer.
      * \param data The data to write
@@ -168,10 +180,33 @@ namespace qi
      * \warning The return value is valid until the next non-const operation.
      */
     void* reserve(size_t size);
+    /**
+     * \brief Ensure the buffer can hold \a capacity bytes without reallocating.
+     * The content and size of the buffer are unchanged.
+     * \param capacity number of bytes the buffer must be able to hold.
+     * \return true if operation succeeded, false otherwise.
+     * \warning Pointers previously returned by data() or reserve() are invalidated.
+     */
+    bool reserveCapacity(size_t capacity);
+    /**
+     * \brief Return the number of bytes the buffer can hold without reallocating.
+     * \return the capacity.
+     */
+    size_t capacity() const;
+    /**
+     * \brief Release the storage that is not used by the content of the buffer.
+     * \warning Pointers previously returned by data() or reserve() are invalidated.
+     */
+    void  shrink();
     /**
      * \brief Erase content of buffer and remove sub-buffers whithout clearing them.
      */
     void  clear();
+    /**
+     * \brief Drop the content past \a size bytes, and the sub-buffers it held.
+     * \param size The new size, nothing is done if it is not smaller than size().
+     */
+    void  truncate(size_t size);
 
 
     /**
@@ -279,6 +314,11 @@ namespace qi
      * \return The current offset.
      */
     size_t position() const;
+    /**
+     * \brief Return the buffer being read.
+     * \return The buffer.
+     */
+    const Buffer& buffer() const;
 
   private:
     Buffer _buffer;
@@ -286,6 +326,68 @@ namespace qi
     size_t _subCursor; // position in sub-buffers
   };
 
+  /**
+   * \brief Read-only view on bytes stored in a Buffer.
+   * \includename{qi/buffer.hpp}
+   *
+   * The view shares ownership of the buffer it points into, so the bytes
+   * stay valid as long as the view exists, provided the buffer is not
+   * modified. Decoding a message into a BufferView (signature 's') or a
+   * RawBufferView (signature 'r') does not copy the data out of the
+   * received message.
+   */
+  class QI_API BufferView
+  {
+  public:
+    /// \brief Construct an empty view.
+    BufferView();
+    /**
+     * \brief Construct a view on \a size bytes at \a data, held by \a buffer.
+     * \param buffer The buffer holding the data, kept alive by the view.
+     * \param data Pointer to the first byte of the view.
+     * \param size Number of bytes in the view.
+     */
+    BufferView(const Buffer& buffer, const char* data, size_t size);
+    /**
+     * \brief Construct a view on a copy of \a data.
+     * \param data The data to copy.
+     * \param size Number of bytes to copy.
+     */
+    BufferView(const char* data, size_t size);
+
+    /// \brief Return a pointer to the first byte of the view.
+    const char* data() const { return _data; }
+    /// \brief Return the number of bytes in the view.
+    size_t size() const { return _size; }
+    /// \brief Return true if the view has no bytes.
+    bool empty() const { return _size == 0; }
+    /// \brief Return a copy of the bytes of the view.
+    std::string str() const { return std::string(_data, _size); }
+    /// \brief Return the buffer holding the bytes of the view.
+    const Buffer& buffer() const { return _buffer; }
+
+  private:
+    Buffer _buffer;
+    const char* _data;
+    size_t _size;
+  };
+
+  /**
+   * \brief BufferView registered in the type system as raw data.
+   * \includename{qi/buffer.hpp}
+   */
+  class QI_API RawBufferView: public BufferView
+  {
+  public:
+    RawBufferView() {}
+    RawBufferView(const Buffer& buffer, const char* data, size_t size)
+      : BufferView(buffer, data, size)
+    {}
+    RawBufferView(const char* data, size_t size)
+      : BufferView(data, size)
+    {}
+  };
+
   namespace detail {
     QI_API void printBuffer(std::ostream& stream, const Buffer& buffer);
   }
@@ -11,6 +11,7 @@
 #  pragma warning( disable: 4503 ) // decorated name length
 # endif
 
+# include <vector>
 # include <boost/shared_ptr.hpp>
 # include <boost/function.hpp>
 
@@ -79,6 +80,14 @@ namespace qi
      */
     void setMaxThreads(unsigned int max);
 
+    /**
+     * \brief Restrict the worker threads to the given CPU cores.
+     * \param cpus CPU core ids, as for qi::os::setCurrentThreadCPUAffinity().
+     *
+     * Must be called before start() to have any effect.
+     */
+    void setCPUAffinity(const std::vector<int>& cpus);
+
     /// \brief Internal function.
     void *nativeHandle();
 
@@ -161,6 +170,16 @@ namespace qi
   /// \brief Return the global eventloop, created on demand on first call.
   QI_API EventLoop* getEventLoop();
 
+  /**
+   * \brief Return the network eventloop, created on demand on first call.
+   *
+   * Socket reads, writes and accepts run on this loop, apart from the pool
+   * returned by getEventLoop() which runs user code. It has a fixed number of
+   * threads (QI_NETWORK_EVENTLOOP_THREAD_COUNT, default 2) which can be pinned
+   * to cores with QI_NETWORK_EVENTLOOP_CPUS, a comma-separated list of core ids.
+   */
+  QI_API EventLoop* getNetworkEventLoop();
+
   /**
    * \brief Start the eventloop with nthread threads. No-op if already started.
    * \param nthread Set the minimum number of worker threads in the pool.
@@ -35,6 +35,46 @@ namespace qi
   };
 
 template<> class TypeImpl<Buffer>: public TypeBufferImpl {};
+
+  /// String kind type of BufferView: get() exposes the viewed bytes without copy.
+  class TypeBufferViewImpl: public StringTypeInterface
+  {
+  public:
+    ManagedRawString get(void* storage) override
+    {
+      BufferView* v = (BufferView*)Methods::ptrFromStorage(&storage);
+      return ManagedRawString(RawString(const_cast<char*>(v->data()), v->size()), Deleter());
+    }
+    void set(void** storage, const char* ptr, size_t sz) override
+    {
+      BufferView* v = (BufferView*)Methods::ptrFromStorage(storage);
+      *v = BufferView(ptr, sz);
+    }
+    using Methods = DefaultTypeImplMethods<BufferView, TypeByPointerPOD<BufferView> >;
+    _QI_BOUNCE_TYPE_METHODS(Methods);
+  };
+
+template<> class TypeImpl<BufferView>: public TypeBufferViewImpl {};
+
+  /// Raw kind type of RawBufferView: get() exposes the viewed bytes without copy.
+  class TypeRawBufferViewImpl: public RawTypeInterface
+  {
+  public:
+    std::pair<char*, size_t> get(void *storage) override
+    {
+      RawBufferView* v = (RawBufferView*)Methods::ptrFromStorage(&storage);
+      return std::make_pair(const_cast<char*>(v->data()), v->size());
+    }
+    void set(void** storage, const char* ptr, size_t sz) override
+    {
+      RawBufferView* v = (RawBufferView*)Methods::ptrFromStorage(storage);
+      *v = RawBufferView(ptr, sz);
+    }
+    using Methods = DefaultTypeImplMethods<RawBufferView, TypeByPointerPOD<RawBufferView> >;
+    _QI_BOUNCE_TYPE_METHODS(Methods);
+  };
+
+template<> class TypeImpl<RawBufferView>: public TypeRawBufferViewImpl {};
 }
 
 #endif  // _QITYPE_DETAIL_TYPEBUFFER_HXX_
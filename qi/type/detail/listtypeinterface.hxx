@@ -27,6 +27,9 @@ public:
   AnyIterator begin(void* storage) override;
   AnyIterator end(void* storage) override;
   void pushBack(void** storage, void* valueStorage) override;
+  void pushBackOwned(void** storage, void* valueStorage) override;
+  void* data(void* storage) override;
+  bool resize(void** storage, size_t size) override;
   _QI_BOUNCE_TYPE_METHODS(MethodsImpl);
   TypeInterface* _elementType;
 };
@@ -109,6 +112,66 @@ void ListTypeInterfaceImpl<T, H>::pushBack(void **storage, void* valueStorage)
   detail::pushBack(*ptr, (typename T::value_type*)_elementType->ptrFromStorage(&valueStorage));
 }
 
+namespace detail
+{
+  template<typename T, typename E>
+  void pushBackMove(T& container, E* element)
+  {
+    container.push_back(std::move(*element));
+  }
+  template<typename CE, typename E>
+  void pushBackMove(std::set<CE>& container, E* element)
+  {
+    container.insert(std::move(*element));
+  }
+}
+template<typename T, typename H>
+void ListTypeInterfaceImpl<T, H>::pushBackOwned(void **storage, void* valueStorage)
+{
+  T* ptr = (T*) ptrFromStorage(storage);
+  detail::pushBackMove(*ptr, (typename T::value_type*)_elementType->ptrFromStorage(&valueStorage));
+  _elementType->destroy(valueStorage);
+}
+
+namespace detail
+{
+  template<typename T>
+  void* listData(T&)
+  {
+    return 0;
+  }
+  template<typename E, typename A>
+  void* listData(std::vector<E, A>& container)
+  {
+    return container.empty() ? 0 : &container[0];
+  }
+  template<typename T>
+  bool listResize(T&, size_t)
+  {
+    return false;
+  }
+  template<typename E, typename A>
+  bool listResize(std::vector<E, A>& container, size_t size)
+  {
+    container.resize(size);
+    return true;
+  }
+}
+
+template<typename T, typename H>
+void* ListTypeInterfaceImpl<T, H>::data(void* storage)
+{
+  T* ptr = (T*) ptrFromStorage(&storage);
+  return detail::listData(*ptr);
+}
+
+template<typename T, typename H>
+bool ListTypeInterfaceImpl<T, H>::resize(void** storage, size_t size)
+{
+  T* ptr = (T*) ptrFromStorage(storage);
+  return detail::listResize(*ptr, size);
+}
+
 template<typename T, typename H>
 size_t ListTypeInterfaceImpl<T, H>::size(void* storage)
 {
@@ -157,6 +220,17 @@ public:
     void* vstor = adaptStorage(storage);
     BaseClass::pushBack(&vstor, valueStorage);
   }
+  void pushBackOwned(void** storage, void* valueStorage) override {
+    void* vstor = adaptStorage(storage);
+    BaseClass::pushBackOwned(&vstor, valueStorage);
+  }
+  void* data(void* storage) override {
+    return BaseClass::data(adaptStorage(&storage));
+  }
+  bool resize(void** storage, size_t size) override {
+    void* vstor = adaptStorage(storage);
+    return BaseClass::resize(&vstor, size);
+  }
 
   //ListTypeInterface* _list;
 };
@@ -201,6 +201,14 @@ namespace qi{
     /// Get the element at index
     virtual void* element(void* storage, int index);
     TypeKind kind() override { return TypeKind_List;}
+    // Added after the existing virtuals, to keep their vtable slots
+    /// Append an element to the end of the list, taking ownership of
+    /// \p valueStorage which must not be used afterwards
+    virtual void pushBackOwned(void** storage, void* valueStorage);
+    /// Return a pointer to the elements if they are stored contiguously, 0 otherwise
+    virtual void* data(void* storage);
+    /// Resize the list to \p size elements, return false if not supported
+    virtual bool resize(void** storage, size_t size);
   };
 
   /**
@@ -299,6 +307,11 @@ namespace qi{
     }
 
     /// @}
+
+    // Added after the existing virtuals, to keep their vtable slots
+    /// Set all the fields of the struct, taking ownership of \p values
+    /// which must not be used afterwards
+    virtual void setOwned(void** storage, const std::vector<void*>& values);
   };
 
   /**
@@ -28,8 +28,12 @@ namespace qi {
    *    <li>- protocol://</li>
    *    <li>- :port</li>
    *    <li>- *empty string*</li>
+   *    <li>- unix:///path/to/socket</li>
    *  </ul>
    *
+   *  For the unix protocol, the host is the path of the socket and there is
+   *  no port: such urls are valid as soon as they have a path.
+   *
    *  @note This class is copyable.
    */
   class QI_API Url
@@ -9,12 +9,14 @@
 
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <stdexcept>
 #include <iomanip>
 #include <ctype.h>
 
-#include <boost/pool/singleton_pool.hpp>
+#include <boost/pool/pool_alloc.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "buffer_p.hpp"
 
@@ -23,6 +25,95 @@ qiLogCategory("qi.Buffer");
 
 namespace qi
 {
+  namespace
+  {
+    /// Recycles the heap storage of buffers through size-classed free lists.
+    class BlockPool
+    {
+    public:
+      static const size_t minBlockSize = BLOCK;
+      static const unsigned int classCount = 7; // 4KiB to 256KiB
+      static const size_t maxBlockSize = minBlockSize << (classCount - 1);
+      static const size_t maxCachedBytesPerClass = 512 * 1024;
+
+      /// @return the size of the block that will be allocated for \p size bytes
+      static size_t blockSize(size_t size)
+      {
+        if (size > maxBlockSize)
+          return size;
+        size_t res = minBlockSize;
+        while (res < size)
+          res <<= 1;
+        return res;
+      }
+
+      /// @param size must be a value returned by blockSize()
+      unsigned char* allocate(size_t size)
+      {
+        if (size <= maxBlockSize)
+        {
+          std::vector<unsigned char*>& freeList = _freeLists[sizeClass(size)];
+          boost::mutex::scoped_lock lock(_mutex);
+          if (!freeList.empty())
+          {
+            unsigned char* res = freeList.back();
+            freeList.pop_back();
+            return res;
+          }
+        }
+        return static_cast<unsigned char*>(malloc(size));
+      }
+
+      /// @param size must be the size \p ptr was allocated with
+      void deallocate(unsigned char* ptr, size_t size)
+      {
+        if (size <= maxBlockSize)
+        {
+          std::vector<unsigned char*>& freeList = _freeLists[sizeClass(size)];
+          boost::mutex::scoped_lock lock(_mutex);
+          if ((freeList.size() + 1) * size <= maxCachedBytesPerClass)
+          {
+            freeList.push_back(ptr);
+            return;
+          }
+        }
+        free(ptr);
+      }
+
+    private:
+      static unsigned int sizeClass(size_t size)
+      {
+        unsigned int res = 0;
+        while ((minBlockSize << res) < size)
+          ++res;
+        return res;
+      }
+
+      boost::mutex _mutex;
+      std::vector<unsigned char*> _freeLists[classCount];
+    };
+
+    BlockPool& blockPool()
+    {
+      // Never destroyed: buffers may be released during static destruction.
+      static BlockPool* pool = new BlockPool;
+      return *pool;
+    }
+
+    boost::shared_ptr<BufferPrivate> makeBufferPrivate()
+    {
+      return boost::allocate_shared<BufferPrivate>(boost::fast_pool_allocator<BufferPrivate>());
+    }
+
+    /// A moved-from Buffer has no BufferPrivate, allocate it on first modification.
+    BufferPrivate& ensure(boost::shared_ptr<BufferPrivate>& p)
+    {
+      if (!p)
+        p = makeBufferPrivate();
+      return *p;
+    }
+  }
+
   BufferPrivate::BufferPrivate() // cppcheck-suppress uninitMemberVar
     : _bigdata(0)
     , _cachedSubBufferTotalSize(0)
@@ -33,25 +124,21 @@ namespace qi
 
   BufferPrivate::~BufferPrivate()
   {
-    if (_bigdata)
-    {
-      free(_bigdata);
-      _bigdata = NULL;
-    }
+    releaseBigdata();
   }
 
-  struct MyPoolTag { };
-  using buffer_pool = boost::singleton_pool<MyPoolTag, sizeof(BufferPrivate)>;
-
-  void* BufferPrivate::operator new(size_t sz)
+  void BufferPrivate::releaseBigdata()
   {
-    QI_ASSERT(sz <= sizeof(BufferPrivate));
-    return buffer_pool::malloc();
-  }
-
-  void BufferPrivate::operator delete(void* ptr)
-  {
-    buffer_pool::free(ptr);
+    if (!_bigdata)
+      return;
+    if (_release)
+    {
+      _release();
+      _release.clear();
+    }
+    else
+      blockPool().deallocate(_bigdata, available);
+    _bigdata = NULL;
   }
 
   int BufferPrivate::indexOfSubBuffer(size_t offset) const
@@ -66,7 +153,7 @@ namespace qi
   }
 
   Buffer::Buffer()
-    : _p(boost::make_shared<BufferPrivate>())
+    : _p(makeBufferPrivate())
   {
   }
 
@@ -84,17 +171,25 @@ namespace qi
   Buffer::Buffer(Buffer&& b)
     : _p(std::move(b._p))
   {
-    // The default state of a qi::Buffer contains a valid BufferPrivate pointer.
-    b._p = boost::make_shared<BufferPrivate>();
+    // The moved-from buffer gets a BufferPrivate back on first modification.
   }
 
   Buffer& Buffer::operator=(Buffer&& b)
   {
     _p = std::move(b._p);
-    b._p = boost::make_shared<BufferPrivate>();
+    b._p.reset();
     return *this;
   }
 
+  Buffer::Buffer(void* data, size_t size, boost::function<void()> release)
+    : _p(makeBufferPrivate())
+  {
+    _p->_bigdata = static_cast<unsigned char*>(data);
+    _p->_release = release;
+    _p->used = size;
+    _p->available = size;
+  }
+
   unsigned char* BufferPrivate::data()
   {
     if (_bigdata)
@@ -105,23 +200,46 @@ namespace qi
 
   bool BufferPrivate::resize(size_t neededSize)
   {
-    neededSize += BLOCK; // Should be enough in most cases;
+    // Grow geometrically so that a sequence of writes is amortized linear.
+    size_t newSize = std::max(neededSize, available * 2);
+    newSize = std::max(newSize, static_cast<size_t>(BLOCK));
+
+    qiLogDebug() << "Resizing buffer from " << available << " to " << newSize;
+    if (reallocate(newSize))
+      return true;
+    // Fallback to exactly what is needed if the geometric growth failed.
+    return newSize != neededSize && reallocate(neededSize);
+  }
 
-    qiLogDebug() << "Resizing buffer from " << available << " to " << neededSize;
+  bool BufferPrivate::reallocate(size_t newSize)
+  {
+    newSize = BlockPool::blockSize(newSize);
     unsigned char *newBigdata;
 
-    newBigdata = static_cast<unsigned char *>(realloc(_bigdata, neededSize));
-    if (newBigdata == NULL)
-      return false;
-    if (!_bigdata && used > 0)
-      ::memcpy(newBigdata, _data, used);
-    available = neededSize;
-    _bigdata = newBigdata; // Don't worry, realloc free previous buffer if needed
+    if (_bigdata && !_release && available > BlockPool::maxBlockSize && newSize > BlockPool::maxBlockSize)
+    {
+      // Neither block is pooled, let realloc avoid the copy if it can.
+      newBigdata = static_cast<unsigned char *>(realloc(_bigdata, newSize));
+      if (newBigdata == NULL)
+        return false;
+    }
+    else
+    {
+      newBigdata = blockPool().allocate(newSize);
+      if (newBigdata == NULL)
+        return false;
+      if (used > 0)
+        ::memcpy(newBigdata, data(), used);
+      releaseBigdata();
+    }
+    available = newSize;
+    _bigdata = newBigdata;
     return true;
   }
 
   bool Buffer::write(const void *data, size_t size)
   {
+    ensure(_p);
     if (_p->used + size > _p->available)
     {
       bool ret = _p->resize(_p->used + size);
@@ -139,6 +257,7 @@ namespace qi
 
   size_t Buffer::addSubBuffer(const Buffer& buffer)
   {
+    ensure(_p);
     size_t subBufferSize = buffer.size();
     size_t actualUsed = _p->used;
 
@@ -151,12 +270,12 @@ namespace qi
 
   bool Buffer::hasSubBuffer(size_t offset) const
   {
-    return (_p->indexOfSubBuffer(offset) != -1);
+    return _p && (_p->indexOfSubBuffer(offset) != -1);
   }
 
   const Buffer& Buffer::subBuffer(size_t offset) const
   {
-    int index = _p->indexOfSubBuffer(offset);
+    int index = _p ? _p->indexOfSubBuffer(offset) : -1;
 
     if (index == -1)
       throw std::runtime_error("No sub-buffer at the specified offset.");
@@ -166,17 +285,18 @@ namespace qi
 
   size_t Buffer::size() const
   {
-    return _p->used;
+    return _p ? _p->used : 0;
   }
 
   size_t Buffer::totalSize() const
   {
-    return size() + _p->_cachedSubBufferTotalSize;
+    return _p ? size() + _p->_cachedSubBufferTotalSize : 0;
   }
 
   const std::vector<std::pair<size_t, Buffer> > & Buffer::subBuffers() const
   {
-    return _p->_subBuffers;
+    static const std::vector<std::pair<size_t, Buffer> > empty;
+    return _p ? _p->_subBuffers : empty;
   }
 
   /*
@@ -186,6 +306,7 @@ namespace qi
   */
   void *Buffer::reserve(size_t size)
   {
+    ensure(_p);
     if (_p->used + size > _p->available)
       _p->resize(_p->used + size);
 
@@ -195,13 +316,56 @@ namespace qi
     return p;
   }
 
+  bool Buffer::reserveCapacity(size_t capacity)
+  {
+    if (capacity <= ensure(_p).available)
+      return true;
+    return _p->reallocate(capacity);
+  }
+
+  size_t Buffer::capacity() const
+  {
+    return _p ? _p->available : 0;
+  }
+
+  void Buffer::shrink()
+  {
+    if (!_p || !_p->_bigdata || _p->_release)
+      return;
+    if (_p->used <= sizeof(_p->_data))
+    {
+      // Content fits in the static storage: give back the heap block.
+      ::memcpy(_p->_data, _p->_bigdata, _p->used);
+      blockPool().deallocate(_p->_bigdata, _p->available);
+      _p->_bigdata = NULL;
+      _p->available = sizeof(_p->_data);
+      return;
+    }
+    if (BlockPool::blockSize(_p->used) < _p->available)
+      _p->reallocate(_p->used);
+  }
+
   void Buffer::clear()
   {
+    if (!_p)
+      return;
     _p->used = 0;
     _p->_subBuffers.clear();
     _p->_cachedSubBufferTotalSize = 0;
   }
 
+  void Buffer::truncate(size_t size)
+  {
+    if (!_p || size >= _p->used)
+      return;
+    _p->used = size;
+    while (!_p->_subBuffers.empty() && _p->_subBuffers.back().first + sizeof(uint32_t) > size)
+    {
+      _p->_cachedSubBufferTotalSize -= _p->_subBuffers.back().second.totalSize();
+      _p->_subBuffers.pop_back();
+    }
+  }
+
   void* Buffer::data()
   {
     return _p ? _p->data() : 0;
@@ -214,28 +378,55 @@ namespace qi
 
   const void *Buffer::read(size_t offset, size_t length) const
   {
-    if (offset + length > _p->used)
+    if (offset + length > size())
     {
       qiLogDebug() << "Attempt to read " << offset+length
-       <<" on buffer of size " << _p->used;
+       <<" on buffer of size " << size();
       return  nullptr;
     }
-    return (char*)_p->data() + offset;
+    return (const char*)data() + offset;
   }
 
   size_t Buffer::read(void* buffer, size_t offset, size_t length) const
   {
-    if (offset > _p->used)
+    if (offset > size())
     {
       qiLogDebug() << "Attempt to read " << offset+length
-      <<" on buffer of size " << _p->used;
+      <<" on buffer of size " << size();
       return -1;
     }
-    size_t copy = std::min(length, _p->used - offset);
-    memcpy(buffer, (char*)_p->data()+offset, copy);
+    size_t copy = std::min(length, size() - offset);
+    if (copy)
+      memcpy(buffer, (const char*)data()+offset, copy);
     return copy;
   }
 
+  BufferView::BufferView()
+    : _buffer()
+    , _data(0)
+    , _size(0)
+  {
+  }
+
+  BufferView::BufferView(const Buffer& buffer, const char* data, size_t size)
+    : _buffer(buffer)
+    , _data(data)
+    , _size(size)
+  {
+  }
+
+  BufferView::BufferView(const char* data, size_t size)
+    : _buffer()
+    , _data(0)
+    , _size(size)
+  {
+    if (size)
+    {
+      _buffer.write(data, size);
+      _data = static_cast<const char*>(_buffer.data());
+    }
+  }
+
   namespace detail {
     void printBuffer(std::ostream& stream, const Buffer& buffer)
     {
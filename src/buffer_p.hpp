@@ -11,6 +11,7 @@
 #define BLOCK   4096
 
 #include <vector>
+#include <boost/function.hpp>
 #include <qi/atomic.hpp>
 #include <qi/types.hpp>
 
@@ -21,14 +22,17 @@ namespace qi
   public:
     BufferPrivate();
     ~BufferPrivate();
-    void* operator new(size_t);
-    void operator delete(void*);
     unsigned char * data();
     bool            resize(size_t size = 0x100000);
+    bool            reallocate(size_t size);
     int             indexOfSubBuffer(size_t offset) const;
+    /// Give back _bigdata to its owner, or to the pool.
+    void            releaseBigdata();
 
   public:
     unsigned char*  _bigdata;
+    // If set, _bigdata is not ours and is given back by calling this.
+    boost::function<void()> _release;
     unsigned char   _data[STATIC_BLOCK] = {};
     size_t          _cachedSubBufferTotalSize;
 
@@ -87,4 +87,9 @@ namespace qi {
   {
     return _cursor;
   }
+
+  const Buffer& BufferReader::buffer() const
+  {
+    return _buffer;
+  }
 }
@@ -2,10 +2,16 @@
 **  Copyright (C) 2012, 2013 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <sstream>
 #include <thread>
 
 #include <boost/program_options.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/asio/steady_timer.hpp>
 
 #include <qi/preproc.hpp>
@@ -187,10 +193,23 @@ namespace qi {
       --_running;
   }
 
+  static void noCleanup(bool*) {}
+  static boost::thread_specific_ptr<bool> networkThread(&noCleanup);
+
+  bool isNetworkThread()
+  {
+    return networkThread.get() != nullptr;
+  }
+
   void EventLoopAsio::_runPool()
   {
     qiLogDebug() << this << "run starting from pool";
     qi::os::setCurrentThreadName(_name);
+    static bool mark = true;
+    if (_network)
+      networkThread.reset(&mark);
+    if (!_cpuAffinity.empty() && !qi::os::setCurrentThreadCPUAffinity(_cpuAffinity))
+      qiLogWarning() << "Cannot set the CPU affinity of eventloop(" << _name << ")";
     _running.setIfEquals(0, 1);
     ++_nThreads;
 
@@ -406,6 +425,22 @@ namespace qi {
     return static_cast<void*>(&_io);
   }
 
+  // Options set before start(), when there is no EventLoopPrivate to hold
+  // them yet. Kept out of EventLoop to preserve its layout.
+  struct PendingEventLoopOptions
+  {
+    boost::mutex mutex;
+    std::map<const EventLoop*, std::vector<int> > cpuAffinity;
+    std::set<const EventLoop*> network;
+  };
+
+  static PendingEventLoopOptions& pendingOptions()
+  {
+    static PendingEventLoopOptions* options = nullptr;
+    QI_THREADSAFE_NEW(options);
+    return *options;
+  }
+
   EventLoop::EventLoop(const std::string& name)
   : _p(0)
   , _name(name)
@@ -417,6 +452,10 @@ namespace qi {
     if (_p)
       _p->destroy();
     _p = 0;
+    PendingEventLoopOptions& options = pendingOptions();
+    boost::mutex::scoped_lock lock(options.mutex);
+    options.cpuAffinity.erase(this);
+    options.network.erase(this);
   }
 
   #define CHECK_STARTED                                                            \
@@ -447,6 +486,17 @@ namespace qi {
       return;
     _p = new EventLoopAsio();
     _p->_name = _name;
+    {
+      PendingEventLoopOptions& options = pendingOptions();
+      boost::mutex::scoped_lock lock(options.mutex);
+      std::map<const EventLoop*, std::vector<int> >::iterator it = options.cpuAffinity.find(this);
+      if (it != options.cpuAffinity.end())
+      {
+        _p->_cpuAffinity.swap(it->second);
+        options.cpuAffinity.erase(it);
+      }
+      _p->_network = options.network.erase(this) != 0;
+    }
     _p->start(nthreads);
     qiLogDebug() << this << " EventLoop start done";
   }
@@ -508,6 +558,15 @@ namespace qi {
     _p->setMaxThreads(max);
   }
 
+  void EventLoop::setCPUAffinity(const std::vector<int>& cpus)
+  {
+    if (_p)
+      qiLogWarning() << "CPU affinity must be set before starting " << _name;
+    PendingEventLoopOptions& options = pendingOptions();
+    boost::mutex::scoped_lock lock(options.mutex);
+    options.cpuAffinity[this] = cpus;
+  }
+
   struct MonitorContext
   {
     EventLoop* target;
@@ -602,14 +661,51 @@ namespace qi {
   }
 
   static EventLoop*    _poolEventLoop = nullptr;
+  static qi::Atomic<int> _poolInit(0);
+  static EventLoop*    _netEventLoop = nullptr;
+  static qi::Atomic<int> _netInit(0);
+
+  static void startPool(EventLoop* ctx, int nthreads)
+  {
+    ctx->start(nthreads);
+  }
+
+  static std::vector<int> networkCpus()
+  {
+    std::vector<int> cpus;
+    std::istringstream envCpus(qi::os::getenv("QI_NETWORK_EVENTLOOP_CPUS"));
+    std::string cpu;
+    while (std::getline(envCpus, cpu, ','))
+      if (!cpu.empty())
+        cpus.push_back(std::atoi(cpu.c_str()));
+    return cpus;
+  }
+
+  static void markNetwork(EventLoop* ctx)
+  {
+    PendingEventLoopOptions& options = pendingOptions();
+    boost::mutex::scoped_lock lock(options.mutex);
+    options.network.insert(ctx);
+  }
+
+  // The network loop must not grow under load like the pool does: it only
+  // runs socket handlers, user code is handed off to the pool.
+  static void startNetwork(EventLoop* ctx)
+  {
+    const int nthreads = std::max(1, qi::os::getEnvDefault("QI_NETWORK_EVENTLOOP_THREAD_COUNT", 2));
+    markNetwork(ctx);
+    ctx->setCPUAffinity(networkCpus());
+    ctx->start(nthreads);
+    ctx->setMaxThreads(nthreads);
+  }
 
   //the initialisation is protected by a mutex,
   //we then use an atomic to prevent having a mutex on a fastpath.
-  static EventLoop* _get(EventLoop* &ctx, int nthreads)
+  static EventLoop* _get(EventLoop* &ctx, qi::Atomic<int>& init, const std::string& name,
+                         const boost::function<void(EventLoop*)>& start)
   {
     //same mutex for multiples eventloops, but that's ok, used only at init.
     static boost::mutex    eventLoopMutex;
-    static qi::Atomic<int> init(0);
 
     if (init.load())
       return ctx;
@@ -622,8 +718,8 @@ namespace qi {
         {
           qiLogVerbose() << "Creating event loop while no qi::Application() is running";
         }
-        ctx = new EventLoop();
-        ctx->start(nthreads);
+        ctx = new EventLoop(name);
+        start(ctx);
         Application::atExit(boost::bind(&eventloop_stop, boost::ref(ctx)));
       }
     }
@@ -633,14 +729,63 @@ namespace qi {
 
   void startEventLoop(int nthread)
   {
-    _get(_poolEventLoop, nthread);
+    _get(_poolEventLoop, _poolInit, "eventloop", boost::bind(&startPool, _1, nthread));
   }
 
   EventLoop* getEventLoop()
   {
-    return _get(_poolEventLoop, 0);
+    return _get(_poolEventLoop, _poolInit, "eventloop", boost::bind(&startPool, _1, 0));
   }
 
+  EventLoop* getNetworkEventLoop()
+  {
+    return _get(_netEventLoop, _netInit, "qi.net", &startNetwork);
+  }
+
+  static std::vector<EventLoop*> _netShards;
+  static qi::Atomic<int> _netShardsInit(0);
+
+  static void shards_stop(std::vector<EventLoop*>& shards)
+  {
+    for (EventLoop*& shard : shards)
+      eventloop_stop(shard);
+    shards.clear();
+  }
+
+  // Each shard is a single pinned thread, so that the sockets it owns are
+  // served by one core without contending on a shared scheduler.
+  const std::vector<EventLoop*>& getNetworkEventLoopShards()
+  {
+    static boost::mutex shardsMutex;
+
+    if (_netShardsInit.load())
+      return _netShards;
+
+    {
+      boost::mutex::scoped_lock _sl(shardsMutex);
+      if (!_netShardsInit.load())
+      {
+        const int count = qi::os::getEnvDefault("QI_NETWORK_EVENTLOOP_SHARDS", 0);
+        std::vector<int> cpus = networkCpus();
+        if (cpus.empty())
+          for (int i = 0; i < count; ++i)
+            cpus.push_back(i % std::max(1u, boost::thread::hardware_concurrency()));
+        for (int i = 0; i < count; ++i)
+        {
+          EventLoop* shard = new EventLoop("qi.net." + boost::lexical_cast<std::string>(i));
+          markNetwork(shard);
+          shard->setCPUAffinity(std::vector<int>(1, cpus[i % cpus.size()]));
+          shard->start(1);
+          shard->setMaxThreads(1);
+          _netShards.push_back(shard);
+        }
+        if (!_netShards.empty())
+          Application::atExit(boost::bind(&shards_stop, boost::ref(_netShards)));
+        ++_netShardsInit;
+      }
+    }
+    return _netShards;
+  }
 
   boost::asio::io_service& getIoService()
   {
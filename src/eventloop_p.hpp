@@ -52,6 +52,8 @@ namespace qi {
     virtual void setMaxThreads(unsigned int max)=0;
     boost::function<void()> _emergencyCallback;
     std::string             _name;
+    std::vector<int>        _cpuAffinity;
+    bool                    _network = false; // see isNetworkThread()
 
   protected:
     virtual ~EventLoopPrivate() = default;
@@ -104,6 +106,19 @@ namespace qi {
     qi::Atomic<uint32_t> _totalTask;
     qi::Atomic<uint32_t> _activeTask;
   };
+
+  /**
+   * Return QI_NETWORK_EVENTLOOP_SHARDS single-threaded network event loops,
+   * created on first call, each pinned to one core. Empty when sharding is
+   * disabled (the default).
+   */
+  const std::vector<EventLoop*>& getNetworkEventLoopShards();
+
+  /**
+   * Whether the calling thread runs getNetworkEventLoop() or one of its
+   * shards. Such threads serve every socket and must never block.
+   */
+  bool isNetworkThread();
 }
 
 #endif  // _SRC_EVENTLOOP_P_HPP_
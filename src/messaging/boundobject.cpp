@@ -6,6 +6,7 @@
 #include <boost/make_shared.hpp>
 
 #include <qi/anyobject.hpp>
+#include <qi/async.hpp>
 #include <qi/type/objecttypebuilder.hpp>
 #include "boundobject.hpp"
 
@@ -13,12 +14,12 @@ qiLogCategory("qimessaging.boundobject");
 
 namespace qi {
 
-  static AnyReference forwardEvent(const GenericFunctionParameters& params,
-                                   unsigned int service, unsigned int object,
-                                   unsigned int event, Signature sig,
-                                   TransportSocketPtr client,
-                                   ObjectHost* context,
-                                   const std::string& signature)
+  static Message makeEvent(const GenericFunctionParameters& params,
+                           unsigned int service, unsigned int object,
+                           unsigned int event, const Signature& sig,
+                           TransportSocketPtr client,
+                           ObjectHost* context,
+                           const std::string& signature)
   {
     qiLogDebug() << "forwardEvent";
     qi::Message msg;
@@ -74,7 +75,50 @@ namespace qi {
     msg.setFunction(event);
     msg.setType(Message::Type_Event);
     msg.setObject(object);
-    client->send(msg);
+    return msg;
+  }
+
+  static AnyReference forwardEvent(const GenericFunctionParameters& params,
+                                   unsigned int service, unsigned int object,
+                                   unsigned int event, Signature sig,
+                                   EventFanoutPtr fanout,
+                                   ObjectHost* context,
+                                   const std::string& signature,
+                                   bool shareable)
+  {
+    // Keep the subscribers from being removed while they are being sent to.
+    boost::shared_lock<boost::shared_mutex> lock(fanout->mutex);
+    // Unless objects, which are registered on the socket they are sent to,
+    // may be part of the payload, the encoding only depends on whether the
+    // remote end handles dynamic payloads: serialize once per kind of
+    // subscriber and send the same message, buffer included, to all of them.
+    Message encoded[2];
+    bool isEncoded[2] = { false, false };
+    for (std::multiset<TransportSocketPtr>::const_iterator it = fanout->subscribers.begin();
+         it != fanout->subscribers.end(); ++it)
+    {
+      const TransportSocketPtr& client = *it;
+      try
+      {
+        if (!shareable)
+        {
+          client->send(makeEvent(params, service, object, event, sig, client, context, signature));
+          continue;
+        }
+        const int kind = client->remoteCapability("MessageFlags", false) ? 1 : 0;
+        if (!isEncoded[kind])
+        {
+          encoded[kind] = makeEvent(params, service, object, event, sig, client, context, signature);
+          isEncoded[kind] = true;
+        }
+        client->send(encoded[kind]);
+      }
+      catch (const std::exception& e)
+      {
+        qiLogWarning() << "Failed to forward event " << event << " of service " << service
+                       << ": " << e.what();
+      }
+    }
     return AnyReference();
   }
 
@@ -104,6 +148,7 @@ namespace qi {
 
   ServiceBoundObject::~ServiceBoundObject()
   {
+    destroy();
     qiLogDebug() << "~ServiceBoundObject()";
     _cancelables.reset();
     ObjectHost::clear();
@@ -145,37 +190,94 @@ namespace qi {
     return result;
   }
 
-  // Bound Method
-  qi::Future<SignalLink> ServiceBoundObject::registerEvent(unsigned int objectId, unsigned int eventId, SignalLink remoteSignalLinkId) {
+  qi::Future<SignalLink> ServiceBoundObject::subscribeRemote(unsigned int eventId, SignalLink remoteSignalLinkId,
+                                                             const std::string& signature) {
     // fetch signature
     const MetaSignal* ms = _object.metaObject().signal(eventId);
     if (!ms)
       throw std::runtime_error("No such signal");
     QI_ASSERT(_currentSocket);
-    AnyFunction mc = AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, _serviceId, _objectId, eventId, ms->parametersSignature(), _currentSocket, this, ""));
-    qi::Future<SignalLink> linking = _object.connect(eventId, mc);
-    auto& linkEntry = _links[_currentSocket][remoteSignalLinkId];
-    linkEntry = RemoteSignalLink(linking, eventId);
-    return linking.andThen([=](SignalLink linkId) mutable {
+    ServiceSignalLinks& sl = _links[_currentSocket];
+    ServiceSignalLinks::iterator previous = sl.find(remoteSignalLinkId);
+    if (previous != sl.end())
+    {
+      unsubscribeRemote(_currentSocket, previous->second);
+      sl.erase(previous);
+    }
+    // All remote subscribers share one local subscription, so that each
+    // emission is serialized once.
+    const EventSubscriptionKey key(eventId, signature);
+    EventSubscription& sub = _eventSubscriptions[key];
+    if (!sub.fanout)
+    {
+      sub.fanout = boost::make_shared<EventFanout>();
+      const bool shareable = !detail::needsStreamContext(ms->parametersSignature())
+          && (signature.empty() || !detail::needsStreamContext(Signature(signature)));
+      AnyFunction mc = AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, _serviceId, _objectId, eventId, ms->parametersSignature(), sub.fanout, this, signature, shareable));
+      sub.localSignalLinkId = _object.connect(eventId, mc);
+      if (sub.localSignalLinkId.isFinished() && sub.localSignalLinkId.hasError())
+      {
+        qi::Future<SignalLink> failed = sub.localSignalLinkId;
+        _eventSubscriptions.erase(key);
+        return failed;
+      }
+      // asynchronous, _callMutex is held
+      sub.localSignalLinkId.connect(qi::bind(&ServiceBoundObject::onLocalSubscription, this, _1, key, sub.fanout),
+                                    FutureCallbackType_Async);
+    }
+    {
+      boost::unique_lock<boost::shared_mutex> lock(sub.fanout->mutex);
+      sub.fanout->subscribers.insert(_currentSocket);
+    }
+    sl[remoteSignalLinkId] = RemoteSignalLink(sub.localSignalLinkId, eventId, signature, sub.fanout);
+    return sub.localSignalLinkId.andThen([=](SignalLink linkId) mutable {
       qiLogDebug() << "SBO rl " << remoteSignalLinkId << " ll " << linkId;
       return linkId;
     });
   }
 
+  void ServiceBoundObject::onLocalSubscription(qi::Future<SignalLink> localSignalLinkId,
+                                               const EventSubscriptionKey& key, EventFanoutPtr fanout)
+  {
+    if (!localSignalLinkId.hasError())
+      return;
+    boost::mutex::scoped_lock callLock(_callMutex);
+    std::map<EventSubscriptionKey, EventSubscription>::iterator it = _eventSubscriptions.find(key);
+    // the key may have been subscribed again since
+    if (it != _eventSubscriptions.end() && it->second.fanout == fanout)
+      _eventSubscriptions.erase(it);
+  }
+
+  qi::Future<void> ServiceBoundObject::unsubscribeRemote(TransportSocketPtr client, const RemoteSignalLink& link) {
+    std::map<EventSubscriptionKey, EventSubscription>::iterator it =
+        _eventSubscriptions.find(std::make_pair(link.event, link.signature));
+    if (it == _eventSubscriptions.end() || it->second.fanout != link.fanout)
+      return qi::Future<void>(0);
+    {
+      // Waits for the emissions being sent, the client must not receive any
+      // once unsubscribed.
+      EventFanout& fanout = *it->second.fanout;
+      boost::unique_lock<boost::shared_mutex> lock(fanout.mutex);
+      std::multiset<TransportSocketPtr>::iterator sub = fanout.subscribers.find(client);
+      if (sub != fanout.subscribers.end())
+        fanout.subscribers.erase(sub);
+      if (!fanout.subscribers.empty())
+        return qi::Future<void>(0);
+    }
+    auto localSignalLinkId = it->second.localSignalLinkId;
+    _eventSubscriptions.erase(it);
+    return localSignalLinkId.andThen([=](SignalLink link) {
+      return _object.disconnect(link).async();
+    }).unwrap();
+  }
+
+  // Bound Method
+  qi::Future<SignalLink> ServiceBoundObject::registerEvent(unsigned int objectId, unsigned int eventId, SignalLink remoteSignalLinkId) {
+    return subscribeRemote(eventId, remoteSignalLinkId, std::string());
+  }
+
   qi::Future<SignalLink> ServiceBoundObject::registerEventWithSignature(unsigned int objectId, unsigned int eventId, SignalLink remoteSignalLinkId, const std::string& signature) {
-    // fetch signature
-    const MetaSignal* ms = _object.metaObject().signal(eventId);
-    if (!ms)
-      throw std::runtime_error("No such signal");
-    QI_ASSERT(_currentSocket);
-    AnyFunction mc = AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, _serviceId, _objectId, eventId, ms->parametersSignature(), _currentSocket, this, signature));
-    qi::Future<SignalLink> linking = _object.connect(eventId, mc);
-    auto& linkEntry = _links[_currentSocket][remoteSignalLinkId];
-    linkEntry = RemoteSignalLink(linking, eventId);
-    return linking.andThen([=](SignalLink linkId) mutable {
-      qiLogDebug() << "SBO rl " << remoteSignalLinkId << " ll " << linkId;
-      return linkId;
-    });
+    return subscribeRemote(eventId, remoteSignalLinkId, signature);
   }
 
   // Bound Method
@@ -191,13 +293,11 @@ namespace qi {
       throw std::runtime_error(ss.str());
     }
 
-    auto localSignalLinkId = it->second.localSignalLinkId;
+    const RemoteSignalLink link = it->second;
     sl.erase(it);
     if (sl.empty())
       _links.erase(_currentSocket);
-    return localSignalLinkId.andThen([=](SignalLink link) {
-      return _object.disconnect(link).async();
-    }).unwrap();
+    return unsubscribeRemote(_currentSocket, link);
   }
 
   // Bound Method
@@ -222,7 +322,6 @@ namespace qi {
   }
 
   void ServiceBoundObject::onMessage(const qi::Message &msg, TransportSocketPtr socket) {
-    boost::mutex::scoped_lock lock(_callMutex);
     try {
       if (msg.version() > qi::Message::currentVersion())
       {
@@ -243,6 +342,10 @@ namespace qi {
         return;
       }
 
+      // The caller already gave up, do not even decode the arguments.
+      if (msg.type() == qi::Message::Type_Call && msg.hasDeadline() && msg.deadline() <= SteadyClock::now())
+        throw std::runtime_error("Call deadline exceeded.");
+
       qi::AnyObject    obj;
       unsigned int     funcId;
       //choose between special function (on BoundObject) or normal calls
@@ -329,7 +432,10 @@ namespace qi {
         value = pContent;
       }
       mfp = value.asTupleValuePtr();
-      /* Because of 'global' _currentSocket, we cannot support parallel
+      /* Everything above runs concurrently, calls from different sockets are
+      * decoded in parallel.
+      *
+      * Because of 'global' _currentSocket, we cannot support parallel
       * executions at this point.
       * Both on self, and on obj which can use currentSocket() too.
       *
@@ -345,11 +451,16 @@ namespace qi {
       switch (msg.type())
       {
       case Message::Type_Call: {
-        boost::recursive_mutex::scoped_lock lock(_mutex);
-        _currentSocket = socket;
         qi::MetaCallType mType = obj == _self ? MetaCallType_Direct : _callType;
         qi::Signature sig = returnSignature.empty() ? Signature() : Signature(returnSignature);
-        qi::Future<AnyReference>  fut = obj.metaCall(funcId, mfp, mType, sig);
+        qi::Future<AnyReference>  fut;
+        {
+          boost::mutex::scoped_lock callLock(_callMutex);
+          boost::recursive_mutex::scoped_lock lock(_mutex);
+          _currentSocket = socket;
+          fut = obj.metaCall(funcId, mfp, mType, sig);
+          _currentSocket.reset();
+        }
         AtomicIntPtr cancelRequested = boost::make_shared<Atomic<int> >(0);
         {
           qiLogDebug() << this << " Registering future for " << socket.get() << ", message:" << msg.id();
@@ -360,13 +471,21 @@ namespace qi {
         const MetaMethod* mm = obj.metaObject().method(funcId);
         if (mm)
           retSig = mm->returnSignature();
-        _currentSocket.reset();
         fut.connect(boost::bind<void>
                     (&ServiceBoundObject::serverResultAdapter, _1, retSig, _gethost(), socket, msg.address(), sig,
                      CancelableKitWeak(_cancelables), cancelRequested));
+        if (msg.hasDeadline())
+        {
+          qi::Future<void> deadline = qi::asyncAt(
+              boost::bind(&ServiceBoundObject::_onCallDeadline, CancelableKitWeak(_cancelables),
+                          boost::weak_ptr<TransportSocket>(socket), msg.id()),
+              msg.deadline());
+          fut.connect([deadline](const qi::Future<AnyReference>&) mutable { deadline.cancel(); });
+        }
       }
         break;
       case Message::Type_Post: {
+        boost::mutex::scoped_lock callLock(_callMutex);
         if (obj == _self) // we need a sync call (see comment above), post does not provide it
           obj.metaCall(funcId, mfp, MetaCallType_Direct);
         else
@@ -397,11 +516,29 @@ namespace qi {
 
   void ServiceBoundObject::cancelCall(TransportSocketPtr socket, const Message& cancelMessage, MessageId origMsgId)
   {
+    _cancelCachedFuture(CancelableKitWeak(_cancelables), socket, origMsgId);
+  }
+
+  void ServiceBoundObject::_onCallDeadline(CancelableKitWeak kit, boost::weak_ptr<TransportSocket> sock, MessageId id)
+  {
+    TransportSocketPtr socket = sock.lock();
+    if (!socket)
+      return;
+    qiLogVerbose() << "Call " << id << " reached its deadline, canceling it";
+    _cancelCachedFuture(kit, socket, id);
+  }
+
+  void ServiceBoundObject::_cancelCachedFuture(CancelableKitWeak kit, TransportSocketPtr socket, MessageId origMsgId)
+  {
+    CancelableKitPtr kitPtr = kit.lock();
+    if (!kitPtr)
+      return;
+
     qiLogDebug() << "Canceling call: " << origMsgId << " on client " << socket.get();
     std::pair<Future<AnyReference>, AtomicIntPtr > fut;
     {
-      boost::mutex::scoped_lock lock(_cancelables->guard);
-      CancelableMap& cancelableCalls = _cancelables->map;
+      boost::mutex::scoped_lock lock(kitPtr->guard);
+      CancelableMap& cancelableCalls = kitPtr->map;
       CancelableMap::iterator it = cancelableCalls.find(socket);
       if (it == cancelableCalls.end())
       {
@@ -430,7 +567,7 @@ namespace qi {
     FutureState state = future.wait(0);
     if (state == FutureState_FinishedWithValue)
     {
-      _removeCachedFuture(CancelableKitWeak(_cancelables), socket, origMsgId);
+      _removeCachedFuture(kit, socket, origMsgId);
       // Check if we have an underlying future: in that case it needs
       // to be cancelled as well.
       AnyReference val = future.value();
@@ -475,6 +612,7 @@ namespace qi {
       boost::mutex::scoped_lock lock(_cancelables->guard);
       _cancelables->map.erase(client);
     }
+    boost::mutex::scoped_lock callLock(_callMutex);
     BySocketServiceSignalLinks::iterator it = _links.find(client);
     if (it != _links.end())
     {
@@ -482,7 +620,7 @@ namespace qi {
       {
         try
         {
-          _object.disconnect(jt->second.localSignalLinkId);
+          unsubscribeRemote(client, jt->second);
         }
         catch (const std::runtime_error& e)
         {
@@ -7,14 +7,17 @@
 #ifndef _SRC_BOUNDOBJECT_HPP_
 #define _SRC_BOUNDOBJECT_HPP_
 
+#include <set>
 #include <string>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/signals2.hpp>
 #include <qi/api.hpp>
 #include <qi/session.hpp>
 #include "transportserver.hpp"
 #include <qi/atomic.hpp>
 #include <qi/strand.hpp>
+#include <qi/trackable.hpp>
 
 #include "objecthost.hpp"
 
@@ -27,6 +30,18 @@ namespace qi {
   class ServiceDirectoryClient;
   class ServiceDirectory;
 
+  // Remote subscriptions to a signal, served by a single local subscription
+  // so that each emission is serialized once for all of them.
+  struct EventFanout
+  {
+    // held shared while an emission is sent, so that removing a subscriber
+    // waits for the emissions that may still reach it
+    boost::shared_mutex mutex;
+    // one entry per remote subscription
+    std::multiset<TransportSocketPtr> subscribers;
+  };
+  using EventFanoutPtr = boost::shared_ptr<EventFanout>;
+
   // (service, linkId)
   struct RemoteSignalLink
   {
@@ -35,12 +50,18 @@ namespace qi {
       , event(0)
     {}
 
-    RemoteSignalLink(qi::Future<SignalLink> localSignalLinkId, unsigned int event)
+    RemoteSignalLink(qi::Future<SignalLink> localSignalLinkId, unsigned int event,
+                     const std::string& signature = std::string(),
+                     EventFanoutPtr fanout = EventFanoutPtr())
     : localSignalLinkId(localSignalLinkId)
-    , event(event) {}
+    , event(event)
+    , signature(signature)
+    , fanout(fanout) {}
 
     qi::Future<SignalLink> localSignalLinkId;
     unsigned int event;
+    std::string signature; // forced by the subscriber, if any
+    EventFanoutPtr fanout; // the subscription this link was added to
   };
 
 
@@ -54,7 +75,7 @@ namespace qi {
 
   //Bound Object, represent an object bound on a server
   // this is not an object..
-  class ServiceBoundObject : public BoundObject, public ObjectHost, boost::noncopyable {
+  class ServiceBoundObject : public BoundObject, public ObjectHost, public Trackable<ServiceBoundObject>, boost::noncopyable {
 
   public:
     ServiceBoundObject(unsigned int serviceId, unsigned int objectId,
@@ -117,6 +138,9 @@ namespace qi {
 
     inline ObjectHost* _gethost() { return _owner ? _owner : this; }
     static void _removeCachedFuture(CancelableKitWeak kit, TransportSocketPtr sock, MessageId id);
+    static void _cancelCachedFuture(CancelableKitWeak kit, TransportSocketPtr sock, MessageId id);
+    /// Cancels the call if still running once its deadline passed.
+    static void _onCallDeadline(CancelableKitWeak kit, boost::weak_ptr<TransportSocket> sock, MessageId id);
     static void serverResultAdapterNext(AnyReference val, Signature targetSignature, ObjectHost* host,
                                  TransportSocketPtr sock, const MessageAddress& replyAddr,
                                  const Signature& forcedReturnSignature, CancelableKitWeak kit);
@@ -130,9 +154,27 @@ namespace qi {
     using ServiceSignalLinks = std::map<SignalLink, RemoteSignalLink>;
     using BySocketServiceSignalLinks = std::map<qi::TransportSocketPtr, ServiceSignalLinks>;
 
-    //Event handling (no lock needed)
+    //Event handling (protected by _callMutex)
     BySocketServiceSignalLinks  _links;
-
+    // (event, forced signature) -> shared local subscription
+    struct EventSubscription
+    {
+      qi::Future<SignalLink> localSignalLinkId;
+      EventFanoutPtr fanout;
+    };
+    using EventSubscriptionKey = std::pair<unsigned int, std::string>;
+    std::map<EventSubscriptionKey, EventSubscription> _eventSubscriptions;
+
+    qi::Future<SignalLink> subscribeRemote(unsigned int eventId, SignalLink remoteSignalLinkId,
+                                           const std::string& signature);
+    // forgets the subscription of @p fanout if its local subscription failed
+    void onLocalSubscription(qi::Future<SignalLink> localSignalLinkId, const EventSubscriptionKey& key,
+                             EventFanoutPtr fanout);
+    /// Removes one remote subscription of @p client, disconnecting the local
+    /// subscription with the last one.
+    qi::Future<void> unsubscribeRemote(TransportSocketPtr client, const RemoteSignalLink& link);
+
+    // serializes the calls made with _currentSocket set, not their decoding
     boost::mutex _callMutex;
   private:
     qi::TransportSocketPtr _currentSocket;
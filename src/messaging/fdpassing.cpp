@@ -0,0 +1,191 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+#include "fdpassing.hpp"
+
+qiLogCategory("qimessaging.fdpassing");
+
+namespace qi
+{
+  namespace detail
+  {
+    static const int sealsAgainstChanges = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+    size_t fdPassingThreshold()
+    {
+      static size_t res = 0;
+      static bool init = false;
+      // Not thread-safe, limited consequences
+      if (!init)
+      {
+        std::string l = os::getenv("QI_FD_PASSING_THRESHOLD");
+        res = l.empty() ? 1024 * 1024 : strtol(l.c_str(), 0, 0);
+        init = true;
+      }
+      return res;
+    }
+
+    int makeSealedMemfd(const void* data, size_t size)
+    {
+      int fd = static_cast<int>(memfd_create("qimessaging-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+      if (fd == -1)
+      {
+        qiLogVerbose() << "memfd_create: " << strerror(errno);
+        return -1;
+      }
+      const char* p = static_cast<const char*>(data);
+      size_t done = 0;
+      while (done < size)
+      {
+        ssize_t res = ::write(fd, p + done, size - done);
+        if (res < 0 && errno == EINTR)
+          continue;
+        if (res <= 0)
+        {
+          qiLogVerbose() << "write to memfd: " << strerror(errno);
+          ::close(fd);
+          return -1;
+        }
+        done += res;
+      }
+      if (fcntl(fd, F_ADD_SEALS, sealsAgainstChanges | F_SEAL_SEAL) == -1)
+      {
+        qiLogVerbose() << "sealing memfd: " << strerror(errno);
+        ::close(fd);
+        return -1;
+      }
+      return fd;
+    }
+
+    static void unmap(void* ptr, size_t size)
+    {
+      munmap(ptr, size);
+    }
+
+    bool mapSealedMemfd(int fd, size_t size, Buffer& result)
+    {
+      // The sender must not be able to change the content behind our back,
+      // nor to shrink it which would fault on access.
+      int seals = fcntl(fd, F_GET_SEALS);
+      struct stat st;
+      if (seals == -1 || (seals & sealsAgainstChanges) != sealsAgainstChanges
+          || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != size || size == 0)
+      {
+        qiLogWarning() << "Received a file descriptor that is not a sealed buffer of size " << size;
+        ::close(fd);
+        return false;
+      }
+      // Private mapping: writes through Buffer::data() stay local.
+      void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (ptr == MAP_FAILED)
+      {
+        qiLogWarning() << "mmap: " << strerror(errno);
+        return false;
+      }
+      result = Buffer(ptr, size, boost::bind(&unmap, ptr, size));
+      return true;
+    }
+
+    long sendWithFds(int socket, const std::vector<boost::asio::const_buffer>& buffers,
+                     const std::vector<int>& fds)
+    {
+      std::vector<struct iovec> iov(std::min(buffers.size(), static_cast<size_t>(IOV_MAX)));
+      for (unsigned i = 0; i < iov.size(); ++i)
+      {
+        iov[i].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(buffers[i]));
+        iov[i].iov_len = boost::asio::buffer_size(buffers[i]);
+      }
+      union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(maxPassedFds * sizeof(int))];
+      } control;
+      struct msghdr mh;
+      memset(&mh, 0, sizeof(mh));
+      mh.msg_iov = iov.data();
+      mh.msg_iovlen = iov.size();
+      if (!fds.empty())
+      {
+        if (fds.size() > maxPassedFds)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+      }
+      ssize_t res;
+      do
+        res = sendmsg(socket, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+      while (res < 0 && errno == EINTR);
+      return res;
+    }
+
+    long receiveWithFds(int socket, void* data, size_t size, std::deque<int>& fds)
+    {
+      struct iovec iov;
+      iov.iov_base = data;
+      iov.iov_len = size;
+      union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(maxPassedFds * sizeof(int))];
+      } control;
+      struct msghdr mh;
+      memset(&mh, 0, sizeof(mh));
+      mh.msg_iov = &iov;
+      mh.msg_iovlen = 1;
+      mh.msg_control = control.buf;
+      mh.msg_controllen = sizeof(control.buf);
+      ssize_t res;
+      do
+        res = recvmsg(socket, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+      while (res < 0 && errno == EINTR);
+      if (res <= 0)
+        return res;
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+      {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+          continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char* p = CMSG_DATA(cmsg);
+        for (size_t i = 0; i < count; ++i)
+        {
+          int fd;
+          memcpy(&fd, p + i * sizeof(int), sizeof(int));
+          fds.push_back(fd);
+        }
+      }
+      if (mh.msg_flags & MSG_CTRUNC)
+      {
+        // Descriptors were lost, the stream can no longer be trusted.
+        errno = EPROTO;
+        return -1;
+      }
+      return res;
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_FDPASSING_HPP_
+#define _SRC_FDPASSING_HPP_
+
+# include <deque>
+# include <vector>
+# include <boost/asio/buffer.hpp>
+# include <qi/buffer.hpp>
+
+namespace qi
+{
+  namespace detail
+  {
+    /// Maximum number of file descriptors sent along with one write.
+    static const unsigned int maxPassedFds = 16;
+
+    /// Sub-buffers at least that large are passed as file descriptors on
+    /// local sockets, 0 if disabled (configure with QI_FD_PASSING_THRESHOLD).
+    size_t fdPassingThreshold();
+
+    /// Copy @p size bytes at @p data into a new memfd sealed against any
+    /// modification, return its descriptor or -1 on failure.
+    int makeSealedMemfd(const void* data, size_t size);
+
+    /// Map the content of @p fd, a memfd of @p size bytes made by
+    /// makeSealedMemfd, into @p result without copying it. Takes ownership
+    /// of @p fd. Return false if it is not a sealed memfd of that size.
+    bool mapSealedMemfd(int fd, size_t size, Buffer& result);
+
+    /// sendmsg() as much of @p buffers as possible on @p socket without
+    /// blocking, with @p fds attached to the first byte.
+    /// @return the number of bytes sent, -1 with errno set on failure.
+    long sendWithFds(int socket, const std::vector<boost::asio::const_buffer>& buffers,
+                     const std::vector<int>& fds);
+
+    /// recvmsg() at most @p size bytes from @p socket without blocking,
+    /// appending the descriptors received along to @p fds.
+    /// @return the number of bytes received, -1 with errno set on failure.
+    long receiveWithFds(int socket, void* data, size_t size, std::deque<int>& fds);
+  }
+}
+
+#endif  // _SRC_FDPASSING_HPP_
@@ -78,6 +78,79 @@ using boolptr = boost::shared_ptr<bool>;
 
 namespace qi
 {
+void OngoingMessages::insert(ServiceId service, GWMessageId id, const ClientInfo& client)
+{
+  Shard& s = shard(id);
+  boost::mutex::scoped_lock lock(s.mutex);
+  s.messages[MessageKey(service, id)] = client;
+}
+
+TransportSocketPtr OngoingMessages::client(ServiceId service, GWMessageId id)
+{
+  Shard& s = shard(id);
+  boost::mutex::scoped_lock lock(s.mutex);
+  auto it = s.messages.find(MessageKey(service, id));
+  if (it == s.messages.end())
+    return TransportSocketPtr();
+  return it->second.socket;
+}
+
+bool OngoingMessages::take(ServiceId service, GWMessageId id, ClientInfo& client)
+{
+  Shard& s = shard(id);
+  boost::mutex::scoped_lock lock(s.mutex);
+  auto it = s.messages.find(MessageKey(service, id));
+  if (it == s.messages.end())
+    return false;
+  client = it->second;
+  s.messages.erase(it);
+  return true;
+}
+
+std::vector<ClientInfo> OngoingMessages::takeService(ServiceId service)
+{
+  std::vector<ClientInfo> clients;
+  for (Shard& s : _shards)
+  {
+    boost::mutex::scoped_lock lock(s.mutex);
+    for (auto it = s.messages.begin(); it != s.messages.end();)
+    {
+      if (it->first.first == service)
+      {
+        clients.push_back(it->second);
+        it = s.messages.erase(it);
+      }
+      else
+        ++it;
+    }
+  }
+  return clients;
+}
+
+void OngoingMessages::removeClient(TransportSocketPtr client)
+{
+  for (Shard& s : _shards)
+  {
+    boost::mutex::scoped_lock lock(s.mutex);
+    for (auto it = s.messages.begin(); it != s.messages.end();)
+    {
+      if (it->second.socket == client)
+        it = s.messages.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void OngoingMessages::clear()
+{
+  for (Shard& s : _shards)
+  {
+    boost::mutex::scoped_lock lock(s.mutex);
+    s.messages.clear();
+  }
+}
+
 void GwTransaction::forceDestination(TransportSocketPtr dest)
 {
   _destination = dest;
@@ -143,6 +216,7 @@ qi::Future<void> Gateway::attachToServiceDirectory(const Url& serviceDirectoryUr
 
 GatewayPrivate::GatewayPrivate(bool ea)
   : _enforceAuth(ea)
+  , _services(boost::make_shared<ServiceMap>())
   , _dying(false)
 {
   _socketCache.init();
@@ -175,13 +249,14 @@ void GatewayPrivate::close(bool clearEndpoints)
     std::vector<qi::Future<void>> disconnections;
     {
       boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-      disconnections.reserve(_services.size());
-      for (const auto& serviceSlot : _services)
+      ServiceMapPtr services = this->services();
+      disconnections.reserve(services->size());
+      for (const auto& serviceSlot : *services)
       {
         if (serviceSlot.second && serviceSlot.first != ServiceSD && serviceSlot.second->isConnected())
           disconnections.emplace_back(serviceSlot.second->disconnect());
       }
-      _services.clear();
+      boost::atomic_store(&_services, ServiceMapPtr(boost::make_shared<ServiceMap>()));
       _sdAvailableServices.clear();
     }
     qi::waitForAll(disconnections);
@@ -198,18 +273,19 @@ void GatewayPrivate::close(bool clearEndpoints)
     qi::waitForAll(disconnections);
     _clients.clear();
   }
-  {
-    boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-    _ongoingMessages.clear();
-  }
+  _ongoingMessages.clear();
   {
     boost::mutex::scoped_lock lock(_pendingMsgMutex);
     _pendingMessages.clear();
   }
+  for (EventShard& shard : _eventShards)
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
+    shard.subscribers.clear();
+  }
+  {
+    boost::mutex::scoped_lock lock(_pendingEventSubMutex);
     _pendingEventSubscriptions.clear();
-    _eventSubscribers.clear();
   }
   if (clearEndpoints)
     _endpoints.clear();
@@ -352,21 +428,47 @@ void GatewayPrivate::updateEndpoints(const qi::Url& url)
 
 TransportSocketPtr GatewayPrivate::safeGetService(ServiceId id)
 {
-  boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-  std::map<ServiceId, TransportSocketPtr>::iterator it;
-  if ((it = _services.find(id)) == _services.end())
+  ServiceMapPtr services = this->services();
+  ServiceMap::const_iterator it = services->find(id);
+  if (it == services->end())
     return TransportSocketPtr();
   return it->second;
 }
 
+GatewayPrivate::ServiceMapPtr GatewayPrivate::services() const
+{
+  return boost::atomic_load(&_services);
+}
+
+void GatewayPrivate::setService(ServiceId id, TransportSocketPtr socket)
+{
+  boost::recursive_mutex::scoped_lock lock(_serviceMutex);
+  boost::shared_ptr<ServiceMap> services = boost::make_shared<ServiceMap>(*this->services());
+  (*services)[id] = socket;
+  boost::atomic_store(&_services, ServiceMapPtr(services));
+}
+
+void GatewayPrivate::eraseService(ServiceId id)
+{
+  boost::recursive_mutex::scoped_lock lock(_serviceMutex);
+  ServiceMapPtr current = services();
+  if (current->find(id) == current->end())
+    return;
+  boost::shared_ptr<ServiceMap> services = boost::make_shared<ServiceMap>(*current);
+  services->erase(id);
+  boost::atomic_store(&_services, ServiceMapPtr(services));
+}
+
 void GatewayPrivate::onClientDisconnected(TransportSocketPtr socket, std::string url, const std::string& reason)
 {
   qiLogVerbose() << "Client " << url << " has left us: " << reason;
+  for (EventShard& shard : _eventShards)
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
-    _eventSubscribers.erase(socket);
-    EventsEndpointMap::iterator it = _eventSubscribers.begin();
-    while (it != _eventSubscribers.end())
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
+    EventsEndpointMap& subscribers = shard.subscribers;
+    subscribers.erase(socket);
+    EventsEndpointMap::iterator it = subscribers.begin();
+    while (it != subscribers.end())
     {
       EventServiceMap::iterator sit = it->second.begin();
       while (sit != it->second.end())
@@ -397,28 +499,12 @@ void GatewayPrivate::onClientDisconnected(TransportSocketPtr socket, std::string
           ++sit;
       }
       if (it->second.size() == 0)
-        it = _eventSubscribers.erase(it);
+        it = subscribers.erase(it);
       else
         ++it;
     }
   }
-  {
-    boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-    OngoingMessagesMap::iterator it = _ongoingMessages.begin();
-    OngoingMessagesMap::iterator end = _ongoingMessages.end();
-    for (; it != end; ++it)
-    {
-      IdLookupMap::iterator msgIt = it->second.begin();
-      IdLookupMap::iterator msgEnd = it->second.end();
-      while (msgIt != msgEnd)
-      {
-        if (msgIt->second.socket == socket)
-          it->second.erase(msgIt++);
-        else
-          msgIt++;
-      }
-    }
-  }
+  _ongoingMessages.removeClient(socket);
   {
     boost::mutex::scoped_lock lock(_pendingMsgMutex);
     PendingMessagesMap::iterator it = _pendingMessages.begin();
@@ -436,19 +522,13 @@ void GatewayPrivate::onClientDisconnected(TransportSocketPtr socket, std::string
   {
     // Check if this client was hosting any service,
     // and if so clean them up.
-    boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-    std::map<ServiceId, TransportSocketPtr>::iterator it = _services.begin();
-    std::map<ServiceId, TransportSocketPtr>::iterator end = _services.end();
-    for (; it != end;)
-      if (it->second == socket)
+    ServiceMapPtr services = this->services();
+    for (const auto& service : *services)
+      if (service.second == socket)
       {
-        ServiceId sid = it->first;
-        ++it;
-        serviceDisconnected(sid);
-        unregisterServiceFromSD(sid);
+        serviceDisconnected(service.first);
+        unregisterServiceFromSD(service.first);
       }
-      else
-        ++it;
   }
   {
     boost::mutex::scoped_lock lock(_clientsMutex);
@@ -517,10 +597,11 @@ void GatewayPrivate::serviceDisconnected(ServiceId sid)
 {
   qiLogVerbose() << "Disconnecting service #" << sid;
   invalidateClientsMessages(sid);
+  for (EventShard& shard : _eventShards)
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
 
-    for (EventsEndpointMap::iterator it = _eventSubscribers.begin(), end = _eventSubscribers.end(); it != end; ++it)
+    for (EventsEndpointMap::iterator it = shard.subscribers.begin(), end = shard.subscribers.end(); it != end; ++it)
     {
       EventServiceMap::iterator sit = it->second.find(sid);
       if (sit != it->second.end())
@@ -530,11 +611,7 @@ void GatewayPrivate::serviceDisconnected(ServiceId sid)
       }
     }
   }
-  {
-    boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-    if (_services.find(sid) != _services.end())
-      _services.erase(sid);
-  }
+  eraseService(sid);
   _objectHost.serviceDisconnected(sid);
 }
 
@@ -554,7 +631,7 @@ void GatewayPrivate::onSdServiceRemoved(ServiceId id)
   {
     boost::recursive_mutex::scoped_lock lock(_serviceMutex);
     _sdAvailableServices.erase(id);
-    isOnGateway = _services.find(id) != _services.end();
+    isOnGateway = services()->count(id) != 0;
   }
   if (isOnGateway)
     serviceDisconnected(id);
@@ -566,7 +643,7 @@ void GatewayPrivate::onSdConnected(Future<void> fut, Promise<void> prom)
     return prom.setError(fut.error());
   TransportSocketPtr sdSocket = _sdClient.socket();
 
-  _services[ServiceSD] = sdSocket;
+  setService(ServiceSD, sdSocket);
   // Additional checks are required for some of the SD's messages, so it gets
   // it's own messageReady callback.
   sdSocket->messageReady.connect(&GatewayPrivate::onServiceDirectoryMessageReady, this, _1, sdSocket);
@@ -584,10 +661,14 @@ void GatewayPrivate::onSdConnected(Future<void> fut, Promise<void> prom)
   // We use a null transport socket to avoid additional checks when events are triggered:
   // instead we'll run a nop function.
   manualInfo.remoteSubscribers[boost::make_shared<NullTransportSocket>()] = 0;
-  ClientsPerEventMap& sdEvents = _eventSubscribers[sdSocket][ServiceSD][Message::GenericObject_Main];
-  sdEvents[_sdClient.metaObject().signalId("serviceAdded")] = manualInfo;
-  manualInfo.gwLink = 1;
-  sdEvents[_sdClient.metaObject().signalId("serviceRemoved")] = manualInfo;
+  {
+    EventShard& shard = eventShard(sdSocket);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
+    ClientsPerEventMap& sdEvents = shard.subscribers[sdSocket][ServiceSD][Message::GenericObject_Main];
+    sdEvents[_sdClient.metaObject().signalId("serviceAdded")] = manualInfo;
+    manualInfo.gwLink = 1;
+    sdEvents[_sdClient.metaObject().signalId("serviceRemoved")] = manualInfo;
+  }
 
   ServiceInfoVector services = _sdClient.services();
   ServiceInfoVector::const_iterator it = services.begin();
@@ -616,7 +697,8 @@ Future<void> GatewayPrivate::connect(const Url& sdUrl)
 void GatewayPrivate::forwardMessage(ClientMessageId origId,
                                     const Message& forward,
                                     TransportSocketPtr origin,
-                                    TransportSocketPtr destination)
+                                    TransportSocketPtr destination,
+                                    const boost::optional<SteadyClockTimePoint>& deadline)
 {
   const ServiceId service = forward.service();
   const GWMessageId gwId = forward.id();
@@ -628,11 +710,16 @@ void GatewayPrivate::forwardMessage(ClientMessageId origId,
     // it as our key in our map message.
     qiLogDebug() << "Forward message: " << forward.address() << " Original id:" << origId
                  << " Origin: " << origin.get() << " Destination: " << destination.get();
+    _ongoingMessages.insert(service, gwId, { origId, origin });
+    if (deadline && destination->remoteCapability("CallDeadlines", false))
     {
-      boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-      _ongoingMessages[service][gwId] = { origId, origin };
+      // Let the service expire the call, with the time left from now.
+      Message withDeadline(forward);
+      withDeadline.setDeadline(*deadline);
+      destination->send(withDeadline);
     }
-    destination->send(forward);
+    else
+      destination->send(forward);
   }
   else
   {
@@ -896,10 +983,7 @@ void GatewayPrivate::localServiceRegistrationCont(Future<TransportSocketPtr> fut
 
 void GatewayPrivate::localServiceRegistrationEnd(TransportSocketPtr socket, ServiceId sid)
 {
-  {
-    boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-    _services[sid] = socket;
-  }
+  setService(sid, socket);
   {
     boost::mutex::scoped_lock lock(_pendingMsgMutex);
     auto it = _pendingMessages[sid].begin();
@@ -911,7 +995,8 @@ void GatewayPrivate::localServiceRegistrationEnd(TransportSocketPtr socket, Serv
       forwardMessage(it->clientId,
                      it->message,
                      it->target,
-                     safeGetService(it->message.service()));
+                     safeGetService(it->message.service()),
+                     it->deadline);
     _pendingMessages[sid].clear();
     _pendingMessages.erase(sid);
   }
@@ -928,8 +1013,9 @@ void GatewayPrivate::removeEventSubscriber(ServiceId sid,
   int remainingSubs = 0;
   SignalLink gwLink = 0;
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
-    EventSubInfo& info = _eventSubscribers[host][sid][object][event];
+    EventShard& shard = eventShard(host);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
+    EventSubInfo& info = shard.subscribers[host][sid][object][event];
 
     gwLink = info.gwLink;
     info.remoteSubscribers.erase(client);
@@ -1010,6 +1096,9 @@ GWMessageId GatewayPrivate::handleCallMessage(GwTransaction& t, TransportSocketP
   forward.setFunction(msg.function());
   forward.setBuffer(msg.buffer());
   forward.setFlags(msg.flags());
+  boost::optional<SteadyClockTimePoint> deadline;
+  if (msg.hasDeadline())
+    deadline = msg.deadline();
   // Check if we already have a connection to this service
   if (!serviceSocket || !serviceSocket->isConnected())
   {
@@ -1038,7 +1127,7 @@ GWMessageId GatewayPrivate::handleCallMessage(GwTransaction& t, TransportSocketP
         // if there are pendingMessages already, it means we're already actively trying to
         // connect to the service: don't request it a second time.
         requestService = _pendingMessages[targetService].size() == 0;
-        _pendingMessages[targetService].push_back({ msg.id(), forward, origin });
+        _pendingMessages[targetService].push_back({ msg.id(), forward, origin, deadline });
       }
       if (requestService)
       {
@@ -1048,7 +1137,7 @@ GWMessageId GatewayPrivate::handleCallMessage(GwTransaction& t, TransportSocketP
     }
     return forward.id();
   }
-  forwardMessage(msg.id(), forward, origin, t.destination());
+  forwardMessage(msg.id(), forward, origin, t.destination(), deadline);
   return forward.id();
 }
 
@@ -1065,16 +1154,11 @@ void GatewayPrivate::handleReplyMessage(GwTransaction& t)
     service = _objectHost.getOriginalObjectAddress(ObjectAddress(service, msg.object())).service;
   }
 
+  // This is likely an internal message and so can be ignored here
+  if (!_ongoingMessages.take(service, gwId, client))
   {
-    boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-    // This is likely an internal message and so can be ignored here
-    if (_ongoingMessages[service].find(gwId) == _ongoingMessages[service].end())
-    {
-      qiLogDebug() << "Reply with no original message [" << gwId << "]: " << t.content.address();
-      return;
-    }
-    client = _ongoingMessages[service][gwId];
-    _ongoingMessages[service].erase(gwId);
+    qiLogDebug() << "Reply with no original message [" << gwId << "]: " << t.content.address();
+    return;
   }
 
   qiLogDebug() << "Reply to socket " << client.socket << " with original ID " << client.id;
@@ -1095,14 +1179,16 @@ void GatewayPrivate::handleEventMessage(GwTransaction& t, TransportSocketPtr soc
   unsigned int object = msg.object();
   unsigned int event = msg.event();
 
+  std::vector<TransportSocketPtr> subscribers;
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    EventShard& shard = eventShard(socket);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
     qiLogDebug() << "Handling event " << service << "." << object << "." << event << "...";
     EventsEndpointMap::iterator endpointIt;
     EventServiceMap::iterator serviceIt;
     EventsPerObjectMap::iterator objectIt;
     ClientsPerEventMap::iterator eventIt;
-    if ((endpointIt = _eventSubscribers.find(socket)) == _eventSubscribers.end() ||
+    if ((endpointIt = shard.subscribers.find(socket)) == shard.subscribers.end() ||
         (serviceIt = endpointIt->second.find(service)) == endpointIt->second.end() ||
         (objectIt = serviceIt->second.find(object)) == serviceIt->second.end() ||
         (eventIt = objectIt->second.find(event)) == objectIt->second.end())
@@ -1112,11 +1198,15 @@ void GatewayPrivate::handleEventMessage(GwTransaction& t, TransportSocketPtr soc
     }
 
     std::map<TransportSocketPtr, SignalLink>& subs = eventIt->second.remoteSubscribers;
-
-    qiLogDebug() << "Forwarding event to " << subs.size() << " subscribers.";
+    subscribers.reserve(subs.size());
     for (std::map<TransportSocketPtr, SignalLink>::iterator it = subs.begin(), end = subs.end(); it != end; ++it)
-      it->first->send(msg);
+      subscribers.push_back(it->first);
   }
+
+  // Send outside of the lock, a slow subscriber must not hold up the others.
+  qiLogDebug() << "Forwarding event to " << subscribers.size() << " subscribers.";
+  for (const TransportSocketPtr& subscriber : subscribers)
+    subscriber->send(msg);
 }
 
 void GatewayPrivate::onAnyMessageReady(const Message& msg, TransportSocketPtr socket)
@@ -1129,22 +1219,11 @@ void GatewayPrivate::onAnyMessageReady(const Message& msg, TransportSocketPtr so
     TransportSocketPtr destination = [&]() -> TransportSocketPtr {
 
       // This is likely an internal message and so can be ignored here
-      {
-        boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-        auto& messageMap = _ongoingMessages[serviceId];
-        auto foundIt = messageMap.find(gwId);
-        if (foundIt != _ongoingMessages[serviceId].end() && foundIt->second.socket)
-          return foundIt->second.socket;
-      }
+      if (TransportSocketPtr client = _ongoingMessages.client(serviceId, gwId))
+        return client;
 
-      {
-        boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-        auto foundIt = _services.find(serviceId);
-        if (foundIt != _services.end() && foundIt->second)
-        {
-          return foundIt->second;
-        }
-      }
+      if (TransportSocketPtr service = safeGetService(serviceId))
+        return service;
 
       return _objectHost.objectSource({ msg.service(), msg.object() }).socket;
     }();
@@ -1272,16 +1351,9 @@ void GatewayPrivate::onServiceDirectoryMessageReady(const Message& msg, Transpor
   case Message::ServiceDirectoryAction_RegisterService:
     if (msg.type() != Message::Type_Error)
     {
-      TransportSocketPtr origin;
-      {
-        boost::mutex::scoped_lock lock(_ongoingMsgMutex);
-        origin = _ongoingMessages[ServiceSD][msg.id()].socket;
-      }
+      TransportSocketPtr origin = _ongoingMessages.client(ServiceSD, msg.id());
       int serviceId = msg.value("I", socket).to<unsigned int>();
-      {
-        boost::recursive_mutex::scoped_lock lock(_serviceMutex);
-        _services[serviceId] = origin;
-      }
+      setService(serviceId, origin);
     }
     break;
   }
@@ -1302,27 +1374,31 @@ void GatewayPrivate::registerEventListenerCall(GwTransaction& t, TransportSocket
 {
   static const char* sig = "(IIL)";
   Message& msg = t.content;
+  // Three integers: decoding them right away is cheaper than a lazy tuple,
+  // and does not keep the message buffer alive.
   AnyReference values = msg.value(sig, origin);
+  EventId event = values[1].to<unsigned int>();
+  SignalLink signalLink = values[2].to<SignalLink>();
+  values.destroy();
   /*
    * Need to use the original object/service ID:
    * when the event is on a client object, we need to see
    * the translated endpoint (which are the original values of the
    * call, originating from a service).
    */
-  EventId event = values[1].to<unsigned int>();
   ServiceId serviceId = t.originalService();
   ObjectId objectId = t.originalObject();
   t.setDestinationIfNull(safeGetService(serviceId));
   EventHostEndpoint eventHost = t.destination();
-  SignalLink signalLink = values[2].to<SignalLink>();
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    EventShard& shard = eventShard(eventHost);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
     EventsEndpointMap::iterator endpointIt;
     EventServiceMap::iterator serviceIt;
     EventsPerObjectMap::iterator objectIt;
     ClientsPerEventMap::iterator eventIt;
     // Check if this client is the first one to subscribe.
-    if ((endpointIt = _eventSubscribers.find(eventHost)) == _eventSubscribers.end() ||
+    if ((endpointIt = shard.subscribers.find(eventHost)) == shard.subscribers.end() ||
         (serviceIt = endpointIt->second.find(serviceId)) == endpointIt->second.end() ||
         (objectIt = serviceIt->second.find(objectId)) == serviceIt->second.end() ||
         (eventIt = objectIt->second.find(event)) == objectIt->second.end())
@@ -1331,6 +1407,9 @@ void GatewayPrivate::registerEventListenerCall(GwTransaction& t, TransportSocket
       // if this cLient is the first to subscribe to this event,
       // we have to send a subscription message to the service
       // to make the connection.
+      // Hold the pending lock while sending so that the reply cannot be
+      // handled before the subscription is recorded.
+      boost::mutex::scoped_lock pendingLock(_pendingEventSubMutex);
       GWMessageId id = handleCallMessage(t, origin);
       _pendingEventSubscriptions[id] = { serviceId, objectId, event, signalLink, origin, eventHost };
       return;
@@ -1339,7 +1418,6 @@ void GatewayPrivate::registerEventListenerCall(GwTransaction& t, TransportSocket
       // If some clients were already subscribed, add this new client to the list.
       eventIt->second.remoteSubscribers[origin] = signalLink;
   }
-  values.destroy();
 
   // Otherwise, handle the response ourself and
   // return their own signalLink
@@ -1359,8 +1437,9 @@ void GatewayPrivate::registerEventListenerReply(GwTransaction& t, TransportSocke
   Message& msg = t.content;
   GWMessageId msgId = msg.id();
   SignalLink link = 0;
+  EventHostEndpoint eventHost;
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    boost::mutex::scoped_lock lock(_pendingEventSubMutex);
     std::map<GWMessageId, EventAddress>::iterator evIt = _pendingEventSubscriptions.find(msgId);
 
     if (evIt == _pendingEventSubscriptions.end() || msg.type() == Message::Type_Error)
@@ -1370,9 +1449,23 @@ void GatewayPrivate::registerEventListenerReply(GwTransaction& t, TransportSocke
       lock.unlock();
       return handleReplyMessage(t);
     }
+    eventHost = evIt->second.hostSocket;
+  }
+  {
+    // The shard lock must be taken before the pending one.
+    EventShard& shard = eventShard(eventHost);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
+    boost::mutex::scoped_lock pendingLock(_pendingEventSubMutex);
+    std::map<GWMessageId, EventAddress>::iterator evIt = _pendingEventSubscriptions.find(msgId);
+    if (evIt == _pendingEventSubscriptions.end())
+    {
+      pendingLock.unlock();
+      lock.unlock();
+      return handleReplyMessage(t);
+    }
 
     const EventAddress& evt = evIt->second;
-    EventSubInfo& eventInfo = _eventSubscribers[evt.hostSocket][evt.serviceId][evt.objectId][evt.eventId];
+    EventSubInfo& eventInfo = shard.subscribers[evt.hostSocket][evt.serviceId][evt.objectId][evt.eventId];
     eventInfo.remoteSubscribers[evt.subscriberSocket] = evt.signalLink;
     eventInfo.gwLink = evt.signalLink;
     _pendingEventSubscriptions.erase(evIt);
@@ -1393,21 +1486,22 @@ void GatewayPrivate::unregisterEventListenerCall(GwTransaction& t, TransportSock
 {
   static const char* sig = "(IIL)";
   AnyReference values = t.content.value(sig, origin);
+  unsigned int event = values[1].to<unsigned int>();
+  values.destroy();
   ServiceId service = t.originalService();
   ObjectId object = t.originalObject();
-  unsigned int event = values[1].to<unsigned int>();
   t.setDestinationIfNull(safeGetService(service));
   EventHostEndpoint eventHost = t.destination();
 
-  values.destroy();
   {
-    boost::recursive_mutex::scoped_lock lock(_eventSubMutex);
+    EventShard& shard = eventShard(eventHost);
+    boost::recursive_mutex::scoped_lock lock(shard.mutex);
     EventsEndpointMap::iterator endpointIt;
     EventServiceMap::iterator serviceIt;
     EventsPerObjectMap::iterator objectIt;
     ClientsPerEventMap::iterator eventIt;
 
-    if ((endpointIt = _eventSubscribers.find(eventHost)) == _eventSubscribers.end() ||
+    if ((endpointIt = shard.subscribers.find(eventHost)) == shard.subscribers.end() ||
         (serviceIt = endpointIt->second.find(service)) == endpointIt->second.end() ||
         (objectIt = serviceIt->second.find(object)) == serviceIt->second.end() ||
         (eventIt = objectIt->second.find(event)) == objectIt->second.end())
@@ -1428,7 +1522,7 @@ void GatewayPrivate::unregisterEventListenerCall(GwTransaction& t, TransportSock
         {
           endpointIt->second.erase(serviceIt);
           if (endpointIt->second.size() == 0)
-            _eventSubscribers.erase(endpointIt);
+            shard.subscribers.erase(endpointIt);
         }
       }
     }
@@ -1460,18 +1554,12 @@ void GatewayPrivate::invalidateClientsMessages(ServiceId sid)
     _pendingMessages.erase(sid);
   }
   {
-    boost::mutex::scoped_lock lock(_ongoingMsgMutex);
     Message forged;
-    IdLookupMap::iterator it = _ongoingMessages[sid].begin();
-    IdLookupMap::iterator end = _ongoingMessages[sid].end();
-
-    for (; it != end; ++it)
+    for (const ClientInfo& client : _ongoingMessages.takeService(sid))
     {
-      forged.setId(it->second.id);
-      serviceUnavailable(sid, forged, it->second.socket);
+      forged.setId(client.id);
+      serviceUnavailable(sid, forged, client.socket);
     }
-    _ongoingMessages[sid].clear();
-    _ongoingMessages.erase(sid);
   }
 }
 
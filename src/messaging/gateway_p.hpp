@@ -8,6 +8,7 @@
 #define _SRC_MESSAGING_GATEWAY_P_HPP_
 
 #include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <qi/messaging/gateway.hpp>
 #include <qi/property.hpp>
@@ -43,6 +44,40 @@ struct MessageInfo
   ClientMessageId clientId;
   Message message;
   TransportSocketPtr target;
+  boost::optional<SteadyClockTimePoint> deadline; // of the call, if any
+};
+
+/// Messages forwarded by the gateway and awaiting a response, by service
+/// and gateway message id. Split in shards by message id, each with its
+/// own lock, so that concurrent calls and replies seldom contend.
+class OngoingMessages
+{
+public:
+  void insert(ServiceId service, GWMessageId id, const ClientInfo& client);
+  /// Returns the client of the message, or a null socket if it is unknown.
+  TransportSocketPtr client(ServiceId service, GWMessageId id);
+  /// Removes the message and returns its client into @p client, or returns
+  /// false if it is unknown.
+  bool take(ServiceId service, GWMessageId id, ClientInfo& client);
+  /// Removes and returns all messages forwarded to @p service.
+  std::vector<ClientInfo> takeService(ServiceId service);
+  /// Removes all messages coming from @p client.
+  void removeClient(TransportSocketPtr client);
+  void clear();
+
+private:
+  using MessageKey = std::pair<ServiceId, GWMessageId>;
+  struct Shard
+  {
+    boost::mutex mutex;
+    boost::unordered_map<MessageKey, ClientInfo> messages;
+  };
+  static const std::size_t ShardCount = 16;
+  Shard& shard(GWMessageId id)
+  {
+    return _shards[id % ShardCount];
+  }
+  Shard _shards[ShardCount];
 };
 
 class GwTransaction
@@ -103,7 +138,14 @@ public:
   Future<void> connect(const Url& sdUrl);
 
 private:
+  using ServiceMap = std::map<ServiceId, TransportSocketPtr>;
+  using ServiceMapPtr = boost::shared_ptr<const ServiceMap>;
+
   TransportSocketPtr safeGetService(ServiceId id);
+  /// Snapshot of the connected services, never modified once published.
+  ServiceMapPtr services() const;
+  void setService(ServiceId id, TransportSocketPtr socket);
+  void eraseService(ServiceId id);
 
   void onServerAcceptError(int err);
 
@@ -138,7 +180,8 @@ private:
   void forwardMessage(ClientMessageId origId,
                       const Message& forward,
                       TransportSocketPtr client,
-                      TransportSocketPtr destination);
+                      TransportSocketPtr destination,
+                      const boost::optional<SteadyClockTimePoint>& deadline = boost::none);
   void forwardPostMessage(GwTransaction& t, TransportSocketPtr origin);
   GWMessageId handleCallMessage(GwTransaction& msg, TransportSocketPtr origin, TransportSocketPtr destination = {});
   void handleReplyMessage(GwTransaction& msg);
@@ -181,19 +224,17 @@ private:
 
   std::vector<TransportSocketPtr> _clients;
   boost::mutex _clientsMutex;
-  std::map<ServiceId, TransportSocketPtr> _services;
+  // read and replaced with boost::atomic_load/store, writers hold _serviceMutex
+  ServiceMapPtr _services;
   std::map<ServiceId, std::string> _sdAvailableServices;
   boost::recursive_mutex _serviceMutex;
   GwSDClient _sdClient;
   GwObjectHost _objectHost;
 
 
-  using IdLookupMap = std::map<GWMessageId, ClientInfo >;
-  using OngoingMessagesMap = std::map<ServiceId, IdLookupMap>;
   // This represents the messages that are currently awaiting a response, with both endpoints being known
   // and connected to the gateway.
-  OngoingMessagesMap _ongoingMessages;
-  boost::mutex _ongoingMsgMutex;
+  OngoingMessages _ongoingMessages;
 
   // Messages for services that are not registered to the GW yet.
   // Once they are, we'll forward them.
@@ -214,6 +255,8 @@ private:
     EventHostEndpoint hostSocket;
   };
   std::map<GWMessageId, EventAddress> _pendingEventSubscriptions;
+  // Taken after the lock of an event shard, never before.
+  boost::mutex _pendingEventSubMutex;
   struct EventSubInfo
   {
     SignalLink gwLink;
@@ -225,8 +268,19 @@ private:
   using EventsPerObjectMap = std::map<ObjectId, ClientsPerEventMap>;
   using EventServiceMap = std::map<ServiceId, EventsPerObjectMap>;
   using EventsEndpointMap = std::map<EventHostEndpoint, EventServiceMap>;
-  EventsEndpointMap _eventSubscribers;
-  boost::recursive_mutex _eventSubMutex;
+  // Event subscriptions, split by host endpoint so that events from
+  // different services do not contend.
+  struct EventShard
+  {
+    boost::recursive_mutex mutex;
+    EventsEndpointMap subscribers;
+  };
+  static const std::size_t EventShardCount = 16;
+  EventShard _eventShards[EventShardCount];
+  EventShard& eventShard(EventHostEndpoint host)
+  {
+    return _eventShards[boost::hash<TransportSocket*>()(host.get()) % EventShardCount];
+  }
 
   void removeEventSubscriber(ServiceId service,
                              uint32_t object,
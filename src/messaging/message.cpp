@@ -2,6 +2,7 @@
 **  Copyright (C) 2012 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
 #include <cstring>
 
 #include <boost/make_shared.hpp>
@@ -122,9 +123,25 @@ namespace qi {
   : buffer(b.buffer)
   , signature(b.signature)
   , header(b.header)
+  , deadline(b.deadline)
   {
   }
 
+  bool MessagePrivate::receiveDeadline()
+  {
+    qi::uint32_t left;
+    size_t size = buffer.size();
+    if (size < sizeof(left))
+      return false;
+    memcpy(&left, static_cast<const char*>(buffer.data()) + size - sizeof(left), sizeof(left));
+    buffer.truncate(size - sizeof(left));
+    header.size -= sizeof(left);
+    header.flags &= ~Message::TypeFlag_Deadline;
+    // Time spent in transit is not accounted for.
+    deadline = SteadyClock::now() + MilliSeconds(left);
+    return true;
+  }
+
   MessagePrivate::~MessagePrivate()
   {
   }
@@ -265,6 +282,28 @@ namespace qi {
     return _p->header.flags;
   }
 
+  void Message::setDeadline(SteadyClockTimePoint deadline)
+  {
+    cow();
+    qi::int64_t left = boost::chrono::duration_cast<MilliSeconds>(deadline - SteadyClock::now()).count();
+    qi::uint32_t word = static_cast<qi::uint32_t>(std::max<qi::int64_t>(0, std::min<qi::int64_t>(left, 0xFFFFFFFF)));
+    if (_p->header.flags & TypeFlag_Deadline)
+      _p->buffer.truncate(_p->buffer.size() - sizeof(word));
+    _p->buffer.write(&word, sizeof(word));
+    _p->header.flags |= TypeFlag_Deadline;
+    _p->deadline = deadline;
+  }
+
+  bool Message::hasDeadline() const
+  {
+    return _p->deadline.is_initialized();
+  }
+
+  SteadyClockTimePoint Message::deadline() const
+  {
+    return *_p->deadline;
+  }
+
   void Message::setService(qi::uint32_t service)
   {
     cow();
@@ -417,6 +456,10 @@ namespace qi {
       throw std::runtime_error("Could not construct type for " + signature.toString());
     qiLogDebug() << "Serialized message body: " << _p->buffer.size();
     }
+    return value(type, socket);
+  }
+
+  AnyReference Message::value(qi::TypeInterface* type, const qi::TransportSocketPtr &socket) const {
     qi::BufferReader br(_p->buffer);
     //TODO: not exception safe
     AnyReference res(type);
@@ -443,12 +486,16 @@ namespace qi {
         setError(ss.str());
       }
       else
+      {
+        _p->buffer.reserveCapacity(_p->buffer.size() + encodedBinarySize(conv.first));
         encodeBinary(&_p->buffer, conv.first, boost::bind(serializeObject, _1, context, streamContext), streamContext);
+      }
       if (conv.second)
         conv.first.destroy();
     }
     else if (value.type()->kind() != qi::TypeKind_Void)
     {
+      _p->buffer.reserveCapacity(_p->buffer.size() + encodedBinarySize(value));
       encodeBinary(&_p->buffer, value, boost::bind(serializeObject, _1, context, streamContext), streamContext);
     }
   }
@@ -457,6 +504,11 @@ namespace qi {
   {
     cow();
     SerializeObjectCallback scb = boost::bind(serializeObject, _1, context, streamContext);
+    // Size the payload first so that it is allocated only once
+    size_t size = 0;
+    for (unsigned i = 0; i < values.size(); ++i)
+      size += encodedBinarySize(values[i]);
+    _p->buffer.reserveCapacity(_p->buffer.size() + size);
     for (unsigned i = 0; i < values.size(); ++i)
       encodeBinary(&_p->buffer, values[i], scb, streamContext);
   }
@@ -12,7 +12,9 @@
 #include <qi/buffer.hpp>
 #include <qi/binarycodec.hpp>
 #include <qi/anyfunction.hpp>
+#include <qi/clock.hpp>
 #include <qi/types.hpp>
+#include <boost/optional.hpp>
 
 
 namespace qi {
@@ -39,10 +41,14 @@ namespace qi {
 
     inline void                complete() { header.size = buffer.totalSize(); }
     inline void               *getHeader() { return reinterpret_cast<void *>(&header); }
+    /// Removes the time left appended to the payload of a received message
+    /// into deadline. Returns false if the payload is too short.
+    bool                       receiveDeadline();
 
     Buffer        buffer;
     std::string   signature;
     MessageHeader header;
+    boost::optional<SteadyClockTimePoint> deadline;
 
     static const unsigned int magic = 0x42adde42;
   };
@@ -159,6 +165,19 @@ namespace qi {
      * NOT IMPLEMENTED
      */
     static const unsigned int TypeFlag_ReturnType = 2;
+    /* Set by the transport on messages whose large sub-buffers are passed
+     * out of the stream, see TcpTransportSocket. Never seen by receivers.
+     */
+    static const unsigned int TypeFlag_PassedBuffers = 4;
+    /* Set by the transport on the chunks of a message sent in several parts,
+     * see TcpTransportSocket. Never seen by receivers.
+     */
+    static const unsigned int TypeFlag_Chunk = 8;
+    /* If flag is set, the payload is followed by the uint32 number of
+     * milliseconds left before the deadline of the call, see setDeadline().
+     * Removed from the payload on reception.
+     */
+    static const unsigned int TypeFlag_Deadline = 16;
 
     static const char* typeToString(Type t);
     static const char* actionToString(unsigned int action, unsigned int service);
@@ -207,6 +226,11 @@ namespace qi {
 
 
     AnyReference value(const Signature &signature, const qi::TransportSocketPtr &socket) const;
+    /** Decode the payload into a new value of type \p type.
+     * BufferView and RawBufferView members of \p type point into the
+     * message buffer instead of copying from it.
+     */
+    AnyReference value(TypeInterface* type, const qi::TransportSocketPtr &socket) const;
     void setValue(const AutoAnyReference& value, const Signature& signature, ObjectHost* context = 0, StreamContext* streamContext = 0);
     void setValues(const std::vector<qi::AnyReference>& values, ObjectHost* context = 0, StreamContext* streamContext = 0);
     /// Convert values to \p targetSignature and assign to payload.
@@ -215,6 +239,13 @@ namespace qi {
     void appendValue(const AutoAnyReference& value, ObjectHost* context = 0, StreamContext* streamContext = 0);
     MessageAddress address() const;
 
+    /// Sets the time after which the caller gives up on the call.
+    /// Must be called once the payload is complete.
+    void         setDeadline(SteadyClockTimePoint deadline);
+    bool         hasDeadline() const;
+    /// Only valid if hasDeadline(), in the clock of this process.
+    SteadyClockTimePoint deadline() const;
+
     bool         isValid() const;
 
   public:
@@ -2,46 +2,77 @@
 **  Copyright (C) 2012 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/thread/tss.hpp>
+#include <qi/async.hpp>
 #include "messagedispatcher.hpp"
 
 qiLogCategory("qimessaging.messagedispatcher");
 
 namespace qi {
 
-#if 0
-  //Needed for handling message Timeout
-  static int _gst()
+  const unsigned int MessageDispatcher::ALL_OBJECTS = -1;
+
+  static void noCleanup(MessageDispatcher::Route*) {}
+  // Route being called by this thread, that may disconnect it without waiting.
+  static boost::thread_specific_ptr<MessageDispatcher::Route> callingRoute(&noCleanup);
+
+  static void callRoute(MessageDispatcher::Route& route, const qi::Message& msg)
   {
-    static const std::string st = qi::os::getenv("QI_MESSAGE_TIMEOUT");
-    if (st != "")
+    // Counted as active before checking it is enabled, for disconnection
+    // to either disable it first or wait for us.
+    ++route.active;
+    if (route.enabled.load())
     {
-      return atoi(st.c_str());
+      MessageDispatcher::Route* previous = callingRoute.get();
+      callingRoute.reset(&route);
+      try
+      {
+        route.fun(msg);
+      }
+      catch (const std::exception& e)
+      {
+        qiLogError() << "Exception caught in message handler: " << e.what();
+      }
+      catch (...)
+      {
+        qiLogError() << "Unknown exception caught in message handler";
+      }
+      callingRoute.reset(previous);
     }
-    else
+    --route.active;
+    // Once disabled, a disconnection may be waiting for us to end.
+    if (!route.enabled.load())
     {
-      // Default timeout in NAOqi 1
-      return 5 * 60;
+      boost::mutex::scoped_lock lock(route.idleMutex);
+      route.idle.notify_all();
     }
   }
 
-  static inline unsigned int getSocketTimeout()
+  MessageDispatcher::MessageDispatcher()
+    : _routes(boost::make_shared<RouteTable>())
+    , _nextLink(0)
   {
-    static int _socket_timeout = _gst();
-    return _socket_timeout;
   }
-#endif
 
-  const unsigned int MessageDispatcher::ALL_OBJECTS = -1;
-
-  MessageDispatcher::MessageDispatcher()
+  MessageDispatcher::~MessageDispatcher()
   {
+    destroy();
   }
 
   void MessageDispatcher::dispatch(const qi::Message& msg) {
     //remove the address from the messageSent map
-    if (msg.type() == qi::Message::Type_Reply)
+    if (msg.type() == qi::Message::Type_Reply
+        || msg.type() == qi::Message::Type_Error
+        || msg.type() == qi::Message::Type_Canceled)
     {
       boost::mutex::scoped_lock sl(_messageSentMutex);
+      if (_expired.erase(msg.id()))
+      {
+        qiLogDebug() << "Dropping late answer to message " << msg.id();
+        return;
+      }
       MessageSentMap::iterator it;
       it = _messageSent.find(msg.id());
       if (it != _messageSent.end())
@@ -49,77 +80,86 @@ namespace qi {
       else
         qiLogDebug() << "Message " << msg.id() <<  " is not in the messageSent map";
     }
+    deliver(msg);
+  }
 
+  void MessageDispatcher::deliver(const qi::Message& msg)
+  {
+    // The table is immutable, keeping it keeps the routes alive.
+    RouteTablePtr routes = boost::atomic_load(&_routes);
+    bool hit = false;
+    RouteTable::const_iterator it = routes->find(Target(msg.service(), msg.object()));
+    if (it != routes->end())
+    {
+      hit = true;
+      for (unsigned i = 0; i < it->second.size(); ++i)
+        callRoute(*it->second[i], msg);
+    }
+    if (msg.object() != ALL_OBJECTS)
     {
-      boost::shared_ptr<OnMessageSignal> sig[2];
-      bool hit = false;
+      it = routes->find(Target(msg.service(), ALL_OBJECTS));
+      if (it != routes->end())
       {
-        boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-        SignalMap::iterator it;
-        it = _signalMap.find(Target(msg.service(), msg.object()));
-        if (it != _signalMap.end())
-        {
-          hit = true;
-          sig[0] = it->second;
-        }
-        it = _signalMap.find(Target(msg.service(), ALL_OBJECTS));
-        if (it != _signalMap.end())
-        {
-          hit = true;
-          sig[1] = it->second;
-        }
+        hit = true;
+        for (unsigned i = 0; i < it->second.size(); ++i)
+          callRoute(*it->second[i], msg);
       }
-      if (sig[0])
-        (*sig[0])(msg);
-      if (sig[1])
-        (*sig[1])(msg);
-      if (!hit) // FIXME: that should probably never happen, raise log level
-        qiLogDebug() << "No listener for service " << msg.service();
     }
+    if (!hit) // FIXME: that should probably never happen, raise log level
+      qiLogDebug() << "No listener for service " << msg.service();
   }
 
   qi::SignalLink
   MessageDispatcher::messagePendingConnect(unsigned int serviceId, unsigned int objectId, boost::function<void (const qi::Message&)> fun) {
-    boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-    boost::shared_ptr<OnMessageSignal> &sig = _signalMap[Target(serviceId, objectId)];
-    if (!sig)
-      sig.reset(new OnMessageSignal());
-    sig->setCallType(MetaCallType_Direct);
-    return sig->connect(fun);
+    boost::mutex::scoped_lock sl(_routesMutex);
+    boost::shared_ptr<RouteTable> routes = boost::make_shared<RouteTable>(*_routes);
+    RoutePtr route = boost::make_shared<Route>(++_nextLink, fun);
+    (*routes)[Target(serviceId, objectId)].push_back(route);
+    boost::atomic_store(&_routes, RouteTablePtr(routes));
+    return route->link;
   }
 
   bool MessageDispatcher::messagePendingDisconnect(unsigned int serviceId, unsigned int objectId, qi::SignalLink linkId)
   {
-    // Do not hold the lock when invoking disconnect()
-    // or deadlock may occur as disconnect() waits for
-    // handlers to finish before returning.
-    boost::shared_ptr<OnMessageSignal> sig;
+    RoutePtr route;
     {
-      boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-      SignalMap::iterator it;
-      it = _signalMap.find(Target(serviceId, objectId));
-      if (it != _signalMap.end())
-        sig = it->second;
-      else
+      boost::mutex::scoped_lock sl(_routesMutex);
+      RouteTable::const_iterator it = _routes->find(Target(serviceId, objectId));
+      if (it == _routes->end())
         return false;
+      std::vector<RoutePtr>::const_iterator rit = it->second.begin();
+      while (rit != it->second.end() && (*rit)->link != linkId)
+        ++rit;
+      if (rit == it->second.end())
+        return false;
+      route = *rit;
+
+      boost::shared_ptr<RouteTable> routes = boost::make_shared<RouteTable>(*_routes);
+      std::vector<RoutePtr>& targetRoutes = (*routes)[Target(serviceId, objectId)];
+      targetRoutes.erase(std::find(targetRoutes.begin(), targetRoutes.end(), route));
+      if (targetRoutes.empty())
+        routes->erase(Target(serviceId, objectId));
+      boost::atomic_store(&_routes, RouteTablePtr(routes));
     }
-    bool ok = sig->disconnect(linkId);
-    if (!sig->hasSubscribers())
-    {
-      // We need to re-acquire lock and check emptyness when locked
-       boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-       SignalMap::iterator it;
-       it = _signalMap.find(Target(serviceId, objectId));
-       if (it != _signalMap.end() && !it->second->hasSubscribers())
-         _signalMap.erase(it);
-    }
-    return ok;
+
+    // Dispatches that loaded the previous table may still call it: once
+    // disabled, wait for those in progress, but not for our own caller.
+    route->enabled = false;
+    const int self = callingRoute.get() == route.get() ? 1 : 0;
+    boost::mutex::scoped_lock lock(route->idleMutex);
+    while (route->active.load() > self)
+      route->idle.wait(lock);
+    return true;
   }
 
   void MessageDispatcher::cleanPendingMessages()
   {
     //we are deleting the Socket and want to timeout all pending request
-    //or the cleanup timer ask us to remove pending request that timed out
+    {
+      boost::mutex::scoped_lock l(_messageSentMutex);
+      _deadlines.clear();
+      _expired.clear();
+    }
     while (true)
     {
       MessageAddress ma;
@@ -134,7 +174,7 @@ namespace qi {
       //generate an error message for the caller.
       qi::Message msg(qi::Message::Type_Error, ma);
       msg.setError("Endpoint disconnected, message dropped.");
-      dispatch(msg);
+      deliver(msg);
     }
   }
 
@@ -150,10 +190,58 @@ namespace qi {
         return;
       }
       _messageSent[msg.id()] = msg.address();
+      if (msg.hasDeadline())
+      {
+        _deadlines.insert(std::make_pair(msg.deadline(), msg.id()));
+        if (!_nextExpiry || msg.deadline() < *_nextExpiry)
+          scheduleExpiry(msg.deadline());
+      }
     }
     return;
   }
 
+  void MessageDispatcher::scheduleExpiry(SteadyClockTimePoint when)
+  {
+    // Timers already pending are left to fire, they have nothing to do.
+    _nextExpiry = when;
+    qi::asyncAt(qi::bind(&MessageDispatcher::expireDeadlines, this), when);
+  }
+
+  void MessageDispatcher::expireDeadlines()
+  {
+    std::vector<MessageAddress> expired;
+    {
+      boost::mutex::scoped_lock l(_messageSentMutex);
+      SteadyClockTimePoint now = SteadyClock::now();
+      while (!_deadlines.empty() && _deadlines.begin()->first <= now)
+      {
+        // Answered calls are not removed from _deadlines, skip them.
+        MessageSentMap::iterator it = _messageSent.find(_deadlines.begin()->second);
+        if (it != _messageSent.end())
+        {
+          // Marked in the same critical section, for its answer to be dropped
+          // whenever it comes.
+          expired.push_back(it->second);
+          _expired.insert(it->first);
+          _messageSent.erase(it);
+        }
+        _deadlines.erase(_deadlines.begin());
+      }
+      if (_deadlines.empty())
+        _nextExpiry.reset();
+      else if (!_nextExpiry || *_nextExpiry <= now)
+        scheduleExpiry(_deadlines.begin()->first);
+    }
+    for (unsigned i = 0; i < expired.size(); ++i)
+    {
+      qiLogVerbose() << "Call " << expired[i] << " reached its deadline";
+      //generate an error message for the caller.
+      qi::Message msg(qi::Message::Type_Error, expired[i]);
+      msg.setError("Call deadline exceeded.");
+      deliver(msg);
+    }
+  }
+
 
 
 }
@@ -8,8 +8,13 @@
 #define _SRC_MESSAGEDISPATCHER_HPP_
 
 #include <qi/anyobject.hpp>
+#include <qi/atomic.hpp>
 #include <qi/signal.hpp>
+#include <qi/trackable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/unordered_map.hpp>
+#include <set>
 #include "message.hpp"
 
 namespace qi {
@@ -21,14 +26,18 @@ namespace qi {
    * Receive message from a TransportSocket and send them on the appropriate
    * signal, based on the serviceId of the message.
    *
-   * This class generate an error message for all pending message that have timed out.
-   * at the moment it only generate message if the socket have been disconnected.
+   * Routes are kept in an immutable table replaced as a whole when a handler
+   * is connected or disconnected, so that dispatching a message only loads
+   * the current table and calls the handlers directly, without locking.
    *
-   * TODO: handle timeout on request taking too long to complete
+   * This class generate an error message for all pending calls when the socket
+   * is disconnected, and for the calls sent with a deadline once it passes.
+   * The answer to such a call is then dropped if it comes anyway.
    */
-  class MessageDispatcher {
+  class MessageDispatcher : public qi::Trackable<MessageDispatcher> {
   public:
     MessageDispatcher();
+    ~MessageDispatcher();
 
     //internal: called by Socket to tell the class that we sent a message
     void sent(const qi::Message& msg);
@@ -42,16 +51,45 @@ namespace qi {
 
   public:
     using Target = std::pair<unsigned int, unsigned int>;
-    using OnMessageSignal = Signal<const qi::Message&>;
-    // use shared-ptr on signal so that we may hold it without holding the map lock
-    using SignalMap = std::map<Target, boost::shared_ptr<OnMessageSignal> >;
+    using MessageHandler = boost::function<void (const qi::Message&)>;
+    /// A connected handler. Once disconnected, it is disabled and waited for.
+    struct Route
+    {
+      Route(qi::SignalLink link, const MessageHandler& fun)
+        : link(link), fun(fun), enabled(true), active(0)
+      {}
+
+      qi::SignalLink    link;
+      MessageHandler    fun;
+      qi::Atomic<bool>  enabled;
+      qi::Atomic<int>   active; // calls in progress
+      boost::mutex              idleMutex;
+      boost::condition_variable idle; // notified when a call of a disabled route ends
+    };
+    using RoutePtr = boost::shared_ptr<Route>;
+    using RouteTable = boost::unordered_map<Target, std::vector<RoutePtr> >;
+    using RouteTablePtr = boost::shared_ptr<const RouteTable>;
     using MessageSentMap = std::map<unsigned int, MessageAddress>;
+    using DeadlineMap = std::multimap<SteadyClockTimePoint, unsigned int>; // message ids
 
-    SignalMap              _signalMap;
-    boost::recursive_mutex _signalMapMutex;
+    // never modified once published, read and replaced with boost::atomic_load/store
+    RouteTablePtr          _routes;
+    boost::mutex           _routesMutex; // serializes replacements of _routes
+    qi::SignalLink         _nextLink;
 
     MessageSentMap         _messageSent;
-    boost::mutex           _messageSentMutex;
+    DeadlineMap            _deadlines;     // of calls sent, may outlive them
+    std::set<unsigned int> _expired;       // calls failed by their deadline, still to be answered
+    boost::optional<SteadyClockTimePoint> _nextExpiry; // of the earliest pending timer
+    boost::mutex           _messageSentMutex; // protects the above
+
+  private:
+    /// Calls the handlers of the message target, without bookkeeping of sent calls.
+    void deliver(const qi::Message& msg);
+    /// Fails the calls whose deadline passed.
+    void expireDeadlines();
+    /// Must be called with _messageSentMutex locked.
+    void scheduleExpiry(SteadyClockTimePoint when);
   };
 
 }
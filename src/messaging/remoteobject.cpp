@@ -13,6 +13,7 @@
 #include "message.hpp"
 #include "transportsocket.hpp"
 #include <qi/log.hpp>
+#include <qi/os.hpp>
 #include <boost/thread/mutex.hpp>
 #include <qi/eventloop.hpp>
 
@@ -20,6 +21,23 @@ qiLogCategory("qimessaging.remoteobject");
 
 namespace qi {
 
+  /// Time after which calls fail if not answered, 0 if they never do.
+  /// Configured in seconds with the environment variable QI_MESSAGE_TIMEOUT.
+  static qi::MilliSeconds callTimeout()
+  {
+    static qi::MilliSeconds res(0);
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    if (!init)
+    {
+      std::string l = os::getenv("QI_MESSAGE_TIMEOUT");
+      if (!l.empty())
+        res = qi::Seconds(strtol(l.c_str(), 0, 0));
+      init = true;
+    }
+    return res;
+  }
+
 
   static qi::MetaObject* createRemoteObjectSpecialMetaObject() {
     qi::MetaObject *mo = new qi::MetaObject;
@@ -295,10 +313,11 @@ namespace qi {
     }
     /* The promise will be set:
      - From here in case of error
-     - From a network callback, called asynchronously in thread pool
-     So it is safe to use a sync promise.
+     - From a network callback, called in the network event loop
+     Continuations are user code, so run them in the thread pool rather than
+     holding up the network threads.
      */
-    qi::Promise<AnyReference> out(FutureCallbackType_Sync);
+    qi::Promise<AnyReference> out(FutureCallbackType_Async);
     qi::Message msg;
     TransportSocketPtr sock;
     // qiLogDebug() << this << " metacall " << msg.service() << " " << msg.function() <<" " << msg.id();
@@ -342,6 +361,8 @@ namespace qi {
     msg.setService(_service);
     msg.setObject(_object);
     msg.setFunction(method);
+    if (callTimeout().count() && sock->remoteCapability("CallDeadlines", false))
+      msg.setDeadline(SteadyClock::now() + callTimeout());
 
     //error will come back as a error message
     if (!sock->isConnected() || !sock->send(msg)) {
@@ -0,0 +1,872 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/make_shared.hpp>
+
+#include "shmtransportsocket.hpp"
+#include "src/eventloop_p.hpp"
+
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.shmtransportsocket");
+
+namespace qi
+{
+  namespace detail
+  {
+    /// Control block of a ring, shared by its writer and its reader.
+    /// head and tail count the bytes written and read since the beginning.
+    struct ShmRing
+    {
+      std::atomic<qi::uint64_t> head; // only modified by the writer
+      char pad0[64 - sizeof(qi::uint64_t)];
+      std::atomic<qi::uint64_t> tail; // only modified by the reader
+      char pad1[64 - sizeof(qi::uint64_t)];
+      // Set by a side before it sleeps on its doorbell, the other side
+      // clears it and rings the doorbell.
+      std::atomic<qi::uint32_t> readerWaiting;
+      std::atomic<qi::uint32_t> writerWaiting;
+    };
+
+    static const size_t ringHeaderSize = 256;
+
+    /// First message on the control socket, sent along with the memfd and
+    /// the two doorbells.
+    struct ShmHello
+    {
+      qi::uint32_t magic;
+      qi::uint32_t version;
+      qi::uint64_t ringSize;
+    };
+
+    // The segment must keep its size: accessing a shrunk mapping faults.
+    static const int shmSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+    static const qi::uint32_t shmHelloMagic = 0x5153484d; // QSHM
+    static const qi::uint32_t shmHelloVersion = 1;
+
+    /// Shared memory and doorbells of a connection, as seen from one side.
+    class ShmSegment : private boost::noncopyable
+    {
+    public:
+      ShmSegment()
+        : base(0)
+        , mappedSize(0)
+        , ringSize(0)
+        , memFd(-1)
+        , localDoorbell(-1)
+        , remoteDoorbell(-1)
+        , in(0)
+        , inData(0)
+        , out(0)
+        , outData(0)
+      {
+      }
+
+      ~ShmSegment()
+      {
+        if (base)
+          munmap(base, mappedSize);
+        if (memFd >= 0)
+          ::close(memFd);
+        if (localDoorbell >= 0)
+          ::close(localDoorbell);
+        if (remoteDoorbell >= 0)
+          ::close(remoteDoorbell);
+      }
+
+      /// Create a segment with two rings of @p size bytes, client side.
+      static ShmSegmentPtr create(size_t size);
+      /// Map a segment received from a client, taking ownership of the fds.
+      static ShmSegmentPtr adopt(int memFd, int serverDoorbell, int clientDoorbell, size_t size);
+
+      /// Ring the doorbell of the other side.
+      void notify()
+      {
+        qi::uint64_t one = 1;
+        if (::write(remoteDoorbell, &one, sizeof(one)) < 0 && errno != EAGAIN)
+          qiLogDebug() << "Failed to ring doorbell: " << strerror(errno);
+      }
+
+      /// Copy as much of [@p src, @p src + @p len) as fits in the outgoing
+      /// ring, and set @p n to its size. Returns false if the peer corrupted
+      /// the ring.
+      bool write(const char* src, size_t len, size_t& n)
+      {
+        qi::uint64_t head = out->head.load(std::memory_order_relaxed);
+        qi::uint64_t tail = out->tail.load(std::memory_order_acquire);
+        // tail is written by the peer, do not trust it.
+        if (head - tail > ringSize)
+          return false;
+        n = std::min(len, static_cast<size_t>(ringSize - (head - tail)));
+        size_t offset = static_cast<size_t>(head & (ringSize - 1));
+        size_t first = std::min(n, ringSize - offset);
+        memcpy(outData + offset, src, first);
+        memcpy(outData, src + first, n - first);
+        out->head.store(head + n);
+        return true;
+      }
+
+      /// Set @p n to the bytes available in the incoming ring. Returns false
+      /// if the peer corrupted the ring.
+      bool available(size_t& n) const
+      {
+        // Sequentially consistent, so that a reader about to sleep and a
+        // writer checking readerWaiting cannot miss each other.
+        qi::uint64_t used = in->head.load() - in->tail.load(std::memory_order_relaxed);
+        // head is written by the peer, do not trust it.
+        if (used > ringSize)
+          return false;
+        n = static_cast<size_t>(used);
+        return true;
+      }
+
+      /// Move @p len available bytes of the incoming ring to @p dst.
+      void read(char* dst, size_t len)
+      {
+        len = std::min(len, ringSize);
+        qi::uint64_t tail = in->tail.load(std::memory_order_relaxed);
+        size_t offset = static_cast<size_t>(tail & (ringSize - 1));
+        size_t first = std::min(len, ringSize - offset);
+        memcpy(dst, inData + offset, first);
+        memcpy(dst + first, inData, len - first);
+        in->tail.store(tail + len);
+        // The writer may be waiting for the room we just made.
+        if (in->writerWaiting.exchange(0))
+          notify();
+      }
+
+      void* base;
+      size_t mappedSize;
+      size_t ringSize;
+      int memFd;
+      int localDoorbell;
+      int remoteDoorbell;
+      ShmRing* in;
+      char* inData;
+      ShmRing* out;
+      char* outData;
+
+    private:
+      // Layout: client to server ring, then server to client ring.
+      void map(bool client)
+      {
+        mappedSize = 2 * (ringHeaderSize + ringSize);
+        base = mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+        if (base == MAP_FAILED)
+        {
+          base = 0;
+          throw std::runtime_error(std::string("mmap: ") + strerror(errno));
+        }
+        char* c2s = static_cast<char*>(base);
+        char* s2c = c2s + ringHeaderSize + ringSize;
+        in = reinterpret_cast<ShmRing*>(client ? s2c : c2s);
+        out = reinterpret_cast<ShmRing*>(client ? c2s : s2c);
+        inData = reinterpret_cast<char*>(in) + ringHeaderSize;
+        outData = reinterpret_cast<char*>(out) + ringHeaderSize;
+      }
+    };
+
+    static bool validRingSize(qi::uint64_t size)
+    {
+      return size >= 4096 && size <= (qi::uint64_t(1) << 30) && (size & (size - 1)) == 0;
+    }
+
+    /// Size of each ring, configured with QI_SHM_RING_SIZE.
+    static size_t shmRingSize()
+    {
+      static size_t res = 0;
+      static bool init = false;
+      // Not thread-safe, limited consequences
+      if (!init)
+      {
+        std::string l = os::getenv("QI_SHM_RING_SIZE");
+        res = l.empty() ? 4 * 1024 * 1024 : strtoul(l.c_str(), 0, 0);
+        if (!validRingSize(res))
+        {
+          qiLogWarning() << "Invalid QI_SHM_RING_SIZE " << l << ", must be a power of two above 4096";
+          res = 4 * 1024 * 1024;
+        }
+        init = true;
+      }
+      return res;
+    }
+
+    ShmSegmentPtr ShmSegment::create(size_t size)
+    {
+      ShmSegmentPtr seg = boost::make_shared<ShmSegment>();
+      seg->ringSize = size;
+      seg->memFd = static_cast<int>(memfd_create("qimessaging", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+      if (seg->memFd < 0)
+        throw std::runtime_error(std::string("memfd_create: ") + strerror(errno));
+      if (ftruncate(seg->memFd, 2 * (ringHeaderSize + size)) < 0)
+        throw std::runtime_error(std::string("ftruncate: ") + strerror(errno));
+      if (fcntl(seg->memFd, F_ADD_SEALS, shmSeals | F_SEAL_SEAL) < 0)
+        throw std::runtime_error(std::string("sealing memfd: ") + strerror(errno));
+      seg->localDoorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      seg->remoteDoorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (seg->localDoorbell < 0 || seg->remoteDoorbell < 0)
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+      seg->map(true);
+      // Freshly truncated memory is zeroed, constructing the rings is enough.
+      new (seg->in) ShmRing();
+      new (seg->out) ShmRing();
+      return seg;
+    }
+
+    ShmSegmentPtr ShmSegment::adopt(int memFd, int serverDoorbell, int clientDoorbell, size_t size)
+    {
+      ShmSegmentPtr seg = boost::make_shared<ShmSegment>();
+      seg->memFd = memFd;
+      seg->localDoorbell = serverDoorbell;
+      seg->remoteDoorbell = clientDoorbell;
+      seg->ringSize = size;
+      if (!validRingSize(size))
+        throw std::runtime_error("invalid ring size");
+      // Unsealed, the client could shrink the segment under our mapping.
+      int seals = fcntl(memFd, F_GET_SEALS);
+      if (seals < 0 || (seals & shmSeals) != shmSeals)
+        throw std::runtime_error("shared memory is not sealed");
+      struct stat st;
+      if (fstat(memFd, &st) < 0 || static_cast<size_t>(st.st_size) != 2 * (ringHeaderSize + size))
+        throw std::runtime_error("shared memory does not match the ring size");
+      seg->map(false);
+      return seg;
+    }
+  }
+
+  using detail::ShmSegment;
+  using detail::ShmSegmentPtr;
+
+  ShmTransportSocket::ShmTransportSocket(EventLoop* eventLoop)
+    : TransportSocket()
+    , _doorbell(*static_cast<boost::asio::io_service*>(eventLoop->nativeHandle()))
+    , _doorbellValue(0)
+    , _controlByte(0)
+    , _abort(false)
+    , _isStarted(false)
+    , _recvHeader(0)
+    , _recvPayload(0)
+    , _recvPtr(0)
+    , _sendChunk(0)
+    , _sendOffset(0)
+    , _sendQueueBytes(0)
+    , _maxSendQueueBytes(defaultMaxSendQueueBytes())
+    , _maxSendQueueMessages(defaultMaxSendQueueMessages())
+  {
+    _eventLoop = eventLoop;
+    _err = 0;
+    _status = qi::TransportSocket::Status::Disconnected;
+  }
+
+  ShmTransportSocket::ShmTransportSocket(EventLoop* eventLoop, SocketPtr control, ShmSegmentPtr segment,
+                                         const qi::Url& remote)
+    : TransportSocket()
+    , _segment(segment)
+    , _control(control)
+    , _doorbell(*static_cast<boost::asio::io_service*>(eventLoop->nativeHandle()), segment->localDoorbell)
+    , _doorbellValue(0)
+    , _controlByte(0)
+    , _abort(false)
+    , _isStarted(false)
+    , _recvHeader(0)
+    , _recvPayload(0)
+    , _recvPtr(0)
+    , _sendChunk(0)
+    , _sendOffset(0)
+    , _sendQueueBytes(0)
+    , _maxSendQueueBytes(defaultMaxSendQueueBytes())
+    , _maxSendQueueMessages(defaultMaxSendQueueMessages())
+  {
+    _eventLoop = eventLoop;
+    _err = 0;
+    _url = remote;
+    _status = qi::TransportSocket::Status::Connected;
+  }
+
+  ShmTransportSocket::~ShmTransportSocket()
+  {
+    qiLogDebug() << this;
+    error("Destroying ShmTransportSocket");
+    // The segment owns the doorbell fd.
+    if (_doorbell.is_open())
+      _doorbell.release();
+    qiLogVerbose() << "deleted " << this;
+  }
+
+  qi::Url ShmTransportSocket::remoteEndpoint() const
+  {
+    return _url;
+  }
+
+  bool ShmTransportSocket::sameUser(Socket& control)
+  {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(control.native_handle(), SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+      return false;
+    if (cred.uid != geteuid())
+    {
+      qiLogWarning() << "Refusing shared memory peer process " << cred.pid
+                     << " of user " << cred.uid;
+      return false;
+    }
+    return true;
+  }
+
+  void ShmTransportSocket::accept(EventLoop* eventLoop, SocketPtr control, const qi::Url& remote,
+                                  boost::function<void (TransportSocketPtr)> onDone)
+  {
+    // Wait for the hello without reading it, recvmsg is needed to get the fds.
+    control->async_read_some(boost::asio::null_buffers(),
+      [=](const boost::system::error_code& erc, std::size_t)
+      {
+        if (erc)
+        {
+          qiLogVerbose() << "Shared memory handshake failed: " << erc.message();
+          onDone(TransportSocketPtr());
+          return;
+        }
+        detail::ShmHello hello;
+        struct iovec iov = { &hello, sizeof(hello) };
+        union
+        {
+          struct cmsghdr align;
+          char buf[CMSG_SPACE(3 * sizeof(int))];
+        } cmsgBuf;
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cmsgBuf.buf;
+        mh.msg_controllen = sizeof(cmsgBuf.buf);
+        ssize_t res = recvmsg(control->native_handle(), &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          accept(eventLoop, control, remote, onDone);
+          return;
+        }
+        int fds[3] = { -1, -1, -1 };
+        struct cmsghdr* cmsg = res > 0 ? CMSG_FIRSTHDR(&mh) : 0;
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+          memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        try
+        {
+          if (res != sizeof(hello) || fds[0] < 0
+              || hello.magic != detail::shmHelloMagic || hello.version != detail::shmHelloVersion)
+            throw std::runtime_error("invalid hello");
+          // adopt takes ownership of the fds, even on failure.
+          int memFd = fds[0], serverDoorbell = fds[1], clientDoorbell = fds[2];
+          fds[0] = fds[1] = fds[2] = -1;
+          ShmSegmentPtr segment = ShmSegment::adopt(memFd, serverDoorbell, clientDoorbell,
+                                                    static_cast<size_t>(hello.ringSize));
+          char ack = 1;
+          boost::asio::write(*control, boost::asio::buffer(&ack, 1));
+          onDone(boost::make_shared<ShmTransportSocket>(eventLoop, control, segment, remote));
+        }
+        catch (const std::exception& e)
+        {
+          for (int i = 0; i < 3; ++i)
+            if (fds[i] >= 0)
+              ::close(fds[i]);
+          qiLogVerbose() << "Shared memory handshake failed: " << e.what();
+          onDone(TransportSocketPtr());
+        }
+      });
+  }
+
+  qi::FutureSync<void> ShmTransportSocket::connect(const qi::Url &url)
+  {
+    boost::recursive_mutex::scoped_lock l(_closingMutex);
+
+    if (_status != qi::TransportSocket::Status::Disconnected)
+    {
+      const char* s = "connection already in progress";
+      qiLogError() << s;
+      return makeFutureError<void>(s);
+    }
+    if (!url.isValid() || url.host().empty())
+    {
+      qiLogError() << "Error try to connect to a bad address: " << url.str();
+      return qi::makeFutureError<void>(std::string("Bad address ") + url.str());
+    }
+    _url = url;
+    _status = qi::TransportSocket::Status::Connecting;
+    _err = 0;
+    _abort = false;
+    _msg = {};
+    _recvHeader = _recvPayload = 0;
+    _recvPtr = 0;
+    // A previous segment owns the descriptor of the previous doorbell.
+    if (_doorbell.is_open())
+      _doorbell.release();
+    _control = boost::make_shared<Socket>(*static_cast<boost::asio::io_service*>(_eventLoop->nativeHandle()));
+    qiLogVerbose() << "Trying to connect to " << _url.str();
+
+    qi::Promise<void> connectPromise;
+    boost::asio::local::stream_protocol::endpoint ep(std::string(1, '\0') + _url.host());
+    _control->async_connect(ep,
+      boost::bind(&ShmTransportSocket::onConnected, shared_from_this(), _1, connectPromise));
+    return connectPromise.future();
+  }
+
+  void ShmTransportSocket::onConnected(const boost::system::error_code& erc, qi::Promise<void> connectPromise)
+  {
+    boost::recursive_mutex::scoped_lock l(_closingMutex);
+    if (_abort)
+    {
+      connectPromise.setError("Disconnection requested");
+      return;
+    }
+    std::string err;
+    if (erc)
+      err = "System error: " + erc.message();
+    else if (!sameUser(*_control))
+      err = "Server runs as another user";
+    else
+    {
+      try
+      {
+        _segment = ShmSegment::create(detail::shmRingSize());
+        detail::ShmHello hello = { detail::shmHelloMagic, detail::shmHelloVersion, _segment->ringSize };
+        // The server's doorbell is our remote one and conversely.
+        int fds[3] = { _segment->memFd, _segment->remoteDoorbell, _segment->localDoorbell };
+        struct iovec iov = { &hello, sizeof(hello) };
+        union
+        {
+          struct cmsghdr align;
+          char buf[CMSG_SPACE(sizeof(fds))];
+        } cmsgBuf;
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cmsgBuf.buf;
+        mh.msg_controllen = sizeof(cmsgBuf.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        if (sendmsg(_control->native_handle(), &mh, MSG_NOSIGNAL) != sizeof(hello))
+          throw std::runtime_error(std::string("sendmsg: ") + strerror(errno));
+        _doorbell.assign(_segment->localDoorbell);
+      }
+      catch (const std::exception& e)
+      {
+        err = e.what();
+      }
+    }
+    if (!err.empty())
+    {
+      qiLogWarning() << "Error connecting " << _url.str() << ": " << err;
+      error(err);
+      connectPromise.setError(err);
+      return;
+    }
+    boost::asio::async_read(*_control, boost::asio::buffer(&_controlByte, 1),
+      boost::bind(&ShmTransportSocket::onAcknowledged, shared_from_this(), _1, _2, connectPromise));
+  }
+
+  void ShmTransportSocket::onAcknowledged(const boost::system::error_code& erc, std::size_t,
+                                          qi::Promise<void> connectPromise)
+  {
+    if (erc)
+    {
+      qiLogWarning() << "Error connecting " << _url.str() << ": " << erc.message();
+      error("System error: " + erc.message());
+      connectPromise.setError("System error: " + erc.message());
+      return;
+    }
+    {
+      boost::recursive_mutex::scoped_lock l(_closingMutex);
+      if (_abort)
+      {
+        connectPromise.setError("Disconnection requested");
+        return;
+      }
+      _status = qi::TransportSocket::Status::Connected;
+    }
+    connectPromise.setValue(0);
+    connected();
+    ensureReading();
+  }
+
+  void ShmTransportSocket::ensureReading()
+  {
+    {
+      boost::recursive_mutex::scoped_lock l(_closingMutex);
+      if (_isStarted || _abort)
+        return;
+      _isStarted = true;
+      watchControl();
+    }
+    // Consume what the peer sent before we were listening to the doorbell.
+    onDoorbell(boost::system::error_code(), 0);
+  }
+
+  void ShmTransportSocket::watchControl()
+  {
+    // Nothing is expected on the control socket any more, any event on it
+    // means the peer went away.
+    _control->async_read_some(boost::asio::buffer(&_controlByte, 1),
+      boost::bind(&ShmTransportSocket::onControl, shared_from_this(), _1, _2));
+  }
+
+  void ShmTransportSocket::onControl(const boost::system::error_code& erc, std::size_t)
+  {
+    if (erc == boost::asio::error::operation_aborted)
+      return;
+    error(erc ? "System error: " + erc.message() : std::string("Protocol error"));
+  }
+
+  void ShmTransportSocket::waitDoorbell()
+  {
+    boost::recursive_mutex::scoped_lock l(_closingMutex);
+    if (_abort)
+      return;
+    _doorbell.async_read_some(boost::asio::buffer(&_doorbellValue, sizeof(_doorbellValue)),
+      boost::bind(&ShmTransportSocket::onDoorbell, shared_from_this(), _1, _2));
+  }
+
+  void ShmTransportSocket::onDoorbell(const boost::system::error_code& erc, std::size_t)
+  {
+    if (erc)
+    {
+      if (erc != boost::asio::error::operation_aborted)
+        error("System error: " + erc.message());
+      return;
+    }
+    if (_abort)
+      return;
+    if (!receive())
+      return;
+    bool flushed;
+    {
+      // The doorbell also rings when room was made in the outgoing ring.
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+      flushed = flushSendQueue();
+    }
+    if (!flushed)
+    {
+      corruptedRing();
+      return;
+    }
+    waitDoorbell();
+  }
+
+  bool ShmTransportSocket::receive()
+  {
+    static const size_t headerSize = sizeof(MessagePrivate::MessageHeader);
+    detail::ShmRing* in = _segment->in;
+    while (true)
+    {
+      size_t available = 0;
+      if (!_segment->available(available))
+      {
+        corruptedRing();
+        return false;
+      }
+      while (available)
+      {
+        if (_recvHeader < headerSize)
+        {
+          size_t n = std::min(available, headerSize - _recvHeader);
+          _segment->read(static_cast<char*>(_msg._p->getHeader()) + _recvHeader, n);
+          _recvHeader += n;
+          available -= n;
+          if (_recvHeader < headerSize)
+            break;
+          if (!checkHeader())
+            return false;
+          if (_msg._p->header.size)
+          {
+            _recvPtr = static_cast<char*>(_msg._p->buffer.reserve(_msg._p->header.size));
+            continue;
+          }
+        }
+        else
+        {
+          size_t n = std::min(available, _msg._p->header.size - _recvPayload);
+          _segment->read(_recvPtr + _recvPayload, n);
+          _recvPayload += n;
+          available -= n;
+          if (_recvPayload < _msg._p->header.size)
+            break;
+        }
+        if (!dispatchMessage())
+          return false;
+        _msg = {};
+        _recvHeader = _recvPayload = 0;
+        _recvPtr = 0;
+      }
+      // Tell the writer we are going to sleep, then check nothing arrived
+      // meanwhile.
+      in->readerWaiting.store(1);
+      if (!_segment->available(available))
+      {
+        corruptedRing();
+        return false;
+      }
+      if (!available)
+        return true;
+      in->readerWaiting.store(0);
+    }
+  }
+
+  void ShmTransportSocket::corruptedRing()
+  {
+    qiLogWarning() << "Shared memory ring corrupted by " << _url.str() << ", disconnecting.";
+    error("Protocol error");
+  }
+
+  bool ShmTransportSocket::checkHeader()
+  {
+    if (_msg._p->header.magic != MessagePrivate::magic)
+    {
+      qiLogWarning() << "Incorrect magic from " << _url.str() << ", disconnecting"
+           " (expected " << MessagePrivate::magic
+        << ", got " << _msg._p->header.magic << ").";
+      error("Protocol error");
+      return false;
+    }
+    size_t maxPayload = maxIncomingPayload();
+    if (maxPayload && _msg._p->header.size > maxPayload)
+    {
+      qiLogWarning() << "Receiving message of size " << _msg._p->header.size
+        << " above maximum configured payload " << maxPayload << ", closing link."
+           " (configure with environment variable QI_MAX_MESSAGE_PAYLOAD)";
+      error("Message too big");
+      return false;
+    }
+    return true;
+  }
+
+  bool ShmTransportSocket::dispatchMessage()
+  {
+    qiLogDebug() << this << " Recv (" << _msg.type() << "):" << _msg.address();
+    if (!dispatchReceived(_msg, shared_from_this()))
+    {
+      error("Ill-formed message.");
+      return false;
+    }
+    return true;
+  }
+
+  void ShmTransportSocket::error(const std::string& erc)
+  {
+    qiLogVerbose() << "Socket error: " << erc;
+    const bool wasConnected = _status == qi::TransportSocket::Status::Connected;
+    {
+      boost::recursive_mutex::scoped_lock lock(_closingMutex);
+      _isStarted = false;
+      if (_abort)
+        return;
+      _abort = true;
+      _status = qi::TransportSocket::Status::Disconnected;
+
+      boost::system::error_code er;
+      if (_control)
+      {
+        _control->shutdown(boost::asio::local::stream_protocol::socket::shutdown_both, er);
+        _control->close(er);
+      }
+      // The segment is kept mapped until destruction: a handler may still be
+      // running on it.
+      if (_doorbell.is_open())
+        _doorbell.cancel(er);
+    }
+    {
+      // Wake up senders waiting for room.
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+      _sendQueueSpace.notify_all();
+    }
+
+    // synchronous signals, do not keep the mutex while we trigger
+    if (wasConnected)
+      disconnected(erc);
+
+    socketEvent(SocketEventData(erc));
+  }
+
+  qi::FutureSync<void> ShmTransportSocket::disconnect()
+  {
+    if (_status == qi::TransportSocket::Status::Disconnected)
+      return qi::Future<void>(0);
+
+    qiLogDebug() << "Disconnecting shared memory transport socket";
+    return _eventLoop->async(boost::bind(&ShmTransportSocket::error, shared_from_this(),
+                                         "Disconnection requested"));
+  }
+
+  /// Bytes a message occupies in the send queue.
+  static size_t queuedSize(const qi::Message& msg)
+  {
+    return sizeof(qi::MessagePrivate::MessageHeader) + msg.buffer().totalSize();
+  }
+
+  bool ShmTransportSocket::sendQueueFull() const
+  {
+    return (_maxSendQueueBytes && _sendQueueBytes >= _maxSendQueueBytes)
+        || (_maxSendQueueMessages && _sendQueue.size() >= _maxSendQueueMessages);
+  }
+
+  void ShmTransportSocket::dropOldestEvents()
+  {
+    std::deque<Message>::iterator it = _sendQueue.begin();
+    // The front message may be partly copied into the ring already.
+    if (!_sendChunks.empty() && it != _sendQueue.end())
+      ++it;
+    while (sendQueueFull() && it != _sendQueue.end())
+    {
+      if (it->type() != Message::Type_Event)
+      {
+        ++it;
+        continue;
+      }
+      qiLogVerbose() << this << " Send queue full, dropping event " << it->address();
+      _sendQueueBytes -= queuedSize(*it);
+      it = _sendQueue.erase(it);
+    }
+  }
+
+  bool ShmTransportSocket::makeRoom(boost::mutex::scoped_lock& lock, const qi::Message& msg)
+  {
+    if (!sendQueueFull())
+      return true;
+    // As TcpTransportSocket's default policies: events drop older events,
+    // other messages wait for the queue to drain, unless they are sent from
+    // a network thread which must not block.
+    if (msg.type() == Message::Type_Event || isNetworkThread() || _eventLoop->isInThisContext())
+    {
+      dropOldestEvents();
+      if (msg.type() != Message::Type_Event || !sendQueueFull())
+        return true;
+      qiLogVerbose() << this << " Send queue full, dropping event " << msg.address();
+      return false;
+    }
+    while (sendQueueFull() && _status == qi::TransportSocket::Status::Connected)
+      _sendQueueSpace.wait(lock);
+    return _status == qi::TransportSocket::Status::Connected;
+  }
+
+  bool ShmTransportSocket::send(const qi::Message &msg)
+  {
+    if (_status != qi::TransportSocket::Status::Connected)
+      return false;
+    {
+      // Wait for room without holding _closingMutex, error() needs it.
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+      if (!makeRoom(lock, msg))
+        return false;
+    }
+    boost::recursive_mutex::scoped_lock lockc(_closingMutex);
+
+    if (_abort || _status != qi::TransportSocket::Status::Connected)
+    {
+      qiLogDebug() << this << "Send on closed socket";
+      return false;
+    }
+
+    qiLogDebug() << this << " Send (" << msg.type() << "):" << msg.address();
+    bool flushed = true;
+    {
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+      _sendQueue.push_back(msg);
+      _sendQueueBytes += queuedSize(msg);
+      if (_sendQueue.size() == 1)
+        flushed = flushSendQueue();
+    }
+    if (!flushed)
+    {
+      // Not under _sendQueueMutex: disconnection handlers may send.
+      corruptedRing();
+      return false;
+    }
+    return true;
+  }
+
+  bool ShmTransportSocket::flushSendQueue()
+  {
+    bool wrote = false;
+    while (!_sendQueue.empty())
+    {
+      if (_sendChunks.empty())
+      {
+        // Start the message at the front of the queue.
+        Message& msg = _sendQueue.front();
+        msg._p->complete();
+        _sendChunks.push_back(std::make_pair(static_cast<const char*>(msg._p->getHeader()),
+                                             sizeof(MessagePrivate::MessageHeader)));
+        const Buffer& buf = msg.buffer();
+        const std::vector<std::pair<size_t, Buffer> >& subs = buf.subBuffers();
+        size_t pos = 0;
+        for (unsigned i = 0; i < subs.size(); ++i)
+        {
+          // Parent buffer up to the size of the sub-buffer, then the sub-buffer.
+          size_t end = subs[i].first + 4;
+          if (end != pos)
+            _sendChunks.push_back(std::make_pair(static_cast<const char*>(buf.data()) + pos, end - pos));
+          pos = end;
+          _sendChunks.push_back(std::make_pair(static_cast<const char*>(subs[i].second.data()),
+                                               subs[i].second.size()));
+        }
+        if (buf.size() != pos)
+          _sendChunks.push_back(std::make_pair(static_cast<const char*>(buf.data()) + pos, buf.size() - pos));
+        _sendChunk = 0;
+        _sendOffset = 0;
+        _dispatcher.sent(msg);
+      }
+
+      while (_sendChunk < _sendChunks.size())
+      {
+        const std::pair<const char*, size_t>& chunk = _sendChunks[_sendChunk];
+        size_t n = 0;
+        if (!_segment->write(chunk.first + _sendOffset, chunk.second - _sendOffset, n))
+          return false;
+        wrote = wrote || n;
+        _sendOffset += n;
+        if (_sendOffset < chunk.second)
+          break;
+        ++_sendChunk;
+        _sendOffset = 0;
+      }
+
+      if (_sendChunk < _sendChunks.size())
+      {
+        // The ring is full: ask the reader for a wake up, unless it made room
+        // in the meantime.
+        _segment->out->writerWaiting.store(1);
+        if (_segment->out->tail.load() != _segment->out->head.load(std::memory_order_relaxed) - _segment->ringSize)
+        {
+          _segment->out->writerWaiting.store(0);
+          continue;
+        }
+        break;
+      }
+      _sendChunks.clear();
+      _sendQueueBytes -= queuedSize(_sendQueue.front());
+      _sendQueue.pop_front();
+      _sendQueueSpace.notify_all();
+    }
+    if (wrote && _segment->out->readerWaiting.exchange(0))
+      _segment->notify();
+    return true;
+  }
+}
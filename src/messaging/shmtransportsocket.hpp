@@ -0,0 +1,143 @@
+#pragma once
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_SHMTRANSPORTSOCKET_HPP_
+#define _SRC_SHMTRANSPORTSOCKET_HPP_
+
+# include <deque>
+# include <string>
+# include <vector>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/recursive_mutex.hpp>
+# include <boost/asio.hpp>
+# include <qi/api.hpp>
+# include <qi/url.hpp>
+# include <qi/eventloop.hpp>
+# include "message.hpp"
+# include "transportsocket.hpp"
+
+namespace qi
+{
+  namespace detail
+  {
+    class ShmSegment;
+    using ShmSegmentPtr = boost::shared_ptr<ShmSegment>;
+  }
+
+  /**
+   * Socket handling the Qi messaging protocol between two processes of the
+   * same machine through memory they share.
+   *
+   * The segment holds one ring per direction. Messages are copied into the
+   * ring by the sender and out of it by the receiver, the kernel is only
+   * entered to ring the doorbell (an eventfd) of a sleeping peer.
+   *
+   * Peers meet on a local control socket (abstract unix socket named after
+   * the host part of the url, the port is unused): the client creates the
+   * segment and passes it along with the doorbells to the server. The
+   * control socket is then only used to detect disconnection. Both sides
+   * only accept a peer process of the same user.
+   *
+   * The send queue is bounded by QI_SEND_QUEUE_MAX_BYTES and
+   * QI_SEND_QUEUE_MAX_MESSAGES: over them, events are dropped, oldest first,
+   * and other messages wait for room, except on network threads.
+   *
+   * Only available on Linux.
+   */
+  class ShmTransportSocket : public TransportSocket, public boost::enable_shared_from_this<ShmTransportSocket>
+  {
+  public:
+    using Socket = boost::asio::local::stream_protocol::socket;
+    using SocketPtr = boost::shared_ptr<Socket>;
+
+    explicit ShmTransportSocket(EventLoop* eventLoop = getNetworkEventLoop());
+    /// Server side socket, @p control is connected and @p segment was received from the client.
+    ShmTransportSocket(EventLoop* eventLoop, SocketPtr control, detail::ShmSegmentPtr segment, const qi::Url& remote);
+    virtual ~ShmTransportSocket();
+
+    /// Connects the socket as a client and ensures that it is reading.
+    virtual qi::FutureSync<void> connect(const qi::Url &url);
+
+    /// Stops reading the socket and disconnects it.
+    virtual qi::FutureSync<void> disconnect();
+
+    virtual bool send(const qi::Message &msg);
+    virtual void ensureReading();
+    virtual qi::Url remoteEndpoint() const;
+
+    /// Receive the segment of a client freshly accepted on @p control, then
+    /// call @p onDone with the connected socket, or a null socket on failure.
+    static void accept(EventLoop* eventLoop, SocketPtr control, const qi::Url& remote,
+                       boost::function<void (TransportSocketPtr)> onDone);
+
+    /// Whether the peer of @p control runs as our user. The abstract socket
+    /// has no file permissions: anyone may listen on or connect to it.
+    static bool sameUser(Socket& control);
+
+  private:
+    void error(const std::string& erc);
+
+    void onConnected(const boost::system::error_code& erc, qi::Promise<void> connectPromise);
+    void onAcknowledged(const boost::system::error_code& erc, std::size_t len, qi::Promise<void> connectPromise);
+    void onControl(const boost::system::error_code& erc, std::size_t len);
+    void onDoorbell(const boost::system::error_code& erc, std::size_t len);
+    void watchControl();
+    void waitDoorbell();
+
+    /// Consumes everything available in the incoming ring, returns false if the socket errored.
+    bool receive();
+    /// Reports a ring whose indexes were corrupted by the peer and closes.
+    void corruptedRing();
+    /// Validates the header of _msg, calls error() and returns false if invalid.
+    bool checkHeader();
+    /// Dispatches the fully received _msg, returns false if the socket errored.
+    bool dispatchMessage();
+    /// True if the send queue is over one of its limits.
+    /// Must be called with _sendQueueMutex locked.
+    bool sendQueueFull() const;
+    /// Drops queued events, oldest first, until the queue is under its limits.
+    /// Must be called with _sendQueueMutex locked.
+    void dropOldestEvents();
+    /// Makes room in the send queue for @p msg, returns false if it must be
+    /// dropped. May wait on @p lock, which holds _sendQueueMutex.
+    bool makeRoom(boost::mutex::scoped_lock& lock, const qi::Message& msg);
+    /// Copies queued messages into the outgoing ring until it is full.
+    /// Returns false if the ring is corrupted. Must be called with
+    /// _sendQueueMutex locked.
+    bool flushSendQueue();
+
+    detail::ShmSegmentPtr _segment;
+    SocketPtr _control;
+    boost::asio::posix::stream_descriptor _doorbell;
+    qi::uint64_t _doorbellValue;
+    char _controlByte;
+
+    bool _abort; // used to notify handlers that we are dead
+    bool _isStarted;
+    mutable boost::recursive_mutex _closingMutex;
+
+    // data to rebuild message
+    qi::Message _msg;
+    size_t      _recvHeader;  // bytes of the header received so far
+    size_t      _recvPayload; // bytes of the payload received so far
+    char*       _recvPtr;
+
+    // Message being copied into the outgoing ring, as a list of chunks.
+    std::vector<std::pair<const char*, size_t> > _sendChunks;
+    size_t _sendChunk;
+    size_t _sendOffset;
+    boost::mutex        _sendQueueMutex; // protects _sendQueue and _sendChunks
+    std::deque<Message> _sendQueue;
+    size_t              _sendQueueBytes;
+    size_t              _maxSendQueueBytes;
+    size_t              _maxSendQueueMessages;
+    boost::condition_variable _sendQueueSpace; // notified when the queue shrinks
+  };
+
+  using ShmTransportSocketPtr = boost::shared_ptr<ShmTransportSocket>;
+}
+
+#endif  // _SRC_SHMTRANSPORTSOCKET_HPP_
@@ -18,10 +18,20 @@
 #include <linux/in.h> // for  IPPROTO_TCP
 #endif
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/make_shared.hpp>
 
 #include "tcptransportsocket.hpp"
+#include "fdpassing.hpp"
+#include "src/eventloop_p.hpp"
 
 #include <qi/log.hpp>
 #include <qi/os.hpp>
@@ -57,24 +67,137 @@ static void pSetValue(qi::Promise<void> prom) {
 
 namespace qi
 {
+  namespace detail
+  {
+    struct PassedBuffers
+    {
+      ~PassedBuffers()
+      {
+#ifndef _WIN32
+        for (unsigned i = 0; i < fds.size(); ++i)
+          ::close(fds[i]);
+#endif
+      }
+
+      MessagePrivate::MessageHeader header; // sent instead of the one of the message
+      std::vector<qi::uint32_t> table;      // count, then offsets in the payload
+      std::vector<int> fds;
+    };
+
+    struct ChunkedSend
+    {
+      ChunkedSend() : lane(0), next(0), frames(0) {}
+
+      qi::Message msg;
+      int lane;                             // held until the last chunk
+      SendPromisePtr promise;
+      std::vector<boost::asio::const_buffer> payload; // what is left to send from next
+      size_t next;
+      unsigned int frames;                  // chunks sent so far
+      qi::uint32_t prefix[2];               // stream id, then total payload size
+      MessagePrivate::MessageHeader frame;  // header of the chunk being written
+    };
+
+    /// Everything a write refers to, kept until it completes.
+    struct SendBatch
+    {
+      SendBatch() : fdPassing(false) {}
+
+      std::vector<qi::Message> msgs; // written whole
+      ChunkedSendPtr chunk;          // written one chunk of
+      std::vector<SendPromisePtr> promises; // of the messages this write completes
+      std::vector<PassedBuffersPtr> passed;
+      std::vector<boost::asio::const_buffer> buffers;
+      bool fdPassing;
+    };
+  }
+
+  size_t TcpTransportSocket::messageChunkSize()
+  {
+    static size_t res = 0;
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    if (!init)
+    {
+      // By default a whole chunk, with its header and its stream id and
+      // size prefix, fits in the receive buffer: the receiver parses it
+      // from there instead of reading it into its own storage.
+      static const size_t defaultSize =
+          recvBufferSize - sizeof(MessagePrivate::MessageHeader) - 2 * sizeof(qi::uint32_t);
+      std::string l = os::getenv("QI_MESSAGE_CHUNK_SIZE");
+      res = l.empty() ? defaultSize : strtol(l.c_str(), 0, 0);
+      init = true;
+    }
+    return res;
+  }
+
+  /// Share of the socket of each lane under contention.
+  static const unsigned int sendLaneWeights[detail::SendLane_Count] = { 0, 8, 4, 1 };
+
+  static detail::SendLane sendLane(const qi::Message& msg)
+  {
+    switch (msg.type())
+    {
+    case Message::Type_Capability:
+      return detail::SendLane_Control;
+    case Message::Type_Reply:
+    case Message::Type_Error:
+    case Message::Type_Canceled:
+      return detail::SendLane_Reply;
+    case Message::Type_Event:
+      return detail::SendLane_Event;
+    default:
+      // Cancellations must not overtake their call.
+      return detail::SendLane_Call;
+    }
+  }
+
+  static void setSendError(const detail::SendPromisePtr& promise, const std::string& error)
+  {
+    if (promise)
+      promise->setError(error);
+  }
+
   TcpTransportSocket::TcpTransportSocket(EventLoop* eventLoop, bool ssl, boost::shared_ptr<Socket> s)
     : TransportSocket()
     , _ssl(ssl)
+    , _local(false)
     , _nextHandshakeType()
     , _sslContext(boost::asio::ssl::context::sslv23)
     , _abort(false)
     , _connecting(false)
+    , _recvBuffer(recvBufferSize)
+    , _recvBegin(0)
+    , _recvEnd(0)
+    , _recvChunkedBytes(0)
+    , _sendQueueCount(0)
+    , _sendQueueBytes(0)
+    , _maxSendQueueBytes(defaultMaxSendQueueBytes())
+    , _maxSendQueueMessages(defaultMaxSendQueueMessages())
+    , _nextChunkStream(0)
     , _sending(false)
     , _isStarted(false)
   {
     _eventLoop = eventLoop;
     _err = 0;
     _status = qi::TransportSocket::Status::Disconnected;
+    _sendPolicies[Message::Type_Event] = SendPolicy::DropOldest;
+    std::copy(sendLaneWeights, sendLaneWeights + detail::SendLane_Count, _sendCredits);
+    std::fill(_sendLaneChunked, _sendLaneChunked + detail::SendLane_Count, false);
+    if (messageChunkSize())
+      advertiseCapability("MessageChunks", AnyValue::from(true));
 
     if (s)
     {
       _socket = s;
       _status = qi::TransportSocket::Status::Connected;
+      boost::system::error_code ec;
+      int family = s->lowest_layer().local_endpoint(ec).protocol().family();
+      _local = !ec && family != AF_INET && family != AF_INET6;
+#ifdef __linux__
+      if (_local && detail::fdPassingThreshold())
+        advertiseCapability("FdPassing", AnyValue::from(true));
+#endif
       if (_ssl)
         _nextHandshakeType = boost::asio::ssl::stream_base::server;
       // Transmit each Message without delay
@@ -88,6 +211,10 @@ namespace qi
   {
     qiLogDebug() << this;
     error("Destroying TcpTransportSocket");
+#ifndef _WIN32
+    for (unsigned i = 0; i < _recvFds.size(); ++i)
+      ::close(_recvFds[i]);
+#endif
     qiLogVerbose() << "deleted " << this;
   }
 
@@ -118,25 +245,56 @@ namespace qi
       return;
     }
 
-    if (_ssl)
+    if (_ssl && _nextHandshakeType)
     {
-      if (_nextHandshakeType)
-      {
-        _socket->async_handshake(_nextHandshakeType.value(),
-          boost::bind(&TcpTransportSocket::handshake, shared_from_this(), _1, _socket, connectionAttemptPromise));
-        return;
-      }
+      _socket->async_handshake(_nextHandshakeType.value(),
+        boost::bind(&TcpTransportSocket::handshake, shared_from_this(), _1, _socket, connectionAttemptPromise));
+      return;
+    }
 
-      boost::asio::async_read(*_socket,
-        boost::asio::buffer(_msg._p->getHeader(), sizeof(MessagePrivate::MessageHeader)),
-        boost::bind(&TcpTransportSocket::onReadHeader, shared_from_this(), _1, _2, _socket));
+    // Read as much as is available in the free part of the receive buffer.
+    QI_ASSERT(_recvEnd < _recvBuffer.size());
+    boost::asio::mutable_buffers_1 b =
+      boost::asio::buffer(&_recvBuffer[_recvEnd], _recvBuffer.size() - _recvEnd);
+    if (_ssl)
+    {
+      _socket->async_read_some(b,
+        boost::bind(&TcpTransportSocket::onReadSome, shared_from_this(), _1, _2, _socket));
+    }
+#ifdef __linux__
+    else if (_local)
+    {
+      // Passed file descriptors can only be received by recvmsg().
+      _socket->next_layer().async_read_some(boost::asio::null_buffers(),
+        boost::bind(&TcpTransportSocket::onReadable, shared_from_this(), _1, _socket));
     }
+#endif
     else
     {
-      boost::asio::async_read(_socket->next_layer(),
-        boost::asio::buffer(_msg._p->getHeader(), sizeof(MessagePrivate::MessageHeader)),
-        boost::bind(&TcpTransportSocket::onReadHeader, shared_from_this(), _1, _2, _socket));
+      _socket->next_layer().async_read_some(b,
+        boost::bind(&TcpTransportSocket::onReadSome, shared_from_this(), _1, _2, _socket));
+    }
+  }
+
+  void TcpTransportSocket::onReadable(const boost::system::error_code& erc, SocketPtr s)
+  {
+    boost::system::error_code ec = erc;
+    std::size_t len = 0;
+#ifdef __linux__
+    if (!ec)
+    {
+      long res = detail::receiveWithFds(s->next_layer().native_handle(),
+          &_recvBuffer[_recvEnd], _recvBuffer.size() - _recvEnd, _recvFds);
+      if (res > 0)
+        len = res;
+      else if (res == 0)
+        ec = boost::asio::error::eof;
+      else if (errno != EAGAIN && errno != EWOULDBLOCK)
+        ec = boost::system::error_code(errno, boost::system::system_category());
     }
+#endif
+    // Nothing read without error: wait again.
+    onReadSome(ec, len, s);
   }
 
   qi::Url TcpTransportSocket::remoteEndpoint() const
@@ -144,13 +302,22 @@ namespace qi
     boost::recursive_mutex::scoped_lock lock(_closingMutex);
     if (!_socket)
       return qi::Url();
-    return qi::Url(
-      _socket->lowest_layer().remote_endpoint().address().to_string(),
-      "tcp",
-      _socket->lowest_layer().remote_endpoint().port());
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    if (_local)
+    {
+      // Peers of a listening unix socket are unnamed, use our own path.
+      if (_url.isValid())
+        return _url;
+      return qi::Url("unix://" + detail::toEndpoint<boost::asio::local::stream_protocol::endpoint>(
+                       _socket->lowest_layer().local_endpoint()).path());
+    }
+#endif
+    boost::asio::ip::tcp::endpoint ep =
+      detail::toEndpoint<boost::asio::ip::tcp::endpoint>(_socket->lowest_layer().remote_endpoint());
+    return qi::Url(ep.address().to_string(), "tcp", ep.port());
   }
 
-  void TcpTransportSocket::onReadHeader(const boost::system::error_code& erc,
+  void TcpTransportSocket::onReadSome(const boost::system::error_code& erc,
     std::size_t len, SocketPtr)
   {
     if (erc)
@@ -164,120 +331,292 @@ namespace qi
       _continueReading(qi::Promise<void>{});
       return;
     }
-    QI_ASSERT(len == sizeof(_msg._p->header));
+    _recvEnd += len;
+
+    // Carve out every complete message present in the receive buffer.
+    static const size_t headerSize = sizeof(MessagePrivate::MessageHeader);
+    while (_recvEnd - _recvBegin >= headerSize)
+    {
+      memcpy(_msg._p->getHeader(), &_recvBuffer[_recvBegin], headerSize);
+      if (!checkHeader())
+        return;
+      size_t payload = _msg._p->header.size;
+      size_t available = _recvEnd - _recvBegin - headerSize;
+
+      if (headerSize + payload > _recvBuffer.size())
+      {
+        if (!checkReceivedFds())
+          return;
+        // Message does not fit in the receive buffer, read the remaining
+        // payload directly into its own storage.
+        unsigned char* ptr = static_cast<unsigned char*>(_msg._p->buffer.reserve(payload));
+        memcpy(ptr, &_recvBuffer[_recvBegin + headerSize], available);
+        _recvBegin = _recvEnd = 0;
+
+        boost::recursive_mutex::scoped_lock l(_closingMutex);
+
+        if (_abort)
+        {
+          error("Aborted");
+          return;
+        }
+
+        boost::asio::mutable_buffers_1 b = boost::asio::buffer(ptr + available, payload - available);
+        if (_ssl)
+        {
+          boost::asio::async_read(*_socket, b,
+            boost::bind(&TcpTransportSocket::onReadData, shared_from_this(), _1, _2, _socket));
+        }
+        else
+        {
+          boost::asio::async_read(_socket->next_layer(), b,
+            boost::bind(&TcpTransportSocket::onReadData, shared_from_this(), _1, _2, _socket));
+        }
+        return;
+      }
+
+      if (available < payload)
+        break;
+
+      if (payload)
+        memcpy(_msg._p->buffer.reserve(payload), &_recvBuffer[_recvBegin + headerSize], payload);
+      _recvBegin += headerSize + payload;
+      if (!dispatchMessage())
+        return;
+      _msg = {};
+    }
+    if (!checkReceivedFds())
+      return;
+
+    // Move the incomplete message, if any, to the beginning of the buffer.
+    if (_recvBegin)
+    {
+      memmove(&_recvBuffer[0], &_recvBuffer[_recvBegin], _recvEnd - _recvBegin);
+      _recvEnd -= _recvBegin;
+      _recvBegin = 0;
+    }
+    _continueReading(qi::Promise<void>{});
+  }
+
+  bool TcpTransportSocket::checkHeader()
+  {
     // check magic
     if (_msg._p->header.magic != MessagePrivate::magic)
     {
       qiLogWarning() << "Incorrect magic from "
-        << _socket->lowest_layer().remote_endpoint().address().to_string()
+        << remoteEndpoint().str()
         << ", disconnecting"
            " (expected " << MessagePrivate::magic
         << ", got " << _msg._p->header.magic << ").";
       error("Protocol error");
-      return;
+      return false;
     }
 
     size_t payload = _msg._p->header.size;
     if (payload)
     {
-      static size_t maxPayload = 0;
-      static bool init = false;
-      // Not thread-safe, limited consequences
-      // worst case: first received messages will not honor limit)
-      if (!init)
-      {
-        init = true;
-        std::string l = os::getenv("QI_MAX_MESSAGE_PAYLOAD");
-        if (!l.empty())
-          maxPayload = strtol(l.c_str(), 0, 0);
-        else
-          maxPayload = 50000000; // reasonable default
-      }
+      size_t maxPayload = maxIncomingPayload();
       if (maxPayload && payload > maxPayload)
       {
         qiLogWarning() << "Receiving message of size " << payload
           << " above maximum configured payload " << maxPayload << ", closing link."
              " (configure with environment variable QI_MAX_MESSAGE_PAYLOAD)";
         error("Message too big");
-        return;
+        return false;
       }
+    }
+    return true;
+  }
 
-      void* ptr = _msg._p->buffer.reserve(payload);
+  void TcpTransportSocket::onReadData(const boost::system::error_code& erc,
+    std::size_t len, SocketPtr)
+  {
+    if (erc)
+    {
+      error("System error: " + erc.message());
+      return;
+    }
+    if (!dispatchMessage())
+      return;
+    _msg = {};
+    _continueReading(qi::Promise<void>{});
+  }
 
-      boost::recursive_mutex::scoped_lock l(_closingMutex);
+  bool TcpTransportSocket::checkReceivedFds()
+  {
+#ifdef __linux__
+    // The descriptors of a write come with its first byte, and every message
+    // of the previous writes was parsed: only the last write may still claim
+    // some. Anything more was sent without a message to claim it.
+    if (_recvFds.size() <= detail::maxPassedFds)
+      return true;
+    qiLogWarning() << "Received " << _recvFds.size() << " unclaimed file descriptors from "
+      << remoteEndpoint().str() << ", disconnecting.";
+    for (unsigned i = 0; i < _recvFds.size(); ++i)
+      ::close(_recvFds[i]);
+    _recvFds.clear();
+    error("Protocol error");
+    return false;
+#else
+    return true;
+#endif
+  }
 
-      if (_abort)
+  bool TcpTransportSocket::receivePassedBuffers()
+  {
+#ifdef __linux__
+    const char* data = static_cast<const char*>(_msg._p->buffer.data());
+    size_t size = _msg._p->buffer.size();
+    qi::uint32_t count = 0;
+    if (size >= sizeof(count))
+      memcpy(&count, data, sizeof(count));
+    size_t tableSize = sizeof(qi::uint32_t) * (1 + count);
+    if (count == 0 || count > detail::maxPassedFds || size < tableSize || _recvFds.size() < count)
+      return false;
+    std::vector<qi::uint32_t> offsets(count);
+    memcpy(&offsets[0], data + sizeof(count), sizeof(qi::uint32_t) * count);
+
+    // Rebuild the payload with the mapped buffers as sub-buffers, where the
+    // sender had them.
+    const char* payload = data + tableSize;
+    size_t payloadSize = size - tableSize;
+    qi::Buffer result;
+    result.reserveCapacity(payloadSize);
+    size_t pos = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+      size_t offset = offsets[i];
+      int fd = _recvFds.front();
+      _recvFds.pop_front();
+      qi::uint32_t subSize;
+      qi::Buffer sub;
+      if (offset < pos || offset + sizeof(subSize) > payloadSize)
       {
-        error("Aborted");
-        return;
+        ::close(fd);
+        return false;
       }
+      memcpy(&subSize, payload + offset, sizeof(subSize));
+      if (!detail::mapSealedMemfd(fd, subSize, sub))
+        return false;
+      result.write(payload + pos, offset - pos);
+      result.addSubBuffer(sub);
+      pos = offset + sizeof(subSize);
+    }
+    result.write(payload + pos, payloadSize - pos);
+    _msg._p->buffer = std::move(result);
+    _msg._p->header.flags &= ~Message::TypeFlag_PassedBuffers;
+    _msg._p->complete();
+    return true;
+#else
+    return false;
+#endif
+  }
 
-      if (_ssl)
+  /// Payload bytes of the messages being reassembled from chunks at once,
+  /// 0 if unlimited (configure with QI_MAX_CHUNKED_PAYLOAD, defaults to
+  /// twice @p maxPayload).
+  static size_t maxChunkedPayload(size_t maxPayload)
+  {
+    static size_t res = 0;
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    if (!init)
+    {
+      std::string l = os::getenv("QI_MAX_CHUNKED_PAYLOAD");
+      res = l.empty() ? 2 * maxPayload : strtol(l.c_str(), 0, 0);
+      init = true;
+    }
+    return res;
+  }
+
+  bool TcpTransportSocket::receiveChunk(bool& complete)
+  {
+    const char* data = static_cast<const char*>(_msg._p->buffer.data());
+    size_t size = _msg._p->buffer.size();
+    qi::uint32_t stream;
+    if (size < sizeof(stream))
+      return false;
+    memcpy(&stream, data, sizeof(stream));
+    data += sizeof(stream);
+    size -= sizeof(stream);
+
+    std::map<qi::uint32_t, qi::Message>::iterator it = _recvChunks.find(stream);
+    if (it == _recvChunks.end())
+    {
+      // First chunk: the header of the message and the size of its payload.
+      qi::uint32_t total;
+      if (size < sizeof(total))
+        return false;
+      memcpy(&total, data, sizeof(total));
+      data += sizeof(total);
+      size -= sizeof(total);
+      qi::Message msg;
+      msg._p->header = _msg._p->header;
+      msg._p->header.flags &= ~Message::TypeFlag_Chunk;
+      msg._p->header.size = total;
+      size_t maxPayload = maxIncomingPayload();
+      if (maxPayload && total > maxPayload)
       {
-        boost::asio::async_read(*_socket,
-          boost::asio::buffer(ptr, payload),
-          boost::bind(&TcpTransportSocket::onReadData, shared_from_this(), _1, _2, _socket));
+        qiLogWarning() << "Receiving chunked message of size " << total
+          << " above maximum configured payload " << maxPayload << ", closing link."
+             " (configure with environment variable QI_MAX_MESSAGE_PAYLOAD)";
+        return false;
       }
-      else
+      // The sender has at most one chunked message per lane in progress.
+      size_t maxBytes = maxChunkedPayload(maxPayload);
+      if (_recvChunks.size() >= detail::SendLane_Count
+          || (maxBytes && _recvChunkedBytes + total > maxBytes))
       {
-        boost::asio::async_read(_socket->next_layer(),
-          boost::asio::buffer(ptr, payload),
-          boost::bind(&TcpTransportSocket::onReadData, shared_from_this(), _1, _2, _socket));
+        qiLogWarning() << "Too many chunked messages in progress (" << _recvChunks.size()
+          << " messages, " << _recvChunkedBytes << " bytes), closing link."
+             " (configure with environment variable QI_MAX_CHUNKED_PAYLOAD)";
+        return false;
       }
+      msg._p->buffer.reserveCapacity(total);
+      _recvChunkedBytes += total;
+      it = _recvChunks.insert(std::make_pair(stream, msg)).first;
     }
-    else
-      onReadData(boost::system::error_code(), 0, _socket);
+    qi::Message& msg = it->second;
+    if (msg._p->buffer.size() + size > msg._p->header.size)
+      return false;
+    msg._p->buffer.write(data, size);
+    complete = msg._p->buffer.size() == msg._p->header.size;
+    if (complete)
+    {
+      _msg = msg;
+      _recvChunkedBytes -= msg._p->header.size;
+      _recvChunks.erase(it);
+    }
+    return true;
   }
 
-  void TcpTransportSocket::onReadData(const boost::system::error_code& erc,
-    std::size_t len, SocketPtr)
+  bool TcpTransportSocket::dispatchMessage()
   {
-    if (erc)
+    if (_msg._p->header.flags & Message::TypeFlag_Chunk)
     {
-      error("System error: " + erc.message());
-      return;
+      bool complete = false;
+      if (!receiveChunk(complete))
+      {
+        error("Ill-formed message chunk.");
+        return false;
+      }
+      if (!complete)
+        return true;
     }
     qiLogDebug() << this << " Recv (" << _msg.type() << "):" << _msg.address();
+    if ((_msg._p->header.flags & Message::TypeFlag_PassedBuffers) && !receivePassedBuffers())
+    {
+      error("Ill-formed passed buffers.");
+      return false;
+    }
     static int usWarnThreshold = os::getenv("QIMESSAGING_SOCKET_DISPATCH_TIME_WARN_THRESHOLD").empty()?0:strtol(os::getenv("QIMESSAGING_SOCKET_DISPATCH_TIME_WARN_THRESHOLD").c_str(),0,0);
     qi::int64_t start = 0;
     if (usWarnThreshold)
       start = os::ustime(); // call might be not that cheap
-    if ((!hasReceivedRemoteCapabilities() &&
-          _msg.service() == Message::Service_Server &&
-          _msg.function() == Message::ServerFunction_Authenticate)
-        || _msg.type() == Message::Type_Capability)
+    if (!dispatchReceived(_msg, shared_from_this()))
     {
-      // This one is for us
-      if (_msg.type() != Message::Type_Error)
-      {
-        AnyReference cmRef;
-        try
-        {
-          cmRef = _msg.value(typeOf<CapabilityMap>()->signature(), shared_from_this());
-          CapabilityMap cm = cmRef.to<CapabilityMap>();
-          cmRef.destroy();
-          boost::mutex::scoped_lock lock(_contextMutex);
-          _remoteCapabilityMap.insert(cm.begin(), cm.end());
-        }
-        catch (const std::runtime_error& e)
-        {
-          cmRef.destroy();
-          qiLogError() << "Ill-formed capabilities message: " << e.what();
-          return error("Ill-formed capabilities message.");
-        }
-      }
-      if (_msg.type() != Message::Type_Capability)
-      {
-        messageReady(_msg);
-        socketEvent(SocketEventData(_msg));
-        _dispatcher.dispatch(_msg);
-      }
-    }
-    else
-    {
-      messageReady(_msg);
-      socketEvent(SocketEventData(_msg));
-      _dispatcher.dispatch(_msg);
+      error("Ill-formed message.");
+      return false;
     }
     if (usWarnThreshold)
     {
@@ -285,8 +624,7 @@ namespace qi
       if (duration > usWarnThreshold)
         qiLogWarning() << "Dispatch to user took " << duration << "us";
     }
-    _msg = {};
-    _continueReading(qi::Promise<void>{});
+    return true;
   }
 
   void TcpTransportSocket::error(const std::string& erc)
@@ -314,11 +652,25 @@ namespace qi
 
       {
         boost::mutex::scoped_lock l(_sendQueueMutex);
+        // A partly sent message can not be resumed on another connection.
+        for (unsigned i = 0; i < _sendChunked.size(); ++i)
+          setSendError(_sendChunked[i]->promise, "Socket closed");
+        _sendChunked.clear();
+        std::fill(_sendLaneChunked, _sendLaneChunked + detail::SendLane_Count, false);
+        for (int lane = 0; lane < detail::SendLane_Count; ++lane)
+        {
+          for (unsigned i = 0; i < _sendQueue[lane].size(); ++i)
+            setSendError(_sendQueue[lane][i].promise, "Socket closed");
+          _sendQueue[lane].clear();
+        }
+        _sendQueueCount = 0;
+        _sendQueueBytes = 0;
+        _sendQueueSpace.notify_all();
         boost::system::error_code er;
         if (_socket)
         {
           // Unconditionally try to shutdown if socket is present, it might be in connecting state.
-          _socket->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, er);
+          _socket->lowest_layer().shutdown(boost::asio::socket_base::shutdown_both, er);
           _socket->lowest_layer().close(er);
         }
       }
@@ -348,17 +700,49 @@ namespace qi
     }
     auto eventLoopAsAsioService = static_cast<boost::asio::io_service*>(_eventLoop->nativeHandle());
     _socket = boost::make_shared<Socket>(*eventLoopAsAsioService, _sslContext);
+    _recvBegin = _recvEnd = 0;
+    _recvChunks.clear();
+    _recvChunkedBytes = 0;
     _url = url;
+    _local = _url.protocol() == "unix";
+#ifdef __linux__
+    if (_local && detail::fdPassingThreshold())
+      advertiseCapability("FdPassing", AnyValue::from(true));
+#endif
     _status = qi::TransportSocket::Status::Connecting;
     _connecting = true;
     _err = 0;
-    if (_url.port() == 0 || !url.isValid()) {
+    if ((!_local && _url.port() == 0) || !url.isValid()) {
       qiLogError() << "Error try to connect to a bad address: " << _url.str();
 
       _status = qi::TransportSocket::Status::Disconnected;
       _connecting = false;
       return qi::makeFutureError<void>(std::string("Bad address ") + _url.str());
     }
+    if (_local)
+    {
+      qiLogVerbose() << "Trying to connect to " << _url.str();
+      qi::Promise<void> connectPromise;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+      try
+      {
+        _socket->lowest_layer().async_connect(boost::asio::local::stream_protocol::endpoint(_url.host()),
+                                              boost::bind(&TcpTransportSocket::onConnected,
+                                                          shared_from_this(),
+                                                          boost::asio::placeholders::error,
+                                                          _socket,
+                                                          connectPromise));
+        return connectPromise.future();
+      }
+      catch (const std::exception& e)
+      {
+        qiLogError() << "Error try to connect to a bad address: " << _url.str() << ": " << e.what();
+      }
+#endif
+      _status = qi::TransportSocket::Status::Disconnected;
+      _connecting = false;
+      return qi::makeFutureError<void>(std::string("Bad address ") + _url.str());
+    }
     qiLogVerbose() << "Trying to connect to " << _url.host() << ":" << _url.port();
     using namespace boost::asio;
     // Resolve url
@@ -419,7 +803,7 @@ namespace qi
 
 
     // asynchronous connect
-    _socket->lowest_layer().async_connect(*it,
+    _socket->lowest_layer().async_connect(boost::asio::generic::stream_protocol::endpoint(it->endpoint()),
                                           boost::bind(&TcpTransportSocket::onConnected,
                                                       shared_from_this(),
                                                       boost::asio::placeholders::error,
@@ -501,6 +885,8 @@ namespace qi
 
   void TcpTransportSocket::setSocketOptions()
   {
+    if (_local)
+      return; // no delay nor keepalive on local sockets
     // Transmit each Message without delay
     const boost::asio::ip::tcp::no_delay option( true );
     try {
@@ -519,7 +905,7 @@ namespace qi
       return; // feature disabled
     // we can't honor timeout < 10s proprely
     timeout = std::max(timeout, 10);
-    boost::asio::ip::tcp::socket::native_handle_type handle
+    Socket::lowest_layer_type::native_handle_type handle
       = _socket->lowest_layer().native_handle();
 #ifdef _WIN32
     /* http://msdn.microsoft.com/en-us/library/windows/desktop/dd877220(v=vs.85).aspx
@@ -608,43 +994,193 @@ namespace qi
   }
 
   bool TcpTransportSocket::send(const qi::Message &msg)
+  {
+    return enqueue(msg, detail::SendPromisePtr());
+  }
+
+  qi::Future<void> TcpTransportSocket::sendAsync(const qi::Message &msg)
+  {
+    detail::SendPromisePtr promise = boost::make_shared<qi::Promise<void> >();
+    // On failure, enqueue sets the error.
+    enqueue(msg, promise);
+    return promise->future();
+  }
+
+  void TcpTransportSocket::setSendQueueLimits(size_t maxBytes, size_t maxMessages)
+  {
+    boost::mutex::scoped_lock lock(_sendQueueMutex);
+    _maxSendQueueBytes = maxBytes;
+    _maxSendQueueMessages = maxMessages;
+    _sendQueueSpace.notify_all();
+  }
+
+  void TcpTransportSocket::setSendPolicy(Message::Type type, SendPolicy policy)
+  {
+    boost::mutex::scoped_lock lock(_sendQueueMutex);
+    _sendPolicies[type] = policy;
+  }
+
+  /// Bytes a message occupies in the send queue.
+  static size_t queuedSize(const qi::Message& msg)
+  {
+    return sizeof(qi::MessagePrivate::MessageHeader) + msg.buffer().totalSize();
+  }
+
+  bool TcpTransportSocket::sendQueueFull() const
+  {
+    return (_maxSendQueueBytes && _sendQueueBytes >= _maxSendQueueBytes)
+        || (_maxSendQueueMessages && _sendQueueCount + _sendChunked.size() >= _maxSendQueueMessages);
+  }
+
+  void TcpTransportSocket::releaseQueued(const qi::Message& msg)
+  {
+    _sendQueueBytes -= queuedSize(msg);
+    _sendQueueSpace.notify_all();
+  }
+
+  bool TcpTransportSocket::dropOldestEvents()
+  {
+    // Messages already being written are out of reach.
+    std::deque<detail::QueuedMessage>& events = _sendQueue[detail::SendLane_Event];
+    while (sendQueueFull() && !events.empty())
+    {
+      qiLogVerbose() << this << " Send queue full, dropping event " << events.front().msg.address();
+      releaseQueued(events.front().msg);
+      setSendError(events.front().promise, "Dropped, send queue full");
+      events.pop_front();
+      --_sendQueueCount;
+    }
+    return !sendQueueFull();
+  }
+
+  bool TcpTransportSocket::enqueue(const qi::Message &msg, detail::SendPromisePtr promise)
   {
     // Check that once before locking in case some idiot tries to send
     // from a disconnect notification.
     if (_status != qi::TransportSocket::Status::Connected)
-      return false;
-    boost::recursive_mutex::scoped_lock lockc(_closingMutex);
-
-    if (!_socket || _status != qi::TransportSocket::Status::Connected)
     {
-      qiLogDebug() << this << "Send on closed socket";
+      setSendError(promise, "Socket closed");
       return false;
     }
 
-    qiLogDebug() << this << " Send (" << msg.type() << "):" << msg.address();
-    boost::mutex::scoped_lock lock(_sendQueueMutex);
+    {
+      // Wait for room without holding _closingMutex, the write completion
+      // that makes room needs it.
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+      if (sendQueueFull())
+      {
+        std::map<Message::Type, SendPolicy>::const_iterator it = _sendPolicies.find(msg.type());
+        SendPolicy policy = it == _sendPolicies.end() ? SendPolicy::Block : it->second;
+        // Blocking a network thread could prevent this queue, or the one of
+        // the socket waiting on us, from draining.
+        if (policy == SendPolicy::Block && (isNetworkThread() || _eventLoop->isInThisContext()))
+          policy = SendPolicy::DropOldest;
+        switch (policy)
+        {
+        case SendPolicy::Block:
+          while (sendQueueFull() && _status == qi::TransportSocket::Status::Connected)
+            _sendQueueSpace.wait(lock);
+          break;
+        case SendPolicy::DropOldest:
+          if (dropOldestEvents() || msg.type() != Message::Type_Event)
+            break;
+          qiLogVerbose() << this << " Send queue full, dropping event " << msg.address();
+          setSendError(promise, "Dropped, send queue full");
+          return false;
+        case SendPolicy::Fail:
+          qiLogVerbose() << this << " Send queue full, refusing " << msg.address();
+          setSendError(promise, "Send queue full");
+          return false;
+        }
+      }
+    }
 
-    if (!_sending)
+    detail::SendBatchPtr batch;
     {
+      boost::recursive_mutex::scoped_lock lockc(_closingMutex);
+
+      if (!_socket || _status != qi::TransportSocket::Status::Connected)
+      {
+        qiLogDebug() << this << "Send on closed socket";
+        setSendError(promise, "Socket closed");
+        return false;
+      }
+
+      qiLogDebug() << this << " Send (" << msg.type() << "):" << msg.address();
+      boost::mutex::scoped_lock lock(_sendQueueMutex);
+
+      detail::QueuedMessage queued;
+      queued.msg = msg;
+      queued.promise = promise;
+      _sendQueue[sendLane(msg)].push_back(queued);
+      ++_sendQueueCount;
+      _sendQueueBytes += queuedSize(msg);
+      if (_sending)
+        return true;
       _sending = true;
-      send_(msg);
+      batch = nextBatch();
     }
-    else
-      _sendQueue.push_back(msg);
+    // We own the sending now: copy the passed payloads and start the write
+    // without blocking the other senders.
+    send_(batch);
     return true;
   }
 
-  void TcpTransportSocket::send_(qi::Message msg)
+  /// Maximum amount of payload gathered into a single write.
+  static size_t maxSendBatchBytes()
+  {
+    static size_t res = 0;
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    if (!init)
+    {
+      std::string l = os::getenv("QI_SEND_BATCH_BYTES");
+      res = l.empty() ? 256 * 1024 : strtol(l.c_str(), 0, 0);
+      init = true;
+    }
+    return res;
+  }
+
+  /// Maximum number of buffers gathered into a single write.
+  static size_t maxSendBatchBuffers()
+  {
+    static size_t res = 0;
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    if (!init)
+    {
+      std::string l = os::getenv("QI_SEND_BATCH_BUFFERS");
+      res = l.empty() ? 64 : strtol(l.c_str(), 0, 0);
+      init = true;
+    }
+    return res;
+  }
+
+  /// Number of buffers needed to send \p buf.
+  static size_t sendBufferCount(const qi::Buffer& buf)
+  {
+    // header, one chunk of parent buffer and one sub-buffer per sub-buffer,
+    // and the trailing parent chunk
+    return 2 + 2 * buf.subBuffers().size();
+  }
+
+  /// Append the buffers needed to send \p msg to \p b.
+  /// If \p passed is set, up to \p fdBudget large sub-buffers are passed as
+  /// file descriptors instead, described by a new element of \p passed.
+  static void appendSendBuffers(std::vector<boost::asio::const_buffer>& b, qi::Message& msg,
+                                std::vector<detail::PassedBuffersPtr>* passed, size_t& fdBudget)
   {
     using boost::asio::buffer;
-    std::vector<boost::asio::const_buffer> b;
     msg._p->complete();
     // Send header
+    size_t headerIndex = b.size();
     b.push_back(buffer(msg._p->getHeader(), sizeof(qi::MessagePrivate::MessageHeader)));
     const qi::Buffer& buf = msg.buffer();
     size_t sz = buf.size();
     const std::vector<std::pair<size_t, Buffer> >& subs = buf.subBuffers();
     size_t pos = 0;
+    size_t sent = 0; // payload bytes written to the stream
+    detail::PassedBuffersPtr p;
     // Handle subbuffers
     for (unsigned i=0; i< subs.size(); ++i)
     {
@@ -652,58 +1188,280 @@ namespace qi
       size_t end = subs[i].first+4;
       if (end != pos)
         b.push_back(buffer((const char*)buf.data() + pos, end-pos));
+      sent += end - pos;
       pos = end;
+      const qi::Buffer& sub = subs[i].second;
+#ifdef __linux__
+      if (passed && fdBudget && sub.size() >= detail::fdPassingThreshold())
+      {
+        int fd = detail::makeSealedMemfd(sub.data(), sub.size());
+        if (fd != -1)
+        {
+          if (!p)
+          {
+            p = boost::make_shared<detail::PassedBuffers>();
+            p->table.push_back(0);
+          }
+          p->fds.push_back(fd);
+          p->table.push_back(static_cast<qi::uint32_t>(sent - 4));
+          --fdBudget;
+          continue;
+        }
+      }
+#endif
       // Send subbuffer
-      b.push_back(buffer(subs[i].second.data(), subs[i].second.size()));
+      b.push_back(buffer(sub.data(), sub.size()));
+      sent += sub.size();
+    }
+    if (sz != pos)
+      b.push_back(buffer((const char*)buf.data() + pos, sz - pos));
+    sent += sz - pos;
+
+    if (p)
+    {
+      p->table[0] = static_cast<qi::uint32_t>(p->fds.size());
+      p->header = msg._p->header;
+      p->header.flags |= Message::TypeFlag_PassedBuffers;
+      p->header.size = static_cast<qi::uint32_t>(p->table.size() * sizeof(qi::uint32_t) + sent);
+      b[headerIndex] = buffer(&p->header, sizeof(p->header));
+      b.insert(b.begin() + headerIndex + 1, buffer(&p->table[0], p->table.size() * sizeof(qi::uint32_t)));
+      passed->push_back(p);
+    }
+  }
+
+  /// Append the next chunk of \p c, at most \p chunkSize bytes of payload,
+  /// to \p b. Return true once the whole message is sent.
+  static bool appendChunk(std::vector<boost::asio::const_buffer>& b, detail::ChunkedSend& c, size_t chunkSize)
+  {
+    using boost::asio::buffer;
+    c.frame = c.msg._p->header;
+    c.frame.flags |= Message::TypeFlag_Chunk;
+    size_t headerIndex = b.size();
+    b.push_back(buffer(&c.frame, sizeof(c.frame)));
+    // The first chunk also tells the size of the whole payload.
+    b.push_back(buffer(&c.prefix[0], c.frames++ ? sizeof(c.prefix[0]) : sizeof(c.prefix)));
+    size_t frameSize = 0;
+    while (frameSize < chunkSize && c.next < c.payload.size())
+    {
+      boost::asio::const_buffer& segment = c.payload[c.next];
+      size_t sz = std::min(boost::asio::buffer_size(segment), chunkSize - frameSize);
+      b.push_back(buffer(segment, sz));
+      segment = segment + sz;
+      if (!boost::asio::buffer_size(segment))
+        ++c.next;
+      frameSize += sz;
+    }
+    c.frame.size = static_cast<qi::uint32_t>(boost::asio::buffer_size(b[headerIndex + 1]) + frameSize);
+    return c.next == c.payload.size();
+  }
+
+  int TcpTransportSocket::nextSendLane()
+  {
+    // A lane waits for its chunked message: its messages are sent in order.
+    if (!_sendQueue[detail::SendLane_Control].empty() && !_sendLaneChunked[detail::SendLane_Control])
+      return detail::SendLane_Control;
+    for (int round = 0; round < 2; ++round)
+    {
+      for (int lane = detail::SendLane_Control + 1; lane < detail::SendLane_Count; ++lane)
+        if (_sendCredits[lane] && !_sendQueue[lane].empty() && !_sendLaneChunked[lane])
+          return lane;
+      // Every lane with pending messages used its share, start a new round.
+      std::copy(sendLaneWeights, sendLaneWeights + detail::SendLane_Count, _sendCredits);
+    }
+    return -1;
+  }
+
+  detail::SendBatchPtr TcpTransportSocket::nextBatch()
+  {
+    if (!_sendQueueCount && _sendChunked.empty())
+      return detail::SendBatchPtr();
+
+    detail::SendBatchPtr batch = boost::make_shared<detail::SendBatch>();
+#ifdef __linux__
+    batch->fdPassing = _local && detail::fdPassingThreshold() && sharedCapability<bool>("FdPassing", false);
+#endif
+    // Passed file descriptors already keep large payloads out of the stream.
+    const size_t chunkSize = messageChunkSize();
+    const bool chunking = chunkSize && !batch->fdPassing && sharedCapability<bool>("MessageChunks", false);
+
+    // Drain as many pending messages as the budget allows into one write.
+    // The first message is always taken, whatever its size.
+    const size_t maxBytes = maxSendBatchBytes();
+    const size_t maxBuffers = maxSendBatchBuffers();
+    size_t bytes = 0;
+    size_t buffers = 0;
+    int lane;
+    while ((lane = nextSendLane()) != -1)
+    {
+      std::deque<detail::QueuedMessage>& queue = _sendQueue[lane];
+      const qi::Message& m = queue.front().msg;
+      if (chunking && m.buffer().totalSize() > chunkSize)
+      {
+        // Sent one chunk per write below, between the messages of the other
+        // lanes. Still accounted for in the queue until its last chunk.
+        detail::ChunkedSendPtr c = boost::make_shared<detail::ChunkedSend>();
+        c->msg = m;
+        c->lane = lane;
+        _sendLaneChunked[lane] = true;
+        c->promise = queue.front().promise;
+        size_t unused = 0;
+        appendSendBuffers(c->payload, c->msg, 0, unused);
+        c->payload.erase(c->payload.begin()); // the header is sent with each chunk
+        c->prefix[0] = _nextChunkStream++;
+        c->prefix[1] = c->msg._p->header.size;
+        _sendChunked.push_back(c);
+        queue.pop_front();
+        --_sendQueueCount;
+        if (_sendCredits[lane])
+          --_sendCredits[lane];
+        continue;
+      }
+      size_t mBytes = sizeof(qi::MessagePrivate::MessageHeader) + m.buffer().totalSize();
+      size_t mBuffers = sendBufferCount(m.buffer());
+      if (!batch->msgs.empty() && (bytes + mBytes > maxBytes || buffers + mBuffers > maxBuffers))
+        break;
+      bytes += mBytes;
+      buffers += mBuffers;
+      batch->msgs.push_back(m);
+      if (queue.front().promise)
+        batch->promises.push_back(queue.front().promise);
+      releaseQueued(m);
+      queue.pop_front();
+      --_sendQueueCount;
+      if (_sendCredits[lane])
+        --_sendCredits[lane];
     }
-    b.push_back(buffer((const char*)buf.data() + pos, sz - pos));
+
+    // Then one chunk of the message whose turn it is.
+    if (!_sendChunked.empty())
+    {
+      detail::ChunkedSendPtr c = _sendChunked.front();
+      _sendChunked.pop_front();
+      if (!appendChunk(batch->buffers, *c, chunkSize))
+        _sendChunked.push_back(c);
+      else
+      {
+        if (c->promise)
+          batch->promises.push_back(c->promise);
+        releaseQueued(c->msg);
+        _sendLaneChunked[c->lane] = false;
+      }
+      batch->chunk = c;
+    }
+    return batch;
+  }
+
+  void TcpTransportSocket::send_(detail::SendBatchPtr batch)
+  {
+    // All the descriptors of a write are attached to its first byte.
+    size_t fdBudget = detail::maxPassedFds;
+    for (unsigned i = 0; i < batch->msgs.size(); ++i)
+      appendSendBuffers(batch->buffers, batch->msgs[i], batch->fdPassing ? &batch->passed : 0, fdBudget);
 
     boost::recursive_mutex::scoped_lock l(_closingMutex);
 
     if (_abort)
     {
       qiLogWarning() << "send aborted";
+      for (unsigned i = 0; i < batch->promises.size(); ++i)
+        setSendError(batch->promises[i], "Socket closed");
       return;
     }
 
-    _dispatcher.sent(msg);
+    for (unsigned i = 0; i < batch->msgs.size(); ++i)
+      _dispatcher.sent(batch->msgs[i]);
+    if (batch->chunk && batch->chunk->frames == 1)
+      _dispatcher.sent(batch->chunk->msg);
 
-    if (_ssl)
+    if (!batch->passed.empty())
     {
-      boost::asio::async_write(*_socket, b,
-        boost::bind(&TcpTransportSocket::sendCont, shared_from_this(), _1, msg, _socket));
+      sendWithFds(boost::system::error_code(), batch, _socket);
+    }
+    else if (_ssl)
+    {
+      boost::asio::async_write(*_socket, batch->buffers,
+        boost::bind(&TcpTransportSocket::sendCont, shared_from_this(), _1, batch, _socket));
     }
     else
     {
-      boost::asio::async_write(_socket->next_layer(), b,
-        boost::bind(&TcpTransportSocket::sendCont, shared_from_this(), _1, msg, _socket));
+      boost::asio::async_write(_socket->next_layer(), batch->buffers,
+        boost::bind(&TcpTransportSocket::sendCont, shared_from_this(), _1, batch, _socket));
     }
   }
 
+  void TcpTransportSocket::sendWithFds(const boost::system::error_code& erc, detail::SendBatchPtr batch, SocketPtr s)
+  {
+#ifdef __linux__
+    if (erc)
+      return; // read-callback will also get the error
+    boost::recursive_mutex::scoped_lock l(_closingMutex);
+    if (_abort)
+      return;
+
+    std::vector<int> fds;
+    for (unsigned i = 0; i < batch->passed.size(); ++i)
+      fds.insert(fds.end(), batch->passed[i]->fds.begin(), batch->passed[i]->fds.end());
+    long res = detail::sendWithFds(s->next_layer().native_handle(), batch->buffers, fds);
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      s->next_layer().async_write_some(boost::asio::null_buffers(),
+        boost::bind(&TcpTransportSocket::sendWithFds, shared_from_this(), _1, batch, s));
+      return;
+    }
+    if (res < 0)
+    {
+      // We may be called from enqueue(), on the sender's thread, do not error() here.
+      std::string message = std::string("System error: ") + strerror(errno);
+      qiLogWarning() << "sendmsg: " << message;
+      _eventLoop->post(boost::bind(&TcpTransportSocket::error, shared_from_this(), message));
+      return;
+    }
+
+    // The descriptors are on their way, write the rest of the stream.
+    std::vector<boost::asio::const_buffer> rest;
+    size_t skip = res;
+    for (unsigned i = 0; i < batch->buffers.size(); ++i)
+    {
+      size_t sz = boost::asio::buffer_size(batch->buffers[i]);
+      if (skip >= sz)
+      {
+        skip -= sz;
+        continue;
+      }
+      rest.push_back(batch->buffers[i] + skip);
+      skip = 0;
+    }
+    batch->buffers.swap(rest);
+    boost::asio::async_write(s->next_layer(), batch->buffers,
+      boost::bind(&TcpTransportSocket::sendCont, shared_from_this(), _1, batch, s));
+#endif
+  }
+
   /*
-   * warning: msg is given to the callback so as not to drop buffers refcount
+   * warning: the batch is given to the callback so as not to drop buffers refcount
    */
-  void TcpTransportSocket::sendCont(const boost::system::error_code& erc, qi::Message msg, SocketPtr)
+  void TcpTransportSocket::sendCont(const boost::system::error_code& erc, detail::SendBatchPtr batch, SocketPtr)
   {
     // The class does not wait for us to terminate, but it will set abort to true.
     // So do not use this before checking abort.
     if (erc || _abort)
       return; // read-callback will also get the error, avoid dup and ignore it
 
-    qi::Message m;
+    for (unsigned i = 0; i < batch->promises.size(); ++i)
+      batch->promises[i]->setValue(0);
+    // Release the previous batch's buffers before gathering the next one.
+    batch.reset();
     {
       boost::mutex::scoped_lock lock(_sendQueueMutex);
-      if (_sendQueue.empty())
+      batch = nextBatch();
+      if (!batch)
       {
         _sending = false;
         return;
       }
-
-      m = _sendQueue.front();
-      _sendQueue.pop_front();
     }
 
-    send_(m);
+    send_(batch);
   }
 
 }
@@ -9,8 +9,11 @@
 
 
 # include <string>
+# include <deque>
+# include <map>
 # include <queue>
 # include <boost/thread/recursive_mutex.hpp>
+# include <boost/thread/condition_variable.hpp>
 # include <boost/asio.hpp>
 # include <boost/asio/ssl.hpp>
 # include <boost/optional.hpp>
@@ -23,18 +26,86 @@
 
 namespace qi
 {
+  namespace detail
+  {
+    /// Convert a generic endpoint to the endpoint of its actual protocol.
+    template <typename Endpoint>
+    Endpoint toEndpoint(const boost::asio::generic::stream_protocol::endpoint& ep)
+    {
+      Endpoint res;
+      memcpy(res.data(), ep.data(), ep.size());
+      res.resize(ep.size());
+      return res;
+    }
+
+    /// Sub-buffers of a message sent as file descriptors.
+    struct PassedBuffers;
+    using PassedBuffersPtr = boost::shared_ptr<PassedBuffers>;
+    /// A message being sent in chunks.
+    struct ChunkedSend;
+    using ChunkedSendPtr = boost::shared_ptr<ChunkedSend>;
+    struct SendBatch;
+    using SendBatchPtr = boost::shared_ptr<SendBatch>;
+    /// Set once a message is handed to the kernel, null if nobody waits.
+    using SendPromisePtr = boost::shared_ptr<qi::Promise<void> >;
+
+    /// Send queues, by decreasing priority.
+    enum SendLane
+    {
+      SendLane_Control = 0, // capabilities, always sent first
+      SendLane_Reply,       // replies, errors and cancellation acknowledgments
+      SendLane_Call,        // calls, posts and cancellations
+      SendLane_Event,
+      SendLane_Count
+    };
+
+    struct QueuedMessage
+    {
+      qi::Message msg;
+      SendPromisePtr promise;
+    };
+  }
+
   /**
-   * Socket handling the Qi messaging protocol.
+   * Socket handling the Qi messaging protocol over TCP, with or without SSL,
+   * or over unix domain stream sockets (unix:// urls).
+   *
+   * On Linux unix sockets, when both ends advertise the "FdPassing"
+   * capability, large sub-buffers of a message are written to sealed memfds
+   * passed along the stream instead of being copied through it. The receiver
+   * maps them back as sub-buffers of the message. Such messages are flagged
+   * with Message::TypeFlag_PassedBuffers and their payload starts with the
+   * count of passed sub-buffers followed by their offsets in the payload,
+   * all as uint32.
+   *
+   * When both ends advertise the "MessageChunks" capability, messages larger
+   * than QI_MESSAGE_CHUNK_SIZE are sent in chunks, one per write, so that
+   * messages of other lanes are not stuck behind them. Chunks carry the header of
+   * their message with Message::TypeFlag_Chunk set, their payload starts with
+   * a uint32 stream id, followed in the first chunk by the uint32 size of
+   * the whole payload. The receiver closes the link if that size is over
+   * QI_MAX_MESSAGE_PAYLOAD, or if the messages it is reassembling exceed one
+   * per lane or QI_MAX_CHUNKED_PAYLOAD bytes (twice the former by default).
+   *
+   * The send queue is bounded by QI_SEND_QUEUE_MAX_BYTES and
+   * QI_SEND_QUEUE_MAX_MESSAGES, see setSendQueueLimits(). What happens to a
+   * message sent over these limits depends on the SendPolicy of its type.
+   * Network threads never block: Block falls back to DropOldest there.
+   *
+   * Queued messages wait in one lane per detail::SendLane. Control messages
+   * are sent first, the other lanes share the socket by weighted round robin
+   * so that a backlog of events does not delay replies and calls. Messages
+   * of a lane are sent in order, chunked ones included.
    */
   // TODO: make this API more symmetric by clarifying the server and client roles.
   class TcpTransportSocket : public TransportSocket, public boost::enable_shared_from_this<TcpTransportSocket>
   {
   public:
-    using Socket = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
-    using SocketPtr = boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>;
+    using Socket = boost::asio::ssl::stream<boost::asio::generic::stream_protocol::socket>;
+    using SocketPtr = boost::shared_ptr<Socket>;
 
     /// @param s if not null, must be a connected socket on the server side
-    explicit TcpTransportSocket(EventLoop* eventloop = getEventLoop(), bool ssl = false, SocketPtr s = {});
+    explicit TcpTransportSocket(EventLoop* eventloop = getNetworkEventLoop(), bool ssl = false, SocketPtr s = {});
     virtual ~TcpTransportSocket();
 
     /// Connects the socket as a client and ensures that it is reading.
@@ -44,9 +115,32 @@ namespace qi
     virtual qi::FutureSync<void> disconnect();
 
     virtual bool send(const qi::Message &msg);
+    virtual qi::Future<void> sendAsync(const qi::Message &msg);
     virtual void ensureReading();
     virtual qi::Url remoteEndpoint() const;
+
+    /// Sets the high-water marks of the send queue, 0 for no limit.
+    void setSendQueueLimits(size_t maxBytes, size_t maxMessages);
+    /// Sets what to do with messages of type @p type sent over the limits.
+    /// Events are dropped by default, other messages block.
+    void setSendPolicy(Message::Type type, SendPolicy policy);
   private:
+    /// Queues @p msg, applying the send policy of its type.
+    bool enqueue(const qi::Message& msg, detail::SendPromisePtr promise);
+    /// True if the send queue is over one of its limits.
+    /// Must be called with _sendQueueMutex locked.
+    bool sendQueueFull() const;
+    /// Drops queued events until the queue is under its limits, returns
+    /// false if that was not enough. Must be called with _sendQueueMutex locked.
+    bool dropOldestEvents();
+    /// Lane to take the next message from, -1 if all are empty or waiting
+    /// for their chunked message.
+    /// Must be called with _sendQueueMutex locked.
+    int nextSendLane();
+    /// Accounts for a message leaving the send queue.
+    /// Must be called with _sendQueueMutex locked.
+    void releaseQueued(const qi::Message& msg);
+
     /// Internal version of ensureReading taking a promise representing the
     /// status of the connection attempt.
     void ensureReading(qi::Promise<void> connectionAttemptPromise);
@@ -61,13 +155,37 @@ namespace qi
                     qi::Promise<void> connectPromise);
     void handshake(const boost::system::error_code& erc, SocketPtr s,
                     qi::Promise<void> connectPromise);
-    void onReadHeader(const boost::system::error_code& erc, std::size_t, SocketPtr s);
+    void onReadSome(const boost::system::error_code& erc, std::size_t, SocketPtr s);
     void onReadData(const boost::system::error_code& erc, std::size_t, SocketPtr s);
-    void send_(qi::Message msg);
-    void sendCont(const boost::system::error_code& erc, qi::Message msg, SocketPtr s);
+    /// Reads the socket once readable, receiving passed file descriptors.
+    void onReadable(const boost::system::error_code& erc, SocketPtr s);
+    /// Replaces the sub-buffers of _msg passed as file descriptors.
+    bool receivePassedBuffers();
+    /// Once the complete messages received are parsed, closes the socket if
+    /// more descriptors are left than the last write can claim.
+    bool checkReceivedFds();
+    /// Adds the chunk in _msg to its message. If that completes it, sets
+    /// @p complete and replaces _msg by the message.
+    bool receiveChunk(bool& complete);
+    /// Validates the header of _msg, calls error() and returns false if invalid.
+    bool checkHeader();
+    /// Dispatches the fully received _msg, returns false if the socket errored.
+    bool dispatchMessage();
+    /// Messages with a larger payload are sent in chunks of that size, 0 if
+    /// disabled (configure with QI_MESSAGE_CHUNK_SIZE).
+    static size_t messageChunkSize();
+    /// Gathers what to write next, null if there is nothing.
+    /// Must be called with _sendQueueMutex locked.
+    detail::SendBatchPtr nextBatch();
+    void send_(detail::SendBatchPtr batch);
+    void sendCont(const boost::system::error_code& erc, detail::SendBatchPtr batch, SocketPtr s);
+    /// Writes @p batch with the descriptors it passes attached, then
+    /// continues with sendCont.
+    void sendWithFds(const boost::system::error_code& erc, detail::SendBatchPtr batch, SocketPtr s);
     void setSocketOptions();
     void _continueReading(qi::Promise<void> connectionAttemptPromise);
     bool _ssl;
+    bool _local; // unix domain socket, no tcp options apply
 
     /// Type of the next SSL handshake to perform.
     /// No handshake must be performed if this value is not set.
@@ -81,8 +199,28 @@ namespace qi
     qi::Message         _msg;
     bool                _connecting;
 
+    // Receive buffer: bytes in [_recvBegin, _recvEnd) are read but not yet
+    // consumed. Messages larger than the buffer are read into their own storage.
+    static const size_t recvBufferSize = 64 * 1024;
+    std::vector<char>   _recvBuffer;
+    size_t              _recvBegin;
+    size_t              _recvEnd;
+    std::deque<int>     _recvFds; // received, not yet claimed by a message
+    std::map<qi::uint32_t, qi::Message> _recvChunks; // by stream id
+    size_t              _recvChunkedBytes; // announced payload of _recvChunks
+
     boost::mutex        _sendQueueMutex; // protects _sendQueue, _sending and closing
-    std::deque<Message> _sendQueue;
+    boost::condition_variable _sendQueueSpace; // notified when the queue shrinks
+    std::deque<detail::QueuedMessage> _sendQueue[detail::SendLane_Count];
+    unsigned int        _sendCredits[detail::SendLane_Count]; // left in this round
+    size_t              _sendQueueCount; // of _sendQueue, not _sendChunked
+    size_t              _sendQueueBytes; // of _sendQueue and _sendChunked
+    size_t              _maxSendQueueBytes;
+    size_t              _maxSendQueueMessages;
+    std::map<Message::Type, SendPolicy> _sendPolicies; // Block if absent
+    std::deque<detail::ChunkedSendPtr> _sendChunked; // take turns, one chunk per write
+    bool                _sendLaneChunked[detail::SendLane_Count]; // lane waits for its chunked message
+    qi::uint32_t        _nextChunkStream;
     bool                _sending;
     mutable boost::recursive_mutex _closingMutex;
     boost::shared_ptr<boost::asio::ip::tcp::resolver> _r;
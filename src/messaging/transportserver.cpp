@@ -9,6 +9,7 @@
 # pragma warning(disable: 4355)
 #endif
 
+#include <algorithm>
 #include <string>
 #include <cstring>
 #include <cstdlib>
@@ -27,6 +28,10 @@
 #include "transportserver.hpp"
 #include "transportsocket.hpp"
 #include "transportserverasio_p.hpp"
+#include "src/eventloop_p.hpp"
+#ifdef __linux__
+# include "transportservershm_p.hpp"
+#endif
 
 qiLogCategory("qimessaging.transportserver");
 
@@ -44,10 +49,22 @@ namespace qi
   qi::Future<void> TransportServer::listen(const qi::Url &url, qi::EventLoop* ctx)
   {
     TransportServerImplPtr impl;
-    if (url.protocol() == "tcp" || url.protocol() == "tcps")
+    if (url.protocol() == "tcp" || url.protocol() == "tcps" || url.protocol() == "unix")
     {
+      if (url.protocol() != "unix" && ctx == getNetworkEventLoop())
+      {
+        const std::vector<EventLoop*>& shards = getNetworkEventLoopShards();
+        if (shards.size() > 1)
+          return listenSharded(url, shards);
+      }
       impl = TransportServerAsioPrivate::make(this, ctx);
     }
+#ifdef __linux__
+    else if (url.protocol() == "shm")
+    {
+      impl = TransportServerShmPrivate::make(this, ctx);
+    }
+#endif
     else
     {
       const char* s = "Unrecognized protocol to create the TransportServer.";
@@ -61,6 +78,47 @@ namespace qi
     return impl->listen(url);
   }
 
+  // One acceptor per shard, all bound to the same port with SO_REUSEPORT:
+  // the kernel spreads incoming connections over them, and each connection
+  // then lives on the event loop of the shard that accepted it.
+  qi::Future<void> TransportServer::listenSharded(const qi::Url& url, const std::vector<EventLoop*>& shards)
+  {
+    qi::Url shardUrl = url;
+    qi::Future<void> listening;
+    std::vector<TransportServerImplPtr> started;
+    for (std::size_t i = 0; i < shards.size(); ++i)
+    {
+      boost::shared_ptr<TransportServerAsioPrivate> impl = TransportServerAsioPrivate::make(this, shards[i]);
+      impl->_reusePort = true;
+      impl->_publishEndpoints = (i == 0);
+      {
+        boost::mutex::scoped_lock l(_implMutex);
+        _impl.push_back(impl);
+      }
+      started.push_back(impl);
+      qi::Future<void> shardListening = impl->listen(shardUrl);
+      if (shardListening.hasError(0))
+      {
+        // Do not leave the port half served: stop the shards of this call.
+        boost::mutex::scoped_lock l(_implMutex);
+        for (std::vector<TransportServerImplPtr>::const_iterator it = started.begin(); it != started.end(); ++it)
+        {
+          (*it)->close();
+          _impl.erase(std::remove(_impl.begin(), _impl.end(), *it), _impl.end());
+        }
+        return shardListening;
+      }
+      if (i == 0)
+      {
+        listening = shardListening;
+        // The other shards must share the port the first one was given.
+        shardUrl = impl->_listenUrl;
+      }
+    }
+    qiLogVerbose() << "Listening on " << shardUrl.str() << " with " << shards.size() << " shards";
+    return listening;
+  }
+
   bool TransportServer::setIdentity(const std::string& key, const std::string& crt)
   {
     struct ::stat status;
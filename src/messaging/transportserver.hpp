@@ -61,7 +61,7 @@ namespace qi {
     virtual ~TransportServer();
 
     qi::Future<void> listen(const qi::Url &url,
-                            qi::EventLoop* ctx = qi::getEventLoop());
+                            qi::EventLoop* ctx = qi::getNetworkEventLoop());
     bool setIdentity(const std::string& key, const std::string& crt);
     void close();
 
@@ -80,6 +80,9 @@ namespace qi {
     std::string                           _identityCertificate;
     std::vector<TransportServerImplPtr>   _impl;
     mutable boost::mutex                 _implMutex;
+
+  private:
+    qi::Future<void> listenSharded(const qi::Url& url, const std::vector<EventLoop*>& shards);
   };
 
 }
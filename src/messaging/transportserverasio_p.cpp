@@ -9,6 +9,11 @@
 #include <qi/log.hpp>
 #include <cerrno>
 
+#ifndef _WIN32
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
 #include <boost/asio.hpp>
 
 #include <boost/lexical_cast.hpp>
@@ -25,12 +30,16 @@ qiLogCategory("qimessaging.transportserver");
 
 namespace qi
 {
+#ifdef SO_REUSEPORT
+  using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
   const int ifsMonitoringTimeout = 5 * 1000 * 1000; // in usec
   const int64_t TransportServerAsioPrivate::AcceptDownRetryTimerUs = 60 * 1000 * 1000; // 60 seconds in usec
 
   void _onAccept(TransportServerImplPtr p,
                  const boost::system::error_code& erc,
-                 boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> s
+                 TransportServerAsioPrivate::SocketPtr s
                  )
   {
     boost::shared_ptr<TransportServerAsioPrivate> ts = boost::dynamic_pointer_cast<TransportServerAsioPrivate>(p);
@@ -46,16 +55,14 @@ namespace qi
 
     if (context)
     {
-      _acceptor = new boost::asio::ip::tcp::acceptor(*(boost::asio::io_service*)context->nativeHandle());
+      _acceptor = new Acceptor(*(boost::asio::io_service*)context->nativeHandle());
       listen(_listenUrl);
     }
     else
       qiLogWarning() << this << " No context available, acceptor will stay down.";
   }
 
-  void TransportServerAsioPrivate::onAccept(const boost::system::error_code& erc,
-    boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket> > s
-    )
+  void TransportServerAsioPrivate::onAccept(const boost::system::error_code& erc, SocketPtr s)
   {
     qiLogDebug() << this << " onAccept";
     if (!_live)
@@ -88,7 +95,7 @@ namespace qi
             qiLogError() << "bug: socket not stored by the newConnection handler (usecount:" << socket.use_count() << ")";
         }
     }
-    _s = boost::make_shared<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(_acceptor->get_io_service(), _sslContext);
+    _s = boost::make_shared<SocketPtr::element_type>(_acceptor->get_io_service(), _sslContext);
     _acceptor->async_accept(_s->lowest_layer(),
                            boost::bind(_onAccept, shared_from_this(), _1, _s));
   }
@@ -106,7 +113,13 @@ namespace qi
 
     _live = false;
     if (_acceptor)
+    {
       _acceptor->close();
+#ifndef _WIN32
+      if (_local)
+        ::unlink(_listenUrl.host().c_str());
+#endif
+    }
   }
 
   /*
@@ -190,6 +203,9 @@ namespace qi
   {
     _listenUrl = url;
     _ssl = _listenUrl.protocol() == "tcps";
+    _local = _listenUrl.protocol() == "unix";
+    if (_local)
+      return listenLocal();
     using namespace boost::asio;
 #ifndef ANDROID
     // resolve endpoint
@@ -219,7 +235,7 @@ namespace qi
 #endif // #ifndef ANDROID
 
     qiLogDebug() << "Will listen on " << ep;
-    _acceptor->open(ep.protocol());
+    _acceptor->open(generic::stream_protocol(ep.protocol()));
 #ifdef _WIN32
     boost::asio::socket_base::reuse_address option(false);
 #else
@@ -227,9 +243,16 @@ namespace qi
     fcntl(_acceptor->native(), F_SETFD, FD_CLOEXEC);
 #endif
     _acceptor->set_option(option);
+#ifdef SO_REUSEPORT
+    if (_reusePort)
+      _acceptor->set_option(ReusePort(true));
+#else
+    if (_reusePort)
+      qiLogWarning() << "SO_REUSEPORT is not supported, shards cannot share " << ep;
+#endif
     try
     {
-      _acceptor->bind(ep);
+      _acceptor->bind(generic::stream_protocol::endpoint(ep));
     }
     catch (const boost::system::system_error& e)
     {
@@ -245,7 +268,7 @@ namespace qi
       qiLogError("qimessaging.server.listen") << ec.message();
       return qi::makeFutureError<void>(ec.message());
     }
-    _port = _acceptor->local_endpoint().port();// already in host byte orde
+    _port = detail::toEndpoint<ip::tcp::endpoint>(_acceptor->local_endpoint()).port();// already in host byte orde
     qiLogDebug() << "Effective port io_service" << _port;
     if (_listenUrl.port() == 0)
     {
@@ -253,13 +276,13 @@ namespace qi
         + boost::lexical_cast<std::string>(_port));
     }
 
-    /* Set endpoints */
-    if (_listenUrl.host() != "0.0.0.0")
+    /* Set endpoints, only once for shards sharing the port */
+    if (_publishEndpoints && _listenUrl.host() != "0.0.0.0")
     {
       boost::mutex::scoped_lock l(_endpointsMutex);
       _endpoints.push_back(_listenUrl.str());
     }
-    else
+    else if (_publishEndpoints)
     {
       updateEndpoints();
     }
@@ -290,13 +313,80 @@ namespace qi
       _sslContext.use_private_key_file(self->_identityKey.c_str(), boost::asio::ssl::context::pem);
     }
 
-    _s = boost::make_shared<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(_acceptor->get_io_service(), _sslContext);
+    _s = boost::make_shared<SocketPtr::element_type>(_acceptor->get_io_service(), _sslContext);
     _acceptor->async_accept(_s->lowest_layer(),
       boost::bind(_onAccept, shared_from_this(), _1, _s));
     _connectionPromise.setValue(0);
     return _connectionPromise.future();
   }
 
+  qi::Future<void> TransportServerAsioPrivate::listenLocal()
+  {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    using namespace boost::asio;
+    const std::string& path = _listenUrl.host();
+    boost::system::error_code ec;
+    local::stream_protocol::endpoint ep;
+    try
+    {
+      ep = local::stream_protocol::endpoint(path);
+    }
+    catch (const std::exception& e)
+    {
+      std::stringstream ss;
+      ss << "failed to listen on " << _listenUrl.str() << ": " << e.what();
+      qiLogError("qimessaging.server.listen") << ss.str();
+      return qi::makeFutureError<void>(ss.str());
+    }
+    _acceptor->open(generic::stream_protocol(ep.protocol()));
+    fcntl(_acceptor->native(), F_SETFD, FD_CLOEXEC);
+    _acceptor->bind(ep, ec);
+    struct stat st;
+    if (ec == error::address_in_use && ::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+      // Remove the socket left by a dead server, but never steal the one
+      // of a live server.
+      local::stream_protocol::socket probe(_acceptor->get_io_service());
+      boost::system::error_code connectError;
+      probe.connect(ep, connectError);
+      if (connectError == error::connection_refused)
+      {
+        qiLogVerbose() << "Removing stale socket " << path;
+        ::unlink(path.c_str());
+        ec.clear();
+        _acceptor->bind(ep, ec);
+      }
+    }
+    if (!ec)
+      _acceptor->listen(socket_base::max_connections, ec);
+    if (ec)
+    {
+      std::stringstream ss;
+      ss << "failed to listen on " << _listenUrl.str() << ": " << ec.message();
+      qiLogError("qimessaging.server.listen") << ss.str();
+      // Do not remove the file of someone else on close.
+      _local = false;
+      return qi::makeFutureError<void>(ss.str());
+    }
+
+    {
+      boost::mutex::scoped_lock l(_endpointsMutex);
+      _endpoints.push_back(_listenUrl);
+    }
+    qiLogInfo() << "TransportServer will listen on: " << _listenUrl.str();
+
+    _s = boost::make_shared<SocketPtr::element_type>(_acceptor->get_io_service(), _sslContext);
+    _acceptor->async_accept(_s->lowest_layer(),
+      boost::bind(_onAccept, shared_from_this(), _1, _s));
+    _connectionPromise.setValue(0);
+    return _connectionPromise.future();
+#else
+    const char* s = "Listen error: unix sockets are not supported on this platform.";
+    qiLogError() << s;
+    return qi::makeFutureError<void>(s);
+#endif
+  }
+
   bool TransportServerAsioPrivate::isFatalAcceptError(int errorCode)
   {
     using namespace boost::system::errc;
@@ -322,11 +412,14 @@ namespace qi
                                                                  EventLoop* ctx)
     : TransportServerImpl(self, ctx)
     , _self(self)
-    , _acceptor(new boost::asio::ip::tcp::acceptor(*(boost::asio::io_service*)ctx->nativeHandle()))
+    , _acceptor(new Acceptor(*(boost::asio::io_service*)ctx->nativeHandle()))
     , _live(true)
     , _sslContext(*(boost::asio::io_service*)ctx->nativeHandle(), boost::asio::ssl::context::sslv23)
     , _s()
     , _ssl(false)
+    , _local(false)
+    , _reusePort(false)
+    , _publishEndpoints(true)
     , _port(0)
   {
   }
@@ -16,6 +16,7 @@
 
 namespace qi
 {
+  /// Accepts tcp, tcps and unix connections.
   class TransportServerAsioPrivate:
       public TransportServerImpl,
       public boost::enable_shared_from_this<TransportServerAsioPrivate>
@@ -23,6 +24,9 @@ namespace qi
     TransportServerAsioPrivate(TransportServer* self, EventLoop* ctx);
 
   public:
+    using Acceptor = boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>;
+    using SocketPtr = boost::shared_ptr<boost::asio::ssl::stream<boost::asio::generic::stream_protocol::socket>>;
+
     static boost::shared_ptr<TransportServerAsioPrivate> make(
         TransportServer* self,
         EventLoop* ctx);
@@ -34,14 +38,16 @@ namespace qi
     void updateEndpoints();
     static bool isFatalAcceptError(int errorCode);
     TransportServer* _self;
-    boost::asio::ip::tcp::acceptor* _acceptor;
-    void onAccept(const boost::system::error_code& erc,
-      boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> s);
+    Acceptor* _acceptor;
+    void onAccept(const boost::system::error_code& erc, SocketPtr s);
     TransportServerAsioPrivate();
     bool _live;
     boost::asio::ssl::context _sslContext;
-    boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> _s;
+    SocketPtr _s;
     bool _ssl;
+    bool _local; // listening on a unix socket
+    bool _reusePort; // share the port with the acceptors of other shards
+    bool _publishEndpoints; // false for all but one of the shards of a port
     unsigned short _port;
     qi::Future<void> _asyncEndpoints;
     Url _listenUrl;
@@ -50,6 +56,7 @@ namespace qi
 
   private:
     void restartAcceptor();
+    qi::Future<void> listenLocal();
   };
 }
 
@@ -0,0 +1,183 @@
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+#include <sstream>
+
+#include <qi/atomic.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+#include <boost/make_shared.hpp>
+
+#include "transportservershm_p.hpp"
+#include "transportserverasio_p.hpp"
+#include "shmtransportsocket.hpp"
+
+qiLogCategory("qimessaging.transportserver");
+
+namespace qi
+{
+  const int TransportServerShmPrivate::AcceptRetryDelayMs = 100;
+
+  TransportServerShmPrivate::TransportServerShmPrivate(TransportServer* self, EventLoop* ctx)
+    : TransportServerImpl(self, ctx)
+    , _acceptor(*static_cast<boost::asio::io_service*>(ctx->nativeHandle()))
+    , _live(true)
+    , _connectionCount(0)
+  {
+  }
+
+  boost::shared_ptr<TransportServerShmPrivate> TransportServerShmPrivate::make(
+      TransportServer* self,
+      EventLoop* ctx)
+  {
+    return boost::shared_ptr<TransportServerShmPrivate>{new TransportServerShmPrivate(self, ctx)};
+  }
+
+  TransportServerShmPrivate::~TransportServerShmPrivate()
+  {
+  }
+
+  qi::Future<void> TransportServerShmPrivate::listen(const qi::Url& url)
+  {
+    _name = url.host();
+    if (_name.empty())
+    {
+      static qi::Atomic<int> count;
+      std::stringstream ss;
+      ss << "qimessaging-" << qi::os::getpid() << "-" << ++count;
+      _name = ss.str();
+    }
+
+    boost::system::error_code ec = openAcceptor();
+    if (ec)
+    {
+      std::stringstream ss;
+      ss << "failed to listen on shm://" << _name << ": " << ec.message();
+      qiLogError() << ss.str();
+      return qi::makeFutureError<void>(ss.str());
+    }
+
+    // The port is unused, it makes the url valid.
+    qi::Url endpoint("shm://" + _name + ":0");
+    {
+      boost::mutex::scoped_lock l(_endpointsMutex);
+      _endpoints.push_back(endpoint);
+    }
+    qiLogInfo() << "TransportServer will listen on: " << endpoint.str();
+
+    accept();
+    _connectionPromise.setValue(0);
+    return _connectionPromise.future();
+  }
+
+  boost::system::error_code TransportServerShmPrivate::openAcceptor()
+  {
+    // Abstract socket: no file to clean up, gone with the process.
+    boost::asio::local::stream_protocol::endpoint ep(std::string(1, '\0') + _name);
+    boost::system::error_code ec;
+    _acceptor.open(ep.protocol(), ec);
+    if (!ec)
+      _acceptor.bind(ep, ec);
+    if (!ec)
+      _acceptor.listen(boost::asio::socket_base::max_connections, ec);
+    if (ec)
+    {
+      boost::system::error_code ignored;
+      _acceptor.close(ignored);
+    }
+    return ec;
+  }
+
+  void TransportServerShmPrivate::restartAcceptor()
+  {
+    qiLogDebug() << this << " Attempting to restart acceptor";
+    if (!_live)
+      return;
+    boost::system::error_code ec = openAcceptor();
+    if (ec)
+    {
+      qiLogError() << "failed to listen on shm://" << _name << ": " << ec.message()
+                   << ", retrying in " << TransportServerAsioPrivate::AcceptDownRetryTimerUs << "us";
+      context->asyncDelay(boost::bind(&TransportServerShmPrivate::restartAcceptor, shared_from_this()),
+          qi::MicroSeconds(TransportServerAsioPrivate::AcceptDownRetryTimerUs));
+      return;
+    }
+    accept();
+  }
+
+  void TransportServerShmPrivate::accept()
+  {
+    SocketPtr s = boost::make_shared<Socket>(*static_cast<boost::asio::io_service*>(context->nativeHandle()));
+    _acceptor.async_accept(*s,
+      boost::bind(&TransportServerShmPrivate::onAccept, shared_from_this(), _1, s));
+  }
+
+  void TransportServerShmPrivate::onAccept(const boost::system::error_code& erc, SocketPtr s)
+  {
+    qiLogDebug() << this << " onAccept";
+    if (!_live)
+      return;
+    if (erc)
+    {
+      qiLogDebug() << "accept error " << erc.message();
+      self->acceptError(erc.value());
+      if (erc == boost::asio::error::operation_aborted)
+        return;
+      if (TransportServerAsioPrivate::isFatalAcceptError(erc.value()))
+      {
+        boost::system::error_code ec;
+        _acceptor.close(ec);
+        qiLogError() << "fatal accept error: " << erc.value();
+        qiLogDebug() << this << " Disabling acceptor for now, retrying in "
+                     << TransportServerAsioPrivate::AcceptDownRetryTimerUs << "us";
+        context->asyncDelay(boost::bind(&TransportServerShmPrivate::restartAcceptor, shared_from_this()),
+            qi::MicroSeconds(TransportServerAsioPrivate::AcceptDownRetryTimerUs));
+        return;
+      }
+      if (erc == boost::system::errc::too_many_files_open
+          || erc == boost::system::errc::too_many_files_open_in_system)
+      {
+        // Accepting again right away would fail the same way: give the
+        // process some time to release descriptors.
+        context->asyncDelay(boost::bind(&TransportServerShmPrivate::accept, shared_from_this()),
+            qi::MilliSeconds(AcceptRetryDelayMs));
+        return;
+      }
+    }
+    else if (!ShmTransportSocket::sameUser(*s))
+    {
+      boost::system::error_code ec;
+      s->close(ec);
+    }
+    else
+    {
+      // Tell connections apart, as a tcp peer address would.
+      std::stringstream ss;
+      ss << "shm://" << _name << "." << ++_connectionCount << ":0";
+      ShmTransportSocket::accept(context, s, qi::Url(ss.str()),
+        boost::bind(&TransportServerShmPrivate::onHandshake, shared_from_this(), _1));
+    }
+    accept();
+  }
+
+  void TransportServerShmPrivate::onHandshake(TransportSocketPtr socket)
+  {
+    if (!socket || !_live)
+      return;
+    self->newConnection(socket);
+
+    if (socket.unique()) {
+      qiLogError() << "bug: socket not stored by the newConnection handler (usecount:" << socket.use_count() << ")";
+    }
+  }
+
+  void TransportServerShmPrivate::close()
+  {
+    qiLogDebug() << this << " close";
+    _live = false;
+    boost::system::error_code ec;
+    _acceptor.close(ec);
+  }
+}
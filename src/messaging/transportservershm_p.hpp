@@ -0,0 +1,59 @@
+#pragma once
+/*
+**  Copyright (C) 2016 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TRANSPORTSERVERSHM_P_HPP_
+#define _SRC_TRANSPORTSERVERSHM_P_HPP_
+
+# include <boost/asio.hpp>
+
+# include <qi/api.hpp>
+# include <qi/url.hpp>
+# include "transportserver.hpp"
+
+namespace qi
+{
+  /// Accepts shared memory connections, see ShmTransportSocket.
+  class TransportServerShmPrivate:
+      public TransportServerImpl,
+      public boost::enable_shared_from_this<TransportServerShmPrivate>
+  {
+    TransportServerShmPrivate(TransportServer* self, EventLoop* ctx);
+
+  public:
+    static boost::shared_ptr<TransportServerShmPrivate> make(
+        TransportServer* self,
+        EventLoop* ctx);
+
+    virtual ~TransportServerShmPrivate();
+
+    /// Listen on the abstract unix socket named after the host of
+    /// @p listenUrl, a unique name is chosen if it has none.
+    virtual qi::Future<void> listen(const qi::Url& listenUrl);
+    virtual void close();
+
+  private:
+    using Socket = boost::asio::local::stream_protocol::socket;
+    using SocketPtr = boost::shared_ptr<Socket>;
+
+    /// Opens, binds and listens on the abstract socket named _name.
+    boost::system::error_code openAcceptor();
+    /// Listens again once a fatal accept error closed the acceptor.
+    void restartAcceptor();
+    void accept();
+    void onAccept(const boost::system::error_code& erc, SocketPtr s);
+    void onHandshake(TransportSocketPtr socket);
+
+    boost::asio::local::stream_protocol::acceptor _acceptor;
+    bool _live;
+    std::string _name;
+    unsigned int _connectionCount;
+
+    // Delay before accepting again when out of file descriptors
+    static const int AcceptRetryDelayMs;
+  };
+}
+
+#endif  // _SRC_TRANSPORTSERVERSHM_P_HPP_
@@ -10,9 +10,11 @@
 #endif
 
 #include <qi/log.hpp>
+#include <qi/os.hpp>
 
 #include "transportsocket.hpp"
 #include "tcptransportsocket.hpp"
+#include "shmtransportsocket.hpp"
 
 qiLogCategory("qimessaging.transportsocket");
 
@@ -26,10 +28,91 @@ namespace qi
     qiLogDebug() << "Destroying transport socket";
   }
 
+  bool TransportSocket::dispatchReceived(const qi::Message& msg, const TransportSocketPtr& self)
+  {
+    if ((msg.flags() & Message::TypeFlag_Deadline) && !msg._p->receiveDeadline())
+    {
+      qiLogError() << "Ill-formed deadline in message " << msg.address();
+      return false;
+    }
+    if ((!hasReceivedRemoteCapabilities() &&
+          msg.service() == Message::Service_Server &&
+          msg.function() == Message::ServerFunction_Authenticate)
+        || msg.type() == Message::Type_Capability)
+    {
+      // This one is for us
+      if (msg.type() != Message::Type_Error)
+      {
+        AnyReference cmRef;
+        try
+        {
+          cmRef = msg.value(typeOf<CapabilityMap>()->signature(), self);
+          CapabilityMap cm = cmRef.to<CapabilityMap>();
+          cmRef.destroy();
+          boost::mutex::scoped_lock lock(_contextMutex);
+          _remoteCapabilityMap.insert(cm.begin(), cm.end());
+        }
+        catch (const std::runtime_error& e)
+        {
+          cmRef.destroy();
+          qiLogError() << "Ill-formed capabilities message: " << e.what();
+          return false;
+        }
+      }
+      if (msg.type() == Message::Type_Capability)
+        return true;
+    }
+    messageReady(msg);
+    socketEvent(SocketEventData(msg));
+    _dispatcher.dispatch(msg);
+    return true;
+  }
+
+  qi::Future<void> TransportSocket::sendAsync(const qi::Message& msg)
+  {
+    if (!send(msg))
+      return makeFutureError<void>("Send failed");
+    return qi::Future<void>(0);
+  }
+
+  size_t TransportSocket::maxIncomingPayload()
+  {
+    static size_t maxPayload = 0;
+    static bool init = false;
+    // Not thread-safe, limited consequences
+    // worst case: first received messages will not honor limit)
+    if (!init)
+    {
+      init = true;
+      std::string l = os::getenv("QI_MAX_MESSAGE_PAYLOAD");
+      if (!l.empty())
+        maxPayload = strtol(l.c_str(), 0, 0);
+      else
+        maxPayload = 50000000; // reasonable default
+    }
+    return maxPayload;
+  }
+
+  static size_t maxSendQueueFromEnv(const char* var, size_t def)
+  {
+    std::string l = os::getenv(var);
+    return l.empty() ? def : strtol(l.c_str(), 0, 0);
+  }
+
+  size_t TransportSocket::defaultMaxSendQueueBytes()
+  {
+    return maxSendQueueFromEnv("QI_SEND_QUEUE_MAX_BYTES", 64 * 1024 * 1024);
+  }
+
+  size_t TransportSocket::defaultMaxSendQueueMessages()
+  {
+    return maxSendQueueFromEnv("QI_SEND_QUEUE_MAX_MESSAGES", 65536);
+  }
+
   TransportSocketPtr makeTransportSocket(const std::string &protocol, qi::EventLoop *eventLoop) {
     TransportSocketPtr ret;
 
-    if (protocol == "tcp")
+    if (protocol == "tcp" || protocol == "unix")
     {
       return TcpTransportSocketPtr(new TcpTransportSocket(eventLoop, false));
     }
@@ -37,6 +120,12 @@ namespace qi
     {
       return TcpTransportSocketPtr(new TcpTransportSocket(eventLoop, true));
     }
+#ifdef __linux__
+    else if (protocol == "shm")
+    {
+      return ShmTransportSocketPtr(new ShmTransportSocket(eventLoop));
+    }
+#endif
     else
     {
       qiLogError() << "Unrecognized protocol to create the TransportSocket: " << protocol;
@@ -48,8 +48,14 @@ namespace qi
       Event_Error = 0,
       Event_Message = 1,
     };
+    /// What to do with a message sent while the send queue is full.
+    enum class SendPolicy {
+      Block      = 0, // wait for the queue to drain
+      DropOldest = 1, // drop the oldest queued events to make room
+      Fail       = 2, // refuse the message
+    };
 
-    explicit TransportSocket(qi::EventLoop* eventLoop = qi::getEventLoop())
+    explicit TransportSocket(qi::EventLoop* eventLoop = qi::getNetworkEventLoop())
       : _eventLoop(NULL)
       , _err(0)
       , _status(Status::Disconnected)
@@ -64,6 +70,9 @@ namespace qi
     virtual qi::FutureSync<void> disconnect()                = 0;
 
     virtual bool send(const qi::Message &msg)                = 0;
+    /// Like send(), the future is set once the message is handed to the
+    /// system, or in error if it was refused, dropped or the socket closed.
+    virtual qi::Future<void> sendAsync(const qi::Message &msg);
 
     /// Start reading if is not already reading.
     /// Must be called once if the socket is obtained through TransportServer::newConnection()
@@ -100,6 +109,20 @@ namespace qi
     }
 
   protected:
+    /// Handle a fully received message: capability messages are consumed,
+    /// other messages are emitted and dispatched.
+    /// @return false if the message carried an ill-formed deadline or capabilities.
+    bool dispatchReceived(const qi::Message& msg, const boost::shared_ptr<TransportSocket>& self);
+
+    /// Maximum payload size accepted for incoming messages, 0 if unlimited.
+    /// Configured with the environment variable QI_MAX_MESSAGE_PAYLOAD.
+    static size_t maxIncomingPayload();
+
+    /// Default high-water marks of send queues, 0 if unlimited. Configured
+    /// with QI_SEND_QUEUE_MAX_BYTES and QI_SEND_QUEUE_MAX_MESSAGES.
+    static size_t defaultMaxSendQueueBytes();
+    static size_t defaultMaxSendQueueMessages();
+
     qi::EventLoop*          _eventLoop;
     qi::MessageDispatcher   _dispatcher;
 
@@ -121,7 +144,7 @@ namespace qi
 
   using TransportSocketPtr = boost::shared_ptr<TransportSocket>;
 
-  TransportSocketPtr makeTransportSocket(const std::string &protocol, qi::EventLoop *eventLoop = getEventLoop());
+  TransportSocketPtr makeTransportSocket(const std::string &protocol, qi::EventLoop *eventLoop = getNetworkEventLoop());
 
 }
 
@@ -2,6 +2,7 @@
 **  Copyright (C) 2012 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <set>
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
@@ -87,22 +88,92 @@ static UrlVector localhost_only(const UrlVector& input)
   return result;
 }
 
+/// Endpoints that can only be reached from the machine exposing them.
+static bool isMachineLocal(const Url& url)
+{
+  return url.protocol() == "shm" || url.protocol() == "unix";
+}
+
+static bool isSupported(const Url& url)
+{
+#ifndef __linux__
+  if (url.protocol() == "shm")
+    return false;
+#endif
+#ifdef _WIN32
+  if (url.protocol() == "unix")
+    return false;
+#endif
+  return true;
+}
+
+static UrlVector protocol_only(const UrlVector& input, const std::string& protocol)
+{
+  UrlVector result;
+  for (const auto& url: input)
+  {
+    if (url.protocol() == protocol && isSupported(url))
+      result.push_back(url);
+  }
+  return result;
+}
+
+/// Endpoints worth trying: valid, and reachable from this machine.
+static UrlVector reachable_only(const UrlVector& input, bool local)
+{
+  UrlVector result;
+  result.reserve(input.size());
+  for (const auto& url: input)
+  {
+    if (!url.isValid())
+      continue; // Do not try to connect to an invalid url!
+
+    if (!local && (isLocalHost(url.host()) || isMachineLocal(url)))
+      continue; // Do not try to connect on localhost when it is a remote!
+
+    if (!isSupported(url))
+      continue;
+    result.push_back(url);
+  }
+  return result;
+}
+
 Future<TransportSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInfo, const std::string& url)
 {
   const std::string& machineId = servInfo.machineId();
   ConnectionAttemptPtr couple = boost::make_shared<ConnectionAttempt>();
   couple->relatedUrls = servInfo.endpoints();
   bool local = machineId == os::getMachineId();
-  UrlVector connectionCandidates;
+  std::deque<UrlVector> candidates;
 
-  // If the connection is local, we're mainly interested in localhost endpoint
+  // If the connection is local, we're mainly interested in shared memory
+  // endpoints, then unix sockets, then localhost ones. Shared memory and
+  // unix sockets may still be out of reach (other user, other namespace):
+  // each kind is tried in turn when every attempt of the previous one failed.
   if (local)
-    connectionCandidates = localhost_only(servInfo.endpoints());
+  {
+    candidates.push_back(protocol_only(servInfo.endpoints(), "shm"));
+    candidates.push_back(protocol_only(servInfo.endpoints(), "unix"));
+    candidates.push_back(localhost_only(servInfo.endpoints()));
+  }
 
   // If the connection isn't local or if the service doesn't expose local endpoints,
   // try and connect to whatever is available.
-  if (connectionCandidates.size() == 0)
-    connectionCandidates = servInfo.endpoints();
+  candidates.push_back(servInfo.endpoints());
+
+  // Keep the reachable endpoints not tried before.
+  std::set<Url> tried;
+  for (std::deque<UrlVector>::iterator it = candidates.begin(); it != candidates.end();)
+  {
+    UrlVector urls;
+    for (const auto& url: reachable_only(*it, local))
+      if (tried.insert(url).second)
+        urls.push_back(url);
+    if (urls.empty())
+      it = candidates.erase(it);
+    else
+      *it++ = urls;
+  }
 
   couple->endpoint = TransportSocketPtr();
   couple->state = State_Pending;
@@ -130,27 +201,36 @@ Future<TransportSocketPtr> TransportSocketCache::socket(const ServiceInfo& servI
     }
     // Otherwise, we keep track of all those URLs and assign them the same promise in our map.
     // They will all track the same connection.
-    couple->attemptCount = connectionCandidates.size();
-    std::map<Url, ConnectionAttemptPtr>& urlMap = _connections[machineId];
-    for (const auto& url: connectionCandidates)
+    if (candidates.empty())
     {
-      if (!url.isValid())
-        continue; // Do not try to connect to an invalid url!
-
-      if (!local && isLocalHost(url.host()))
-        continue; // Do not try to connect on localhost when it is a remote!
-
-      urlMap[url] = couple;
-      TransportSocketPtr socket = makeTransportSocket(url.protocol());
-      _allPendingConnections.push_back(socket);
-      Future<void> sockFuture = socket->connect(url);
-      qiLogDebug() << "Inserted [" << machineId << "][" << url.str() << "]";
-      sockFuture.connect(&TransportSocketCache::onSocketParallelConnectionAttempt, this, _1, socket, url, servInfo);
+      std::stringstream err;
+      err << "Could not connect to service #" << servInfo.serviceId() << ": no reachable endpoint.";
+      return makeFutureError<TransportSocketPtr>(err.str());
     }
+    UrlVector urls = candidates.front();
+    candidates.pop_front();
+    couple->fallbacks.swap(candidates);
+    tryEndpoints(couple, urls, servInfo);
   }
   return couple->promise.future();
 }
 
+void TransportSocketCache::tryEndpoints(ConnectionAttemptPtr attempt, const UrlVector& urls, const ServiceInfo& info)
+{
+  const std::string& machineId = info.machineId();
+  attempt->attemptCount = urls.size();
+  std::map<Url, ConnectionAttemptPtr>& urlMap = _connections[machineId];
+  for (const auto& url: urls)
+  {
+    urlMap[url] = attempt;
+    TransportSocketPtr socket = makeTransportSocket(url.protocol());
+    _allPendingConnections.push_back(socket);
+    Future<void> sockFuture = socket->connect(url);
+    qiLogDebug() << "Inserted [" << machineId << "][" << url.str() << "]";
+    sockFuture.connect(&TransportSocketCache::onSocketParallelConnectionAttempt, this, _1, socket, url, info);
+  }
+}
+
 void TransportSocketCache::insert(const std::string& machineId, const Url& url, TransportSocketPtr socket)
 {
   // If a connection is pending for this machine / url, terminate the pendage and set the
@@ -257,6 +337,15 @@ void TransportSocketCache::onSocketParallelConnectionAttempt(Future<void> fut,
     // Failing to connect to some of the endpoint is expected.
     qiLogDebug() << "Could not connect to service #" << info.serviceId() << " through url " << url.str();
     _allPendingConnections.remove(socket);
+    if (attempt->attemptCount == 0 && !attempt->fallbacks.empty())
+    {
+      UrlVector urls = attempt->fallbacks.front();
+      attempt->fallbacks.pop_front();
+      qiLogVerbose() << "Could not connect to service #" << info.serviceId() << " through "
+                     << url.protocol() << ", trying other endpoints";
+      tryEndpoints(attempt, urls, info);
+      return;
+    }
     // It's a critical error if we've exhausted all available endpoints.
     if (attempt->attemptCount == 0)
     {
@@ -8,6 +8,7 @@
 #define _SRC_TRANSPORTSOCKETCACHE2_HPP_
 
 #include <string>
+#include <deque>
 #include <queue>
 
 #include <boost/thread/mutex.hpp>
@@ -75,9 +76,15 @@ namespace qi
       int attemptCount;
       State state;
       SignalLink disconnectionTracking;
+      // Endpoints to try, in order, once every attempt of the current ones failed
+      std::deque<UrlVector> fallbacks;
     };
     using ConnectionAttemptPtr = boost::shared_ptr<ConnectionAttempt>;
 
+    /// Connects to all of \p urls in parallel for \p attempt.
+    /// Must be called with _socketMutex locked.
+    void tryEndpoints(ConnectionAttemptPtr attempt, const UrlVector& urls, const ServiceInfo& info);
+
     void checkClear(ConnectionAttemptPtr, const std::string& machineId);
 
     using MachineId = std::string;
@@ -257,11 +257,13 @@ namespace qi {
       url += protocol + "://";
     if(components & HOST)
       url += host;
-    if(components & PORT)
+    if((components & PORT) && protocol != "unix")
       url += std::string(":") + boost::lexical_cast<std::string>(port);
   }
 
   bool UrlPrivate::isValid() const {
+    if ((components & SCHEME) && protocol == "unix")
+      return (components & HOST) != 0;
     return components == (SCHEME | HOST | PORT);
   }
 
@@ -277,6 +279,7 @@ namespace qi {
      * scheme:// return SCHEME
      * :port return PORT
      *  return 0
+     * unix://path return SCHEME | HOST, the path being the host
      */
     std::string _url = url;
     std::string _scheme = "";
@@ -294,15 +297,25 @@ namespace qi {
       place = 0;
 
     _url = _url.substr(place);
-    place = _url.find(":");
-    _host = _url.substr(0, place);
-    if (!_host.empty())
-      components |= HOST;
-
-    if (place != std::string::npos) {
-      std::stringstream ss(_url.substr(place+1));
-      ss >> _port;
-      components |= PORT;
+    if (_scheme == "unix")
+    {
+      // The whole path is the host, it may contain ':'.
+      _host = _url;
+      if (!_host.empty())
+        components |= HOST;
+    }
+    else
+    {
+      place = _url.find(":");
+      _host = _url.substr(0, place);
+      if (!_host.empty())
+        components |= HOST;
+
+      if (place != std::string::npos) {
+        std::stringstream ss(_url.substr(place+1));
+        ss >> _port;
+        components |= PORT;
+      }
     }
 
     port = _port;
@@ -4,6 +4,8 @@
 */
 
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <qi/binarycodec.hpp>
 #include <qi/anyvalue.hpp>
@@ -16,7 +18,11 @@
 #include <qi/type/typedispatcher.hpp>
 #include <qi/types.hpp>
 #include <vector>
+#include <map>
+#include <atomic>
+#include <functional>
 #include <cstring>
+#include <limits>
 
 qiLogCategory("qitype.binarycoder");
 
@@ -255,6 +261,12 @@ namespace qi {
     writeString(s, len);
   }
 
+  void BinaryEncoder::reserve(size_t size)
+  {
+    if (!_p->_buffer.reserveCapacity(_p->_buffer.size() + size))
+      setStatus(Status::WriteError);
+  }
+
   void BinaryEncoder::writeRaw(const qi::Buffer &meta) {
     if (!_p->_innerSerialization)
     {
@@ -379,6 +391,481 @@ namespace qi {
 
   namespace detail {
 
+    /// @return the encoded size of a value of type \p type if it is fixed, 0 otherwise.
+    static size_t fixedEncodedSize(TypeInterface* type)
+    {
+      switch (type->kind())
+      {
+      case TypeKind_Int:
+      {
+        unsigned int sz = static_cast<IntTypeInterface*>(type)->size();
+        return sz ? sz : sizeof(bool);
+      }
+      case TypeKind_Float:
+        return static_cast<FloatTypeInterface*>(type)->size();
+      default:
+        return 0;
+      }
+    }
+
+    template <typename T>
+    static bool isType(TypeInterface* type)
+    {
+      return type->info() == typeOf<T>()->info();
+    }
+
+    /// @return the size of \p type if it is a builtin int or float type, whose
+    /// in-memory representation is its encoded form, 0 otherwise.
+    /// Other int types such as durations convert their value in get() and set().
+    static size_t blockCopyableSize(TypeInterface* type)
+    {
+      switch (type->kind())
+      {
+      case TypeKind_Int:
+        // bool is not block copyable
+        if (isType<char>(type) || isType<signed char>(type) || isType<unsigned char>(type)
+            || isType<short>(type) || isType<unsigned short>(type)
+            || isType<int>(type) || isType<unsigned int>(type)
+            || isType<long>(type) || isType<unsigned long>(type)
+            || isType<long long>(type) || isType<unsigned long long>(type))
+          return static_cast<IntTypeInterface*>(type)->size();
+        return 0;
+      case TypeKind_Float:
+        if (isType<float>(type) || isType<double>(type))
+          return static_cast<FloatTypeInterface*>(type)->size();
+        return 0;
+      default:
+        return 0;
+      }
+    }
+
+    /// Storage of LazyTupleType.
+    struct LazyTuple
+    {
+      LazyTuple()
+        : hasData(false)
+        , modified(false)
+      {}
+
+      // encoded fields, valid if hasData
+      Buffer buffer;
+      bool hasData;
+      // set when a field was assigned: the encoded fields are then outdated
+      bool modified;
+      // decoded fields, 0 until first accessed
+      std::vector<void*> fields;
+      // readers positioned at the beginning of the first encoded fields
+      std::vector<BufferReader> starts;
+      // protects the above, fields are decoded by whoever reads them first
+      boost::mutex mutex;
+    };
+
+    /** Tuple whose fields are decoded from a buffer when first accessed.
+     *
+     * Fields handed out by get() are read-only, they are changed with set().
+     * Encoding a LazyTuple none of whose fields were set copies its encoded
+     * bytes.
+     */
+    class LazyTupleType: public StructTypeInterface
+    {
+    public:
+      explicit LazyTupleType(const Signature& signature);
+
+      std::vector<TypeInterface*> memberTypes() override { return _types; }
+      void* get(void* storage, unsigned int index) override;
+      void set(void** storage, unsigned int index, void* valStorage) override;
+      const TypeInfo& info() override { return _info; }
+      void* initializeStorage(void* ptr = 0) override;
+      void* clone(void* storage) override;
+      void destroy(void* storage) override;
+      void* ptrFromStorage(void** s) override { return Methods::ptrFromStorage(s); }
+      bool less(void* a, void* b) override { return a < b; }
+
+      LazyTuple& backend(void* storage) { return *(LazyTuple*)ptrFromStorage(&storage); }
+      /// @return true if the encoded fields are up to date and can be copied
+      /// as they are, setting \p size to their size.
+      bool encodedFields(LazyTuple& tuple, size_t& size);
+
+    private:
+      /// @return a reader positioned at the beginning of field \p index.
+      /// The tuple mutex must be held.
+      BufferReader& fieldReader(LazyTuple& tuple, unsigned int index);
+
+    public:
+
+      Signature _signature;
+      std::vector<TypeInterface*> _types;
+      TypeInfo _info;
+      using Methods = DefaultTypeImplMethods<LazyTuple, TypeByPointerPOD<LazyTuple>>;
+    };
+
+    /** Serialization steps of a type, computed once and cached by CodecPlanCache.
+     *
+     * Containers and tuples are handled by the plan itself, using the
+     * signatures and child plans computed beforehand. Other kinds are delegated
+     * to the type visitors.
+     */
+    struct CodecPlan
+    {
+      enum Op
+      {
+        Op_Int,
+        Op_Float,
+        Op_String,
+        Op_List,
+        Op_Map,
+        Op_Tuple,
+        Op_Visitor,
+      };
+
+      explicit CodecPlan(TypeInterface* type);
+      /// Types of the values handled by children plans
+      std::vector<TypeInterface*> childTypes() const;
+
+      Op             op;
+      TypeInterface* type;
+      // Op_Int and Op_Float
+      bool           isSigned;
+      int            byteSize;
+      // Op_Tuple: the type is a LazyTupleType
+      bool           lazyTuple;
+      // Op_String, or Op_Visitor on a raw kind: the type is a BufferView
+      // decoded without copy
+      bool           bufferView;
+      // Op_List
+      size_t         blockElementSize;
+      size_t         encodedElementSize;
+      // element signature for Op_List, key signature for Op_Map,
+      // signature for Op_Tuple
+      Signature      signature;
+      // Op_Map
+      Signature      valueSignature;
+      // element for Op_List, key and value for Op_Map, members for Op_Tuple
+      std::vector<const CodecPlan*> children;
+    };
+
+    CodecPlan::CodecPlan(TypeInterface* type)
+      : op(Op_Visitor)
+      , type(type)
+      , isSigned(false)
+      , byteSize(0)
+      , lazyTuple(false)
+      , bufferView(false)
+      , blockElementSize(0)
+      , encodedElementSize(0)
+    {
+      switch (type->kind())
+      {
+      case TypeKind_Int:
+        op = Op_Int;
+        isSigned = static_cast<IntTypeInterface*>(type)->isSigned();
+        byteSize = static_cast<IntTypeInterface*>(type)->size();
+        break;
+      case TypeKind_Float:
+        op = Op_Float;
+        byteSize = static_cast<FloatTypeInterface*>(type)->size();
+        break;
+      case TypeKind_String:
+        op = Op_String;
+        bufferView = type->info() == typeOf<BufferView>()->info();
+        break;
+      case TypeKind_Raw:
+        bufferView = type->info() == typeOf<RawBufferView>()->info();
+        break;
+      case TypeKind_List:
+      case TypeKind_VarArgs:
+      {
+        TypeInterface* elementType = static_cast<ListTypeInterface*>(type)->elementType();
+        op = Op_List;
+        blockElementSize = blockCopyableSize(elementType);
+        encodedElementSize = fixedEncodedSize(elementType);
+        signature = elementType->signature();
+        break;
+      }
+      case TypeKind_Map:
+        op = Op_Map;
+        signature = static_cast<MapTypeInterface*>(type)->keyType()->signature();
+        valueSignature = static_cast<MapTypeInterface*>(type)->elementType()->signature();
+        break;
+      case TypeKind_Tuple:
+        op = Op_Tuple;
+        signature = qi::makeTupleSignature(static_cast<StructTypeInterface*>(type)->memberTypes());
+        lazyTuple = dynamic_cast<LazyTupleType*>(type) != 0;
+        break;
+      default:
+        break;
+      }
+    }
+
+    std::vector<TypeInterface*> CodecPlan::childTypes() const
+    {
+      std::vector<TypeInterface*> res;
+      switch (op)
+      {
+      case Op_List:
+        res.push_back(static_cast<ListTypeInterface*>(type)->elementType());
+        break;
+      case Op_Map:
+        res.push_back(static_cast<MapTypeInterface*>(type)->keyType());
+        res.push_back(static_cast<MapTypeInterface*>(type)->elementType());
+        break;
+      case Op_Tuple:
+        res = static_cast<StructTypeInterface*>(type)->memberTypes();
+        break;
+      default:
+        break;
+      }
+      return res;
+    }
+
+    /// Insert-only hash table whose lookups take no lock: an entry is
+    /// prepended to its bucket by a release store and never removed.
+    /// Callers must serialize publish().
+    template <typename Key, typename Value>
+    class PublishedTable
+    {
+    public:
+      PublishedTable()
+      {
+        for (std::size_t i = 0; i < BucketCount; ++i)
+          _buckets[i].store(0, std::memory_order_relaxed);
+      }
+
+      Value* find(const Key& key) const
+      {
+        for (const Entry* entry = _buckets[bucket(key)].load(std::memory_order_acquire);
+             entry; entry = entry->next)
+          if (entry->key == key)
+            return entry->value;
+        return 0;
+      }
+
+      void publish(const Key& key, Value* value)
+      {
+        std::atomic<Entry*>& head = _buckets[bucket(key)];
+        head.store(new Entry(key, value, head.load(std::memory_order_relaxed)),
+                   std::memory_order_release);
+      }
+
+    private:
+      struct Entry
+      {
+        Entry(const Key& key, Value* value, Entry* next)
+          : key(key), value(value), next(next)
+        {}
+        const Key key;
+        Value* const value;
+        Entry* const next;
+      };
+
+      static const std::size_t BucketCount = 256;
+
+      static std::size_t bucket(const Key& key)
+      {
+        return std::hash<Key>()(key) % BucketCount;
+      }
+
+      std::atomic<Entry*> _buckets[BucketCount];
+    };
+
+    /// Thread-safe cache of the plans of every type seen by the codec.
+    /// Plans are never destroyed, like the types they describe.
+    /// Lookups are lock-free, _mutex is only taken to build missing plans.
+    class CodecPlanCache
+    {
+    public:
+      const CodecPlan& get(TypeInterface* type)
+      {
+        if (!type)
+          throw std::runtime_error("NULL type");
+        if (CodecPlan* plan = _published.find(type))
+          return *plan;
+        boost::mutex::scoped_lock lock(_mutex);
+        std::vector<CodecPlan*> built;
+        CodecPlan* plan = build(type, built);
+        // Only publish complete plans, so that lock-free readers never see
+        // a plan whose children are still being built.
+        for (unsigned i = 0; i < built.size(); ++i)
+          _published.publish(built[i]->type, built[i]);
+        return *plan;
+      }
+
+    private:
+      // _mutex must be held
+      CodecPlan* build(TypeInterface* type, std::vector<CodecPlan*>& built)
+      {
+        std::map<TypeInterface*, CodecPlan*>::iterator it = _plans.find(type);
+        if (it != _plans.end())
+          return it->second;
+        CodecPlan* plan = new CodecPlan(type);
+        _plans[type] = plan;
+        built.push_back(plan);
+        std::vector<TypeInterface*> childTypes = plan->childTypes();
+        for (unsigned i = 0; i < childTypes.size(); ++i)
+          plan->children.push_back(build(childTypes[i], built));
+        return plan;
+      }
+
+      boost::mutex _mutex;
+      std::map<TypeInterface*, CodecPlan*> _plans;
+      PublishedTable<TypeInterface*, CodecPlan> _published;
+    };
+
+    static const CodecPlan& codecPlan(TypeInterface* type)
+    {
+      static CodecPlanCache* cache = 0;
+      QI_THREADSAFE_NEW(cache);
+      return cache->get(type);
+    }
+
+    static void runSerializePlan(const CodecPlan& plan, AnyReference value, BinaryEncoder& out,
+                                 const SerializeObjectCallback& serializeObjectCb, StreamContext* streamContext);
+    static AnyReference runDeserializePlan(const CodecPlan& plan, AnyReference result, BinaryDecoder& in,
+                                           const DeserializeObjectCallback& context, StreamContext* streamContext);
+
+    static void writeInt(BinaryEncoder& out, int64_t value, bool isSigned, int byteSize)
+    {
+      switch((isSigned ? 1 : -1) * byteSize)
+      {
+        case 0:  out.write((bool)!!value);    break;
+        case 1:  out.write((int8_t)value);  break;
+        case -1: out.write((uint8_t)value); break;
+        case 2:  out.write((int16_t)value); break;
+        case -2: out.write((uint16_t)value);break;
+        case 4:  out.write((int32_t)value); break;
+        case -4: out.write((uint32_t)value);break;
+        case 8:  out.write((int64_t)value); break;
+        case -8: out.write((uint64_t)value);break;
+        default: {
+          std::stringstream ss;
+          ss << "Unknown integer type " << isSigned << " " << byteSize;
+          throw std::runtime_error(ss.str());
+        }
+      }
+    }
+
+    static void writeFloat(BinaryEncoder& out, double value, int byteSize)
+    {
+      if (byteSize == 4)
+        out.write((float)value);
+      else if (byteSize == 8)
+        out.write((double)value);
+      else {
+        std::stringstream ss;
+        ss << "serialize on unknown float type " << byteSize;
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    static void readInt(BinaryDecoder& in, AnyReference& result, bool isSigned, int byteSize)
+    {
+      switch((isSigned?1:-1)*byteSize)
+      {
+      case 0: {
+        bool b; in.read(b); result.setInt(b);
+      } break;
+      case 1: {
+        int8_t b; in.read(b); result.setInt(b);
+      } break;
+      case -1: {
+        uint8_t b; in.read(b); result.setUInt(b);
+      } break;
+      case 2: {
+        int16_t b; in.read(b); result.setInt(b);
+      } break;
+      case -2: {
+        uint16_t b; in.read(b); result.setUInt(b);
+      } break;
+      case 4: {
+        int32_t b; in.read(b); result.setInt(b);
+      } break;
+      case -4: {
+        uint32_t b; in.read(b); result.setUInt(b);
+      } break;
+      case 8: {
+        int64_t b; in.read(b); result.setInt(b);
+      } break;
+      case -8: {
+        uint64_t b; in.read(b); result.setUInt(b);
+      } break;
+      default: {
+        std::stringstream ss;
+        ss << "Unknown integer type " << isSigned << " " << byteSize;
+        throw std::runtime_error(ss.str());
+      }
+      }
+    }
+
+    static void readFloat(BinaryDecoder& in, AnyReference& result, int byteSize)
+    {
+      if (byteSize == 4) {
+        float t;
+        in.read(t);
+        result.setFloat(t);
+      } else if (byteSize == 8) {
+        double t;
+        in.read(t);
+        result.setDouble(t);
+      } else {
+        std::stringstream ss;
+        ss << "Unknown float type " << byteSize;
+        throw std::runtime_error(ss.str());
+      }
+    }
+
+    static void readString(BinaryDecoder& in, AnyReference& result)
+    {
+      std::string s;
+      in.read(s);
+
+      //optimise when result is of type std::string
+      static TypeInterface* tstring = nullptr;
+      QI_ONCE(tstring = qi::typeOf<std::string>());
+      if ((result.type() == tstring) || (result.type()->info() == tstring->info())) {
+        std::swap(s, result.as<std::string>());
+        return;
+      }
+      //result is compatible with string
+      result.setString(s);
+    }
+
+    /// Point \p result, a BufferView, to the next string in the decoded buffer.
+    static void readStringView(BinaryDecoder& in, AnyReference& result)
+    {
+      qi::uint32_t sz = 0;
+      in.read(sz);
+      if (in.status() != BinaryDecoder::Status::Ok)
+        return;
+      const char* data = static_cast<const char*>(sz ? in.readRaw(sz) : 0);
+      if (sz && !data) {
+        in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+        return;
+      }
+      result.as<BufferView>() = BufferView(in.bufferReader().buffer(), data, sz);
+    }
+
+    /// Point \p result, a RawBufferView, to the next raw data in the decoded buffer.
+    static void readRawView(BinaryDecoder& in, AnyReference& result)
+    {
+      BufferReader& reader = in.bufferReader();
+      if (reader.hasSubBuffer())
+      {
+        const Buffer& sub = reader.subBuffer();
+        result.as<RawBufferView>() = RawBufferView(sub, static_cast<const char*>(sub.data()), sub.size());
+        return;
+      }
+      qi::uint32_t sz = 0;
+      in.read(sz);
+      if (in.status() != BinaryDecoder::Status::Ok)
+        return;
+      const char* data = static_cast<const char*>(sz ? in.readRaw(sz) : 0);
+      if (sz && !data) {
+        in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+        return;
+      }
+      result.as<RawBufferView>() = RawBufferView(reader.buffer(), data, sz);
+    }
+
     class SerializeTypeVisitor
     {
     public:
@@ -403,36 +890,12 @@ namespace qi {
 
       void visitInt(int64_t value, bool isSigned, int byteSize)
       {
-        switch((isSigned ? 1 : -1) * byteSize)
-        {
-          case 0:  out.write((bool)!!value);    break;
-          case 1:  out.write((int8_t)value);  break;
-          case -1: out.write((uint8_t)value); break;
-          case 2:  out.write((int16_t)value); break;
-          case -2: out.write((uint16_t)value);break;
-          case 4:  out.write((int32_t)value); break;
-          case -4: out.write((uint32_t)value);break;
-          case 8:  out.write((int64_t)value); break;
-          case -8: out.write((uint64_t)value);break;
-          default: {
-            std::stringstream ss;
-            ss << "Unknown integer type " << isSigned << " " << byteSize;
-            throw std::runtime_error(ss.str());
-          }
-        }
+        writeInt(out, value, isSigned, byteSize);
       }
 
       void visitFloat(double value, int byteSize)
       {
-        if (byteSize == 4)
-          out.write((float)value);
-        else if (byteSize == 8)
-          out.write((double)value);
-        else {
-          std::stringstream ss;
-          ss << "serialize on unknown float type " << byteSize;
-          throw std::runtime_error(ss.str());
-        }
+        writeFloat(out, value, byteSize);
       }
 
       void visitString(char* data, size_t len)
@@ -440,12 +903,9 @@ namespace qi {
         out.writeString(data, len);
       }
 
-      void visitList(AnyIterator it, AnyIterator end)
+      void visitList(AnyIterator, AnyIterator)
       {
-        out.beginList(value.size(), static_cast<ListTypeInterface*>(value.type())->elementType()->signature());
-        for (; it != end; ++it)
-          serialize(*it, out, serializeObjectCb, streamContext);
-        out.endList();
+        runSerializePlan(codecPlan(value.type()), value, out, serializeObjectCb, streamContext);
       }
 
       void visitVarArgs(AnyIterator it, AnyIterator end)
@@ -453,17 +913,9 @@ namespace qi {
         visitList(it, end);
       }
 
-      void visitMap(AnyIterator it, AnyIterator end)
+      void visitMap(AnyIterator, AnyIterator)
       {
-        MapTypeInterface* type = static_cast<MapTypeInterface*>(value.type());
-        out.beginMap(value.size(), type->keyType()->signature(), type->elementType()->signature());
-        for(; it != end; ++it)
-        {
-          AnyReference v = *it;
-          serialize(v[0], out, serializeObjectCb, streamContext);
-          serialize(v[1], out, serializeObjectCb, streamContext);
-        }
-        out.endMap();
+        runSerializePlan(codecPlan(value.type()), value, out, serializeObjectCb, streamContext);
       }
 
       void visitObject(GenericObject value)
@@ -503,19 +955,15 @@ namespace qi {
         out.write(osi.objectId);
       }
 
-      void visitTuple(const std::string &name, const AnyReferenceVector& vals, const std::vector<std::string>& annotations)
+      void visitTuple(const std::string &, const AnyReferenceVector&, const std::vector<std::string>&)
       {
-        out.beginTuple(qi::makeTupleSignature(vals));
-        for (unsigned i=0; i<vals.size(); ++i)
-          serialize(vals[i], out, serializeObjectCb, streamContext);
-        out.endTuple();
+        runSerializePlan(codecPlan(value.type()), value, out, serializeObjectCb, streamContext);
       }
 
       void visitDynamic(AnyReference pointee)
       {
         //Remaining types
-        out.writeValue(pointee, boost::bind(&typeDispatch<SerializeTypeVisitor>,
-                                            SerializeTypeVisitor(out, serializeObjectCb, pointee, streamContext), pointee));
+        out.writeValue(pointee, boost::bind(&serialize, pointee, boost::ref(out), serializeObjectCb, streamContext));
       }
 
       void visitRaw(AnyReference raw)
@@ -560,91 +1008,24 @@ namespace qi {
         result = AnyReference(typeOf<void>(), 0);
       }
 
-      void visitInt(int64_t value, bool isSigned, int byteSize)
+      void visitInt(int64_t, bool isSigned, int byteSize)
       {
-        switch((isSigned?1:-1)*byteSize)
-        {
-        case 0: {
-          bool b; in.read(b); result.setInt(b);
-        } break;
-        case 1: {
-          int8_t b; in.read(b); result.setInt(b);
-        } break;
-        case -1: {
-          uint8_t b; in.read(b); result.setUInt(b);
-        } break;
-        case 2: {
-          int16_t b; in.read(b); result.setInt(b);
-        } break;
-        case -2: {
-          uint16_t b; in.read(b); result.setUInt(b);
-        } break;
-        case 4: {
-          int32_t b; in.read(b); result.setInt(b);
-        } break;
-        case -4: {
-          uint32_t b; in.read(b); result.setUInt(b);
-        } break;
-        case 8: {
-          int64_t b; in.read(b); result.setInt(b);
-        } break;
-        case -8: {
-          uint64_t b; in.read(b); result.setUInt(b);
-        } break;
-        default: {
-          std::stringstream ss;
-          ss << "Unknown integer type " << isSigned << " " << byteSize;
-          throw std::runtime_error(ss.str());
-        }
-        }
+        readInt(in, result, isSigned, byteSize);
       }
 
-      void visitFloat(double value, int byteSize)
+      void visitFloat(double, int byteSize)
       {
-        if (byteSize == 4) {
-          float t;
-          in.read(t);
-          result.setFloat(t);
-        } else if (byteSize == 8) {
-          double t;
-          in.read(t);
-          result.setDouble(t);
-        } else {
-          std::stringstream ss;
-          ss << "Unknown float type " << byteSize;
-          throw std::runtime_error(ss.str());
-        }
+        readFloat(in, result, byteSize);
       }
 
       void visitString(char*, size_t)
       {
-        std::string s;
-        in.read(s);
-
-        //optimise when result is of type std::string
-        static TypeInterface* tstring = nullptr;
-        QI_ONCE(tstring = qi::typeOf<std::string>());
-        if ((result.type() == tstring) || (result.type()->info() == tstring->info())) {
-          std::swap(s, result.as<std::string>());
-          return;
-        }
-        //result is compatible with string
-        result.setString(s);
+        readString(in, result);
       }
 
       void visitList(AnyIterator, AnyIterator)
       {
-        TypeInterface* elementType = static_cast<ListTypeInterface*>(result.type())->elementType();
-        qi::uint32_t sz = 0;
-        in.read(sz);
-        if (in.status() != BinaryDecoder::Status::Ok)
-          return;
-        for (unsigned i = 0; i < sz; ++i)
-        {
-          AnyReference v = deserialize(elementType, in, context, streamContext);
-          result.append(v);
-          v.destroy();
-        }
+        runDeserializePlan(codecPlan(result.type()), result, in, context, streamContext);
       }
 
       void visitVarArgs(AnyIterator b, AnyIterator e)
@@ -654,21 +1035,9 @@ namespace qi {
 
       void visitMap(AnyIterator, AnyIterator)
       {
-        TypeInterface* keyType = static_cast<MapTypeInterface*>(result.type())->keyType();
-        TypeInterface* elementType = static_cast<MapTypeInterface*>(result.type())->elementType();
-        qi::uint32_t sz = 0;
-        in.read(sz);
-        if (in.status() != BinaryDecoder::Status::Ok)
-          return;
-        for (unsigned i = 0; i < sz; ++i)
-        {
-          AnyReference k = deserialize(keyType, in, context, streamContext);
-          AnyReference v = deserialize(elementType, in, context, streamContext);
-          result.insert(k, v);
-          k.destroy();
-          v.destroy();
-        }
+        runDeserializePlan(codecPlan(result.type()), result, in, context, streamContext);
       }
+
       void visitAnyObject(AnyObject& o)
       {
         if (!streamContext)
@@ -712,22 +1081,7 @@ namespace qi {
 
       void visitTuple(const std::string &, const AnyReferenceVector&, const std::vector<std::string>&)
       {
-        std::vector<TypeInterface*> types = result.membersType();
-        AnyReferenceVector   vals;
-        vals.resize(types.size());
-        for (unsigned i = 0; i<types.size(); ++i)
-        {
-          AnyReference val = deserialize(types[i], in, context, streamContext);
-          if (!val.isValid())
-            throw std::runtime_error("Deserialization of tuple field failed");
-          vals[i] = val;
-        }
-        //TODO: there is a copy here.
-        result.setTuple(vals);
-        for (unsigned i = 0; i<vals.size(); ++i)
-        {
-          vals[i].destroy();
-        }
+        runDeserializePlan(codecPlan(result.type()), result, in, context, streamContext);
       }
 
       void visitDynamic(AnyReference pointee)
@@ -746,11 +1100,9 @@ namespace qi {
           throw std::runtime_error(ss.str());
         }
 
-        DeserializeTypeVisitor dtv(*this);
-        dtv.result = AnyReference(type);
-        typeDispatch<DeserializeTypeVisitor>(dtv, dtv.result);
-        result.setDynamic(dtv.result);
-        dtv.result.destroy();
+        AnyReference value = deserialize(type, in, context, streamContext);
+        result.setDynamic(value);
+        value.destroy();
       }
       void visitIterator(AnyReference)
       {
@@ -771,10 +1123,357 @@ namespace qi {
       StreamContext* streamContext;
     }; //class
 
+    /// Serialize \p value, using \p plan if it matches the type of \p value.
+    static void serializeElement(const CodecPlan& plan, AnyReference value, BinaryEncoder& out,
+                                 const SerializeObjectCallback& serializeObjectCb, StreamContext* streamContext)
+    {
+      runSerializePlan(value.type() == plan.type ? plan : codecPlan(value.type()),
+                       value, out, serializeObjectCb, streamContext);
+    }
+
+    static void runSerializePlan(const CodecPlan& plan, AnyReference value, BinaryEncoder& out,
+                                 const SerializeObjectCallback& serializeObjectCb, StreamContext* streamContext)
+    {
+      switch (plan.op)
+      {
+      case CodecPlan::Op_Int:
+        writeInt(out, static_cast<IntTypeInterface*>(plan.type)->get(value.rawValue()), plan.isSigned, plan.byteSize);
+        break;
+      case CodecPlan::Op_Float:
+        writeFloat(out, static_cast<FloatTypeInterface*>(plan.type)->get(value.rawValue()), plan.byteSize);
+        break;
+      case CodecPlan::Op_String:
+      {
+        StringTypeInterface::ManagedRawString content =
+          static_cast<StringTypeInterface*>(plan.type)->get(value.rawValue());
+        out.writeString(content.first.first, content.first.second);
+        if (content.second)
+          content.second(content.first);
+        break;
+      }
+      case CodecPlan::Op_List:
+      {
+        ListTypeInterface* type = static_cast<ListTypeInterface*>(plan.type);
+        void* storage = value.rawValue();
+        size_t size = type->size(storage);
+        out.beginList(size, plan.signature);
+        if (plan.blockElementSize)
+        {
+          if (void* data = type->data(storage))
+          {
+            // Elements are contiguous in memory: copy them all at once
+            out.write(static_cast<const char*>(data), size * plan.blockElementSize);
+            out.endList();
+            break;
+          }
+        }
+        if (plan.encodedElementSize)
+          out.reserve(size * plan.encodedElementSize);
+        const CodecPlan& elementPlan = *plan.children[0];
+        AnyIterator it = type->begin(storage);
+        AnyIterator end = type->end(storage);
+        for (; it != end; ++it)
+          serializeElement(elementPlan, *it, out, serializeObjectCb, streamContext);
+        out.endList();
+        break;
+      }
+      case CodecPlan::Op_Map:
+      {
+        MapTypeInterface* type = static_cast<MapTypeInterface*>(plan.type);
+        void* storage = value.rawValue();
+        out.beginMap(type->size(storage), plan.signature, plan.valueSignature);
+        AnyIterator it = type->begin(storage);
+        AnyIterator end = type->end(storage);
+        for (; it != end; ++it)
+        {
+          AnyReference v = *it;
+          serializeElement(*plan.children[0], v[0], out, serializeObjectCb, streamContext);
+          serializeElement(*plan.children[1], v[1], out, serializeObjectCb, streamContext);
+        }
+        out.endMap();
+        break;
+      }
+      case CodecPlan::Op_Tuple:
+      {
+        if (plan.lazyTuple)
+        {
+          LazyTupleType* type = static_cast<LazyTupleType*>(plan.type);
+          LazyTuple& tuple = type->backend(value.rawValue());
+          size_t size;
+          if (type->encodedFields(tuple, size))
+          {
+            // Forward the encoded fields as they are
+            out.beginTuple(plan.signature);
+            out.write(static_cast<const char*>(tuple.buffer.data()), size);
+            out.endTuple();
+            break;
+          }
+        }
+        AnyReferenceVector vals = static_cast<StructTypeInterface*>(plan.type)->values(value.rawValue());
+        out.beginTuple(plan.signature);
+        for (unsigned i = 0; i < vals.size(); ++i)
+          serializeElement(*plan.children[i], vals[i], out, serializeObjectCb, streamContext);
+        out.endTuple();
+        break;
+      }
+      case CodecPlan::Op_Visitor:
+      {
+        SerializeTypeVisitor stv(out, serializeObjectCb, value, streamContext);
+        qi::typeDispatch(stv, value);
+        break;
+      }
+      }
+    }
+
+    static size_t planEncodedSize(const CodecPlan& plan, AnyReference value);
+
+    /// Encoded size of \p value, using \p plan if it matches the type of \p value.
+    static size_t elementEncodedSize(const CodecPlan& plan, AnyReference value)
+    {
+      return planEncodedSize(value.type() == plan.type ? plan : codecPlan(value.type()), value);
+    }
+
+    /// @return the number of bytes runSerializePlan will write for \p value.
+    /// Objects are not accounted for, their encoding depends on the stream context.
+    static size_t planEncodedSize(const CodecPlan& plan, AnyReference value)
+    {
+      switch (plan.op)
+      {
+      case CodecPlan::Op_Int:
+        return plan.byteSize ? plan.byteSize : sizeof(bool);
+      case CodecPlan::Op_Float:
+        return plan.byteSize;
+      case CodecPlan::Op_String:
+      {
+        StringTypeInterface::ManagedRawString content =
+          static_cast<StringTypeInterface*>(plan.type)->get(value.rawValue());
+        size_t size = content.first.second;
+        if (content.second)
+          content.second(content.first);
+        return sizeof(qi::uint32_t) + size;
+      }
+      case CodecPlan::Op_List:
+      {
+        ListTypeInterface* type = static_cast<ListTypeInterface*>(plan.type);
+        void* storage = value.rawValue();
+        if (plan.encodedElementSize)
+          return sizeof(qi::uint32_t) + type->size(storage) * plan.encodedElementSize;
+        size_t size = sizeof(qi::uint32_t);
+        AnyIterator it = type->begin(storage);
+        AnyIterator end = type->end(storage);
+        for (; it != end; ++it)
+          size += elementEncodedSize(*plan.children[0], *it);
+        return size;
+      }
+      case CodecPlan::Op_Map:
+      {
+        MapTypeInterface* type = static_cast<MapTypeInterface*>(plan.type);
+        void* storage = value.rawValue();
+        size_t size = sizeof(qi::uint32_t);
+        AnyIterator it = type->begin(storage);
+        AnyIterator end = type->end(storage);
+        for (; it != end; ++it)
+        {
+          AnyReference v = *it;
+          size += elementEncodedSize(*plan.children[0], v[0]);
+          size += elementEncodedSize(*plan.children[1], v[1]);
+        }
+        return size;
+      }
+      case CodecPlan::Op_Tuple:
+      {
+        if (plan.lazyTuple)
+        {
+          LazyTupleType* type = static_cast<LazyTupleType*>(plan.type);
+          LazyTuple& tuple = type->backend(value.rawValue());
+          size_t size;
+          if (type->encodedFields(tuple, size))
+            return size;
+        }
+        AnyReferenceVector vals = static_cast<StructTypeInterface*>(plan.type)->values(value.rawValue());
+        size_t size = 0;
+        for (unsigned i = 0; i < vals.size(); ++i)
+          size += elementEncodedSize(*plan.children[i], vals[i]);
+        return size;
+      }
+      case CodecPlan::Op_Visitor:
+        break;
+      }
+      switch (plan.type->kind())
+      {
+      case TypeKind_Dynamic:
+      {
+        if (plan.type->info() == typeOf<AnyObject>()->info())
+          return 0;
+        AnyReference content = value.content();
+        qi::Signature sig = content.signature();
+        size_t size = sizeof(qi::uint32_t) + sig.toString().size();
+        if (sig.isValid())
+          size += planEncodedSize(codecPlan(content.type()), content);
+        return size;
+      }
+      case TypeKind_Raw:
+        // Raw data is attached as a sub-buffer, only its size is written inline
+        return sizeof(qi::uint32_t);
+      default:
+        return 0;
+      }
+    }
+
+    /// Read \p sz contiguous elements at once if \p listType supports it.
+    static bool readListBlock(BinaryDecoder& in, AnyReference& result, ListTypeInterface* listType,
+                              qi::uint32_t sz, size_t elementSize)
+    {
+      if (sz > std::numeric_limits<size_t>::max() / elementSize)
+        return false;
+      void* storage = result.rawValue();
+      size_t offset = listType->size(storage);
+      // Resizing to the current size tells whether resize is supported.
+      if (!listType->resize(&storage, offset))
+        return false;
+      // Check the data is there before allocating anything.
+      void* src = in.readRaw(sz * elementSize);
+      if (!src)
+      {
+        in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+        return false;
+      }
+      listType->resize(&storage, offset + sz);
+      memcpy(static_cast<char*>(listType->data(storage)) + offset * elementSize, src, sz * elementSize);
+      return true;
+    }
+
+    /// Deserialize a new value described by \p plan, throw on error.
+    static AnyReference deserializeElement(const CodecPlan& plan, BinaryDecoder& in,
+                                           const DeserializeObjectCallback& context, StreamContext* streamContext)
+    {
+      AnyReference res(plan.type);
+      try {
+        res = runDeserializePlan(plan, res, in, context, streamContext);
+        if (in.status() != BinaryDecoder::Status::Ok) {
+          std::stringstream ss;
+          ss << "ISerialization error " << BinaryDecoder::statusToStr(in.status());
+          throw std::runtime_error(ss.str());
+        }
+        return res;
+      } catch (const std::runtime_error&) {
+        res.destroy();
+        throw;
+      }
+    }
+
+    static AnyReference runDeserializePlan(const CodecPlan& plan, AnyReference result, BinaryDecoder& in,
+                                           const DeserializeObjectCallback& context, StreamContext* streamContext)
+    {
+      switch (plan.op)
+      {
+      case CodecPlan::Op_Int:
+        readInt(in, result, plan.isSigned, plan.byteSize);
+        break;
+      case CodecPlan::Op_Float:
+        readFloat(in, result, plan.byteSize);
+        break;
+      case CodecPlan::Op_String:
+        if (plan.bufferView)
+          readStringView(in, result);
+        else
+          readString(in, result);
+        break;
+      case CodecPlan::Op_List:
+      {
+        qi::uint32_t sz = 0;
+        in.read(sz);
+        if (in.status() != BinaryDecoder::Status::Ok)
+          break;
+        ListTypeInterface* listType = static_cast<ListTypeInterface*>(plan.type);
+        if (plan.blockElementSize)
+        {
+          if (sz && readListBlock(in, result, listType, sz, plan.blockElementSize))
+            break;
+          if (in.status() != BinaryDecoder::Status::Ok)
+            break;
+        }
+        // Decoded elements are handed over to the list instead of being
+        // copied into it and destroyed.
+        void* storage = result.rawValue();
+        for (unsigned i = 0; i < sz; ++i)
+        {
+          AnyReference v = deserializeElement(*plan.children[0], in, context, streamContext);
+          if (v.type() == listType->elementType())
+            listType->pushBackOwned(&storage, v.rawValue());
+          else
+          {
+            result.append(v);
+            v.destroy();
+          }
+        }
+        break;
+      }
+      case CodecPlan::Op_Map:
+      {
+        qi::uint32_t sz = 0;
+        in.read(sz);
+        if (in.status() != BinaryDecoder::Status::Ok)
+          break;
+        for (unsigned i = 0; i < sz; ++i)
+        {
+          AnyReference k = deserializeElement(*plan.children[0], in, context, streamContext);
+          AnyReference v;
+          try {
+            v = deserializeElement(*plan.children[1], in, context, streamContext);
+          } catch (const std::runtime_error&) {
+            k.destroy();
+            throw;
+          }
+          result.insert(k, v);
+          k.destroy();
+          v.destroy();
+        }
+        break;
+      }
+      case CodecPlan::Op_Tuple:
+      {
+        std::vector<void*> vals;
+        vals.reserve(plan.children.size());
+        try {
+          for (unsigned i = 0; i < plan.children.size(); ++i)
+          {
+            AnyReference val = deserializeElement(*plan.children[i], in, context, streamContext);
+            if (!val.isValid())
+              throw std::runtime_error("Deserialization of tuple field failed");
+            vals.push_back(val.rawValue());
+          }
+        } catch (const std::runtime_error&) {
+          for (unsigned i = 0; i < vals.size(); ++i)
+            plan.children[i]->type->destroy(vals[i]);
+          throw;
+        }
+        // The decoded fields are handed over to the tuple instead of being
+        // copied into it and destroyed.
+        StructTypeInterface* tupleType = static_cast<StructTypeInterface*>(plan.type);
+        void* storage = result.rawValue();
+        tupleType->setOwned(&storage, vals);
+        break;
+      }
+      case CodecPlan::Op_Visitor:
+      {
+        if (plan.bufferView)
+        {
+          readRawView(in, result);
+          break;
+        }
+        DeserializeTypeVisitor dtv(in, context, streamContext);
+        dtv.result = result;
+        qi::typeDispatch(dtv, dtv.result);
+        return dtv.result;
+      }
+      }
+      return result;
+    }
+
     void serialize(AnyReference val, BinaryEncoder& out, SerializeObjectCallback context, StreamContext* sctx)
     {
-      detail::SerializeTypeVisitor stv(out, context, val, sctx);
-      qi::typeDispatch(stv, val);
+      runSerializePlan(codecPlan(val.type()), val, out, context, sctx);
       if (out.status() != BinaryEncoder::Status::Ok) {
         std::stringstream ss;
         ss << "OSerialization error " << BinaryEncoder::statusToStr(out.status());
@@ -784,15 +1483,13 @@ namespace qi {
 
     AnyReference deserialize(AnyReference what, BinaryDecoder& in, DeserializeObjectCallback context, StreamContext* sctx)
     {
-      detail::DeserializeTypeVisitor dtv(in, context, sctx);
-      dtv.result = what;
-      qi::typeDispatch(dtv, dtv.result);
+      AnyReference result = runDeserializePlan(codecPlan(what.type()), what, in, context, sctx);
       if (in.status() != BinaryDecoder::Status::Ok) {
         std::stringstream ss;
         ss << "ISerialization error " << BinaryDecoder::statusToStr(in.status());
         throw std::runtime_error(ss.str());
       }
-      return dtv.result;
+      return result;
     }
 
     AnyReference deserialize(qi::TypeInterface *type, BinaryDecoder& in, DeserializeObjectCallback context, StreamContext* sctx)
@@ -806,12 +1503,258 @@ namespace qi {
       }
     }
 
+    static void skipBytes(BinaryDecoder& in, size_t size)
+    {
+      if (size && !in.readRaw(size))
+        in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+    }
+
+    /// Move \p in past a value of type \p type without decoding it.
+    static void skipValue(TypeInterface* type, BinaryDecoder& in)
+    {
+      const CodecPlan& plan = codecPlan(type);
+      BufferReader& reader = in.bufferReader();
+      qi::uint32_t sz = 0;
+      switch (plan.op)
+      {
+      case CodecPlan::Op_Int:
+        skipBytes(in, plan.byteSize ? plan.byteSize : sizeof(bool));
+        break;
+      case CodecPlan::Op_Float:
+        skipBytes(in, plan.byteSize);
+        break;
+      case CodecPlan::Op_String:
+        in.read(sz);
+        skipBytes(in, sz);
+        break;
+      case CodecPlan::Op_List:
+        in.read(sz);
+        if (plan.encodedElementSize)
+          skipBytes(in, sz * plan.encodedElementSize);
+        else
+          for (unsigned i = 0; i < sz && in.status() == BinaryDecoder::Status::Ok; ++i)
+            skipValue(plan.children[0]->type, in);
+        break;
+      case CodecPlan::Op_Map:
+        in.read(sz);
+        for (unsigned i = 0; i < sz && in.status() == BinaryDecoder::Status::Ok; ++i)
+        {
+          skipValue(plan.children[0]->type, in);
+          skipValue(plan.children[1]->type, in);
+        }
+        break;
+      case CodecPlan::Op_Tuple:
+        for (unsigned i = 0; i < plan.children.size(); ++i)
+          skipValue(plan.children[i]->type, in);
+        break;
+      case CodecPlan::Op_Visitor:
+        switch (type->kind())
+        {
+        case TypeKind_Raw:
+          if (reader.hasSubBuffer())
+            reader.subBuffer();
+          else
+          {
+            in.read(sz);
+            skipBytes(in, sz);
+          }
+          break;
+        case TypeKind_Void:
+          break;
+        default:
+        {
+          std::stringstream ss;
+          ss << "Cannot skip a value of type " << type->infoString();
+          throw std::runtime_error(ss.str());
+        }
+        }
+        break;
+      }
+    }
+
+    LazyTupleType::LazyTupleType(const Signature& signature)
+      : _signature(signature)
+    {
+      const SignatureVector& children = signature.children();
+      for (unsigned i = 0; i < children.size(); ++i)
+      {
+        TypeInterface* type = TypeInterface::fromSignature(children[i]);
+        if (!type)
+          throw std::runtime_error("Could not construct type for " + children[i].toString());
+        _types.push_back(type);
+      }
+      _info = TypeInfo("LazyTupleType<" + signature.toString() + ">("
+                       + boost::lexical_cast<std::string>(this) + ")");
+    }
+
+    BufferReader& LazyTupleType::fieldReader(LazyTuple& tuple, unsigned int index)
+    {
+      if (tuple.starts.empty())
+        tuple.starts.push_back(BufferReader(tuple.buffer));
+      while (tuple.starts.size() <= index)
+      {
+        BufferReader reader = tuple.starts.back();
+        BinaryDecoder in(&reader);
+        skipValue(_types[tuple.starts.size() - 1], in);
+        if (in.status() != BinaryDecoder::Status::Ok) {
+          std::stringstream ss;
+          ss << "ISerialization error " << BinaryDecoder::statusToStr(in.status());
+          throw std::runtime_error(ss.str());
+        }
+        tuple.starts.push_back(reader);
+      }
+      return tuple.starts[index];
+    }
+
+    bool LazyTupleType::encodedFields(LazyTuple& tuple, size_t& size)
+    {
+      boost::mutex::scoped_lock lock(tuple.mutex);
+      if (!tuple.hasData || tuple.modified || !tuple.buffer.subBuffers().empty())
+        return false;
+      if (_types.empty())
+      {
+        size = 0;
+        return true;
+      }
+      BufferReader reader = fieldReader(tuple, _types.size() - 1);
+      BinaryDecoder in(&reader);
+      skipValue(_types.back(), in);
+      if (in.status() != BinaryDecoder::Status::Ok) {
+        std::stringstream ss;
+        ss << "ISerialization error " << BinaryDecoder::statusToStr(in.status());
+        throw std::runtime_error(ss.str());
+      }
+      size = reader.position();
+      return true;
+    }
+
+    void* LazyTupleType::get(void* storage, unsigned int index)
+    {
+      LazyTuple& tuple = backend(storage);
+      if (index >= _types.size())
+        throw std::runtime_error("Tuple index out of range");
+      boost::mutex::scoped_lock lock(tuple.mutex);
+      if (!tuple.fields[index])
+      {
+        if (tuple.hasData)
+        {
+          BufferReader reader = fieldReader(tuple, index);
+          BinaryDecoder in(&reader);
+          tuple.fields[index] = deserialize(_types[index], in, DeserializeObjectCallback(), 0).rawValue();
+        }
+        else
+          tuple.fields[index] = _types[index]->initializeStorage();
+      }
+      return tuple.fields[index];
+    }
+
+    void LazyTupleType::set(void** storage, unsigned int index, void* valStorage)
+    {
+      LazyTuple& tuple = *(LazyTuple*)ptrFromStorage(storage);
+      if (index >= _types.size())
+        throw std::runtime_error("Tuple index out of range");
+      void* value = _types[index]->clone(valStorage);
+      boost::mutex::scoped_lock lock(tuple.mutex);
+      std::swap(tuple.fields[index], value);
+      tuple.modified = true;
+      lock.unlock();
+      if (value)
+        _types[index]->destroy(value);
+    }
+
+    void* LazyTupleType::initializeStorage(void* ptr)
+    {
+      LazyTuple* tuple = (LazyTuple*)Methods::initializeStorage(ptr);
+      if (!ptr)
+        tuple->fields.resize(_types.size(), 0);
+      return tuple;
+    }
+
+    void* LazyTupleType::clone(void* storage)
+    {
+      LazyTuple& src = backend(storage);
+      LazyTuple* res = (LazyTuple*)initializeStorage();
+      boost::mutex::scoped_lock lock(src.mutex);
+      res->buffer = src.buffer;
+      res->hasData = src.hasData;
+      res->modified = src.modified;
+      res->starts = src.starts;
+      for (unsigned i = 0; i < src.fields.size(); ++i)
+        if (src.fields[i])
+          res->fields[i] = _types[i]->clone(src.fields[i]);
+      return res;
+    }
+
+    void LazyTupleType::destroy(void* storage)
+    {
+      LazyTuple& tuple = backend(storage);
+      for (unsigned i = 0; i < tuple.fields.size(); ++i)
+        if (tuple.fields[i])
+          _types[i]->destroy(tuple.fields[i]);
+      Methods::destroy(storage);
+    }
+
+    bool needsStreamContext(const Signature& sig)
+    {
+      if (sig.type() == Signature::Type_Object || sig.type() == Signature::Type_Dynamic)
+        return true;
+      const SignatureVector& children = sig.children();
+      for (unsigned i = 0; i < children.size(); ++i)
+        if (needsStreamContext(children[i]))
+          return true;
+      return false;
+    }
+
+    static LazyTupleType* lazyTupleType(const Signature& signature)
+    {
+      static boost::mutex* mutex = 0;
+      static PublishedTable<std::string, LazyTupleType>* types = 0;
+      QI_THREADSAFE_NEW(mutex, types);
+      const std::string& key = signature.toString();
+      if (LazyTupleType* type = types->find(key))
+        return type;
+      boost::mutex::scoped_lock lock(*mutex);
+      LazyTupleType* type = types->find(key);
+      if (!type)
+      {
+        type = new LazyTupleType(signature);
+        types->publish(key, type);
+      }
+      return type;
+    }
+
   } // namespace detail
 
+  AnyReference decodeBinaryLazy(const qi::Buffer& buffer, const qi::Signature& signature,
+    DeserializeObjectCallback onObject, StreamContext* sctx) {
+    if (signature.type() != Signature::Type_Tuple)
+      throw std::runtime_error("Lazy decoding expects a tuple signature, got " + signature.toString());
+    if (detail::needsStreamContext(signature))
+    {
+      // Objects have to be decoded in order, with their stream context
+      TypeInterface* type = TypeInterface::fromSignature(signature);
+      if (!type)
+        throw std::runtime_error("Could not construct type for " + signature.toString());
+      BufferReader reader(buffer);
+      AnyReference res(type);
+      try {
+        return decodeBinary(&reader, res, onObject, sctx);
+      } catch (const std::runtime_error&) {
+        res.destroy();
+        throw;
+      }
+    }
+    detail::LazyTupleType* type = detail::lazyTupleType(signature);
+    AnyReference res(type);
+    detail::LazyTuple& tuple = type->backend(res.rawValue());
+    tuple.buffer = buffer;
+    tuple.hasData = true;
+    return res;
+  }
+
   void encodeBinary(qi::Buffer *buf, const qi::AutoAnyReference &gvp, SerializeObjectCallback onObject, StreamContext* sctx) {
     BinaryEncoder be(*buf);
-    detail::SerializeTypeVisitor stv(be, onObject, gvp, sctx);
-    qi::typeDispatch(stv, gvp);
+    detail::runSerializePlan(detail::codecPlan(gvp.type()), gvp, be, onObject, sctx);
     if (be.status() != BinaryEncoder::Status::Ok) {
       std::stringstream ss;
       ss << "OSerialization error " << BinaryEncoder::statusToStr(be.status());
@@ -820,20 +1763,23 @@ namespace qi {
     }
   }
 
+  size_t encodedBinarySize(const qi::AutoAnyReference &gvp) {
+    if (!gvp.type())
+      return 0;
+    return detail::planEncodedSize(detail::codecPlan(gvp.type()), gvp);
+  }
+
   AnyReference decodeBinary(qi::BufferReader *buf, qi::AnyReference gvp,
     DeserializeObjectCallback onObject, StreamContext* sctx) {
     BinaryDecoder in(buf);
-    detail::DeserializeTypeVisitor dtv(in, onObject, sctx);
-    dtv.result = gvp;
-    qi::typeDispatch(dtv, dtv.result);
+    AnyReference result = detail::runDeserializePlan(detail::codecPlan(gvp.type()), gvp, in, onObject, sctx);
     if (in.status() != BinaryDecoder::Status::Ok) {
       std::stringstream ss;
       ss << "ISerialization error " << BinaryDecoder::statusToStr(in.status());
       qiLogError() << ss.str();
       throw std::runtime_error(ss.str());
     }
-    return dtv.result;
+    return result;
   }
 
 }
-
@@ -128,6 +128,9 @@ namespace qi {
     void write(const char *);
     void write(const std::string& i);
 
+    /// Hint that at least \p size more bytes are about to be written.
+    void reserve(size_t size);
+
     void writeValue(const AnyReference &value, boost::function<void()> recurse = boost::function<void()>());
     void writeRaw(const Buffer &buffer);
 
@@ -833,6 +833,23 @@ namespace qi {
       src.push_back(_elementType->clone(valueStorage));
     }
 
+    void pushBackOwned(void** storage, void* valueStorage)
+    {
+      std::vector<void*>& src = *(std::vector<void*>*)ptrFromStorage(storage);
+      src.push_back(valueStorage);
+    }
+
+    // Elements are stored as individual storages, not contiguously
+    void* data(void*)
+    {
+      return 0;
+    }
+
+    bool resize(void**, size_t)
+    {
+      return false;
+    }
+
     void* element(void* storage, int key)
     {
       std::vector<void*>& src = *(std::vector<void*>*)ptrFromStorage(&storage);
@@ -956,6 +973,19 @@ namespace qi {
       ptr[index] = _types[index]->clone(valStorage);
     }
 
+    void setOwned(void** storage, const std::vector<void*>& values) override
+    {
+      std::vector<void*>& ptr = *(std::vector<void*>*)ptrFromStorage(storage);
+      if (ptr.size() < values.size())
+        ptr.resize(values.size(), 0);
+      for (unsigned i = 0; i < values.size(); ++i)
+      {
+        if (ptr[i])
+          _types[i]->destroy(ptr[i]);
+        ptr[i] = values[i];
+      }
+    }
+
     const TypeInfo& info() override
     {
       return _info;
@@ -1374,6 +1404,30 @@ namespace qi {
     }
   }
 
+  void* ListTypeInterface::data(void*)
+  {
+    return 0;
+  }
+
+  bool ListTypeInterface::resize(void**, size_t)
+  {
+    return false;
+  }
+
+  void ListTypeInterface::pushBackOwned(void** storage, void* valueStorage)
+  {
+    pushBack(storage, valueStorage);
+    elementType()->destroy(valueStorage);
+  }
+
+  void StructTypeInterface::setOwned(void** storage, const std::vector<void*>& values)
+  {
+    set(storage, values);
+    std::vector<TypeInterface*> types = memberTypes();
+    for (unsigned i = 0; i < values.size(); ++i)
+      types[i]->destroy(values[i]);
+  }
+
   void* ListTypeInterface::element(void* storage, int index)
   {
     // Default implementation using iteration
@@ -7,6 +7,8 @@
 
 #include <gtest/gtest.h>
 #include <map>
+#include <list>
+#include <set>
 #include <qi/buffer.hpp>
 #include <qi/binarycodec.hpp>
 #include <qi/session.hpp>
@@ -369,6 +371,141 @@ TEST(TestBind, serializeVectorStrings)
   EXPECT_EQ(vs[2], vs2[2]);
 }
 
+TEST(TestBind, serializeVectorScalars)
+{
+  qi::Buffer      buf;
+  qi::BufferReader bufr(buf);
+  std::vector<float> vf;
+  std::vector<int> vi;
+  std::vector<unsigned char> vc;
+  for (int i = 0; i < 1000; ++i)
+  {
+    vf.push_back(i / 3.0f);
+    vi.push_back(-i);
+    vc.push_back(static_cast<unsigned char>(i));
+  }
+  std::list<int> li(vi.begin(), vi.end());
+
+  qi::encodeBinary(&buf, vf);
+  qi::encodeBinary(&buf, vi);
+  qi::encodeBinary(&buf, vc);
+  qi::encodeBinary(&buf, li);
+  qi::encodeBinary(&buf, std::vector<int>());
+  EXPECT_EQ(5 * sizeof(qi::uint32_t) + 1000 * (sizeof(float) + 2 * sizeof(int) + 1),
+            buf.size());
+
+  std::vector<float> vf1;
+  qi::decodeBinary(&bufr, &vf1);
+  std::vector<int> vi1;
+  qi::decodeBinary(&bufr, &vi1);
+  std::vector<unsigned char> vc1;
+  qi::decodeBinary(&bufr, &vc1);
+  // a list encoded element-wise decodes as a block and vice versa
+  std::vector<int> vi2;
+  qi::decodeBinary(&bufr, &vi2);
+  std::list<int> li1;
+  qi::decodeBinary(&bufr, &li1);
+
+  EXPECT_EQ(vf, vf1);
+  EXPECT_EQ(vi, vi1);
+  EXPECT_EQ(vc, vc1);
+  EXPECT_EQ(vi, vi2);
+  EXPECT_TRUE(li1.empty());
+}
+
+TEST(TestBind, serializeScalarsDynamicList)
+{
+  qi::Buffer buf;
+  qi::BufferReader bufr(buf);
+  std::vector<int> vi;
+  for (int i = 0; i < 100; ++i)
+    vi.push_back(-i);
+  qi::encodeBinary(&buf, vi);
+
+  // Lists built from signatures store each element separately
+  qi::AnyReference dyn(qi::TypeInterface::fromSignature("[i]"));
+  qi::decodeBinary(&bufr, dyn);
+  EXPECT_EQ(vi, dyn.to<std::vector<int> >());
+
+  qi::Buffer buf2;
+  qi::BufferReader bufr2(buf2);
+  qi::encodeBinary(&buf2, dyn);
+  std::vector<int> vi2;
+  qi::decodeBinary(&bufr2, &vi2);
+  EXPECT_EQ(vi, vi2);
+  dyn.destroy();
+}
+
+TEST(TestBind, deserializeNestedContainers)
+{
+  typedef std::vector<std::pair<int, std::string> > Pairs;
+  Pairs pairs;
+  std::set<std::string> names;
+  for (int i = 0; i < 20; ++i)
+  {
+    pairs.push_back(std::make_pair(i, std::string(i, 'x')));
+    names.insert(std::string(i, 'y'));
+  }
+  qi::Buffer buf;
+  qi::BufferReader bufr(buf);
+  qi::encodeBinary(&buf, pairs);
+  qi::encodeBinary(&buf, names);
+  qi::encodeBinary(&buf, pairs);
+
+  Pairs pairs2;
+  std::set<std::string> names2;
+  qi::decodeBinary(&bufr, &pairs2);
+  qi::decodeBinary(&bufr, &names2);
+  EXPECT_EQ(pairs, pairs2);
+  EXPECT_EQ(names, names2);
+
+  qi::AnyReference dyn(qi::TypeInterface::fromSignature("[(is)]"));
+  qi::decodeBinary(&bufr, dyn);
+  EXPECT_EQ(pairs, dyn.to<Pairs>());
+  dyn.destroy();
+}
+
+TEST(TestBind, serializeVectorScalarsPastEnd)
+{
+  qi::Buffer      buf;
+  std::vector<int> vi(100, 42);
+  qi::encodeBinary(&buf, vi);
+  // truncate the payload
+  qi::Buffer truncated;
+  truncated.write(buf.data(), buf.size() - 1);
+  qi::BufferReader truncatedr(truncated);
+
+  std::vector<int> vi1;
+  EXPECT_ANY_THROW(qi::decodeBinary(&truncatedr, &vi1));
+  EXPECT_TRUE(vi1.empty());
+}
+
+TEST(TestBind, serializeVectorDurations)
+{
+  qi::Buffer      buf;
+  qi::BufferReader bufr(buf);
+  std::vector<qi::Seconds> vs;
+  for (int i = 0; i < 10; ++i)
+    vs.push_back(qi::Seconds(i));
+  std::list<qi::Seconds> ls(vs.begin(), vs.end());
+
+  // Durations are sent in nanoseconds, never copied as a block of counts.
+  qi::encodeBinary(&buf, vs);
+  qi::encodeBinary(&buf, ls);
+  ASSERT_EQ(2 * (sizeof(qi::uint32_t) + 10 * sizeof(qi::int64_t)), buf.size());
+  EXPECT_EQ(0, memcmp(buf.data(), static_cast<const char*>(buf.data()) + buf.size() / 2,
+                      buf.size() / 2));
+
+  std::vector<qi::uint64_t> ns;
+  qi::decodeBinary(&bufr, &ns);
+  std::vector<qi::Seconds> vs1;
+  qi::decodeBinary(&bufr, &vs1);
+  ASSERT_EQ(10u, ns.size());
+  for (int i = 0; i < 10; ++i)
+    EXPECT_EQ(i * 1000000000ull, ns[i]);
+  EXPECT_EQ(vs, vs1);
+}
+
 TEST(TestBind, serializeBuffer)
 {
   qi::Buffer buf;
@@ -387,6 +524,129 @@ TEST(TestBind, serializeBuffer)
 
 }
 
+template<typename T>
+static void expectEncodedSize(const T& value)
+{
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, value);
+  EXPECT_EQ(buf.size(), qi::encodedBinarySize(value));
+}
+
+TEST(TestBind, encodedSize)
+{
+  expectEncodedSize(true);
+  expectEncodedSize(42);
+  expectEncodedSize(3.5f);
+  expectEncodedSize(std::string("foo"));
+  expectEncodedSize(std::vector<std::string>(3, "bar"));
+  expectEncodedSize(std::vector<double>(12, 1.0));
+  std::map<std::string, std::list<int> > m;
+  m["a"].push_back(1);
+  m["bb"].push_back(2);
+  m["bb"].push_back(3);
+  expectEncodedSize(m);
+  expectEncodedSize(std::make_pair(12, std::string("pair")));
+  expectEncodedSize(qi::AnyValue::from(std::vector<int>(5, 1)));
+  expectEncodedSize(qi::AnyValue());
+  qi::Buffer buffer;
+  buffer.write("raw", 3);
+  expectEncodedSize(buffer);
+}
+
+TEST(TestBind, deserializeBufferView)
+{
+  qi::Buffer buf;
+  qi::BufferReader bufr(buf);
+  std::string str(10000, 'a');
+  qi::Buffer raw;
+  raw.write(str.c_str(), 100);
+  qi::encodeBinary(&buf, str);
+  qi::encodeBinary(&buf, std::vector<std::string>(2, "view"));
+  qi::encodeBinary(&buf, raw);
+
+  const char* begin = static_cast<const char*>(buf.data());
+  const char* end = begin + buf.size();
+
+  qi::BufferView view;
+  qi::decodeBinary(&bufr, &view);
+  EXPECT_EQ(str, view.str());
+  EXPECT_TRUE(view.data() >= begin && view.data() < end);
+
+  std::vector<qi::BufferView> views;
+  qi::decodeBinary(&bufr, &views);
+  ASSERT_EQ(2u, views.size());
+  EXPECT_EQ("view", views[1].str());
+  EXPECT_TRUE(views[1].data() >= begin && views[1].data() < end);
+
+  qi::RawBufferView rawView;
+  qi::decodeBinary(&bufr, &rawView);
+  EXPECT_EQ(100u, rawView.size());
+  EXPECT_EQ(raw.data(), rawView.data());
+
+  // Serializing a view is the same as serializing its content
+  qi::Buffer buf2;
+  qi::BufferReader bufr2(buf2);
+  qi::encodeBinary(&buf2, view);
+  std::string str2;
+  qi::decodeBinary(&bufr2, &str2);
+  EXPECT_EQ(str, str2);
+}
+
+TEST(TestBind, deserializeLazy)
+{
+  qi::Buffer buf;
+  std::vector<float> vf(100, 2.5f);
+  qi::encodeBinary(&buf, 12);
+  qi::encodeBinary(&buf, std::string("lazy"));
+  qi::encodeBinary(&buf, vf);
+
+  qi::AnyReference lazy = qi::decodeBinaryLazy(buf, "(is[f])");
+  // Not accessed: encoded as is
+  EXPECT_EQ(buf.size(), qi::encodedBinarySize(lazy));
+  qi::Buffer out;
+  qi::encodeBinary(&out, lazy);
+  ASSERT_EQ(buf.size(), out.size());
+  EXPECT_EQ(0, memcmp(buf.data(), out.data(), buf.size()));
+
+  EXPECT_EQ(vf, lazy[2].to<std::vector<float> >());
+  EXPECT_EQ("lazy", lazy[1].to<std::string>());
+  EXPECT_EQ(12, lazy[0].to<int>());
+
+  // Only read: still encoded as is
+  qi::Buffer out1;
+  qi::encodeBinary(&out1, lazy);
+  ASSERT_EQ(buf.size(), out1.size());
+  EXPECT_EQ(0, memcmp(buf.data(), out1.data(), buf.size()));
+
+  // Set: encoded field by field
+  std::string modified("modified");
+  qi::AnyReferenceVector values;
+  values.push_back(lazy[0]);
+  values.push_back(qi::AnyReference::from(modified));
+  values.push_back(lazy[2]);
+  lazy.setTuple(values);
+  qi::Buffer out2;
+  qi::BufferReader reader(out2);
+  qi::encodeBinary(&out2, lazy);
+  int i;
+  std::string str;
+  std::vector<float> vf2;
+  qi::decodeBinary(&reader, &i);
+  qi::decodeBinary(&reader, &str);
+  qi::decodeBinary(&reader, &vf2);
+  EXPECT_EQ(12, i);
+  EXPECT_EQ("modified", str);
+  EXPECT_EQ(vf, vf2);
+  lazy.destroy();
+
+  qi::AnyReference truncated = qi::decodeBinaryLazy(buf, "(is[f]s)");
+  EXPECT_EQ(12, truncated[0].to<int>());
+  EXPECT_ANY_THROW(truncated[3]);
+  truncated.destroy();
+
+  EXPECT_ANY_THROW(qi::decodeBinaryLazy(buf, "i"));
+}
+
 TEST(TestBind, serializeAllTypes)
 {
   qi::Buffer      buf;
@@ -13,6 +13,28 @@
 qiLogCategory("test");
 static qi::Promise<int> *payload;
 
+struct EventPayload
+{
+  int value;
+};
+QI_TYPE_STRUCT_REGISTER(EventPayload, value);
+
+// Counts the accesses to its fields, encoding included.
+struct CountedPayload
+{
+  EventPayload payload;
+};
+
+static qi::Atomic<int> payloadAccesses;
+
+static EventPayload* countPayloadAccess(CountedPayload* counted)
+{
+  ++payloadAccesses;
+  return &counted->payload;
+}
+
+QI_TYPE_STRUCT_BOUNCE_REGISTER(CountedPayload, EventPayload, countPayloadAccess);
+
 void onFire(const int& pl)
 {
   std::cout << "onFire:" << pl << std::endl;
@@ -27,6 +49,7 @@ public:
   {
     qi::DynamicObjectBuilder ob;
     ob.advertiseSignal<const int&>("fire");
+    ob.advertiseSignal<const CountedPayload&>("fireCounted");
     oserver = ob.object();
   }
 
@@ -110,6 +133,77 @@ TEST_F(ObjectEventRemote, CoDeco)
   }
 }
 
+static qi::SessionPtr connectedSession(const TestSessionPair& p)
+{
+  qi::SessionPtr sess = qi::makeSession();
+  if (p.mode() == TestMode::Mode_Gateway)
+    sess->connect(p.gatewayEndpoints()[0]);
+  else
+    sess->connect(p.serviceDirectoryEndpoints()[0]);
+  return sess;
+}
+
+TEST_F(ObjectEventRemote, ManySubscribers)
+{
+  static const unsigned int count = 3;
+  std::vector<qi::SessionPtr> sessions;
+  std::vector<qi::AnyObject> clients;
+  std::vector<qi::Promise<int> > received(count);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    sessions.push_back(connectedSession(p));
+    clients.push_back(sessions.back()->service("coin"));
+    clients.back().connect("fire", boost::function<void(int)>([&received, i](int v) {
+      received[i].setValue(v);
+    }));
+  }
+
+  oserver.post("fire", 42);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    ASSERT_TRUE(received[i].future().hasValue(2000));
+    EXPECT_EQ(42, received[i].future().value());
+  }
+
+  // the remaining subscribers still receive the event
+  clients.front() = qi::AnyObject();
+  sessions.front()->close();
+  for (unsigned int i = 1; i < count; ++i)
+    received[i] = qi::Promise<int>();
+  oserver.post("fire", 43);
+  for (unsigned int i = 1; i < count; ++i)
+  {
+    ASSERT_TRUE(received[i].future().hasValue(2000));
+    EXPECT_EQ(43, received[i].future().value());
+  }
+
+  // the event is serialized once for all of the subscribers
+  const CountedPayload value = { { 44 } };
+  std::vector<qi::Promise<void> > counted(count);
+  auto connectCounted = [&](unsigned int i) {
+    clients[i].connect("fireCounted", boost::function<void(qi::AnyValue)>([&counted, i](qi::AnyValue) {
+      counted[i].setValue(0);
+    }));
+  };
+  connectCounted(1);
+  int accesses = payloadAccesses.load();
+  oserver.post("fireCounted", value);
+  ASSERT_TRUE(counted[1].future().hasValue(2000));
+  const int singleSubscriberAccesses = payloadAccesses.load() - accesses;
+
+  counted[1] = qi::Promise<void>();
+  for (unsigned int i = 2; i < count; ++i)
+    connectCounted(i);
+  accesses = payloadAccesses.load();
+  oserver.post("fireCounted", value);
+  for (unsigned int i = 1; i < count; ++i)
+    ASSERT_TRUE(counted[i].future().hasValue(2000));
+  EXPECT_EQ(singleSubscriberAccesses, payloadAccesses.load() - accesses);
+
+  for (unsigned int i = 1; i < count; ++i)
+    sessions[i]->close();
+}
+
 int verifA = 0;
 int verifB = 0;
 
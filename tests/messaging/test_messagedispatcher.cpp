@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <qi/future.hpp>
+#include <qi/os.hpp>
+#include "../../src/messaging/messagedispatcher.hpp"
+
+static void record(const qi::Message& msg, std::vector<unsigned int>* ids)
+{
+  ids->push_back(msg.id());
+}
+
+TEST(MessageDispatcher, DispatchesToObjectAndServiceHandlers)
+{
+  qi::MessageDispatcher dispatcher;
+  std::vector<unsigned int> object, service, other;
+  dispatcher.messagePendingConnect(1, 2, boost::bind(&record, _1, &object));
+  dispatcher.messagePendingConnect(1, qi::MessageDispatcher::ALL_OBJECTS, boost::bind(&record, _1, &service));
+  dispatcher.messagePendingConnect(3, 2, boost::bind(&record, _1, &other));
+
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(8, 1, 4, 100)));
+  ASSERT_EQ(1u, object.size());
+  EXPECT_EQ(7u, object[0]);
+  ASSERT_EQ(2u, service.size());
+  EXPECT_EQ(8u, service[1]);
+  EXPECT_TRUE(other.empty());
+}
+
+TEST(MessageDispatcher, DisconnectStopsDispatching)
+{
+  qi::MessageDispatcher dispatcher;
+  std::vector<unsigned int> kept, removed;
+  dispatcher.messagePendingConnect(1, 2, boost::bind(&record, _1, &kept));
+  qi::SignalLink link = dispatcher.messagePendingConnect(1, 2, boost::bind(&record, _1, &removed));
+
+  EXPECT_TRUE(dispatcher.messagePendingDisconnect(1, 2, link));
+  EXPECT_FALSE(dispatcher.messagePendingDisconnect(1, 2, link));
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  EXPECT_EQ(1u, kept.size());
+  EXPECT_TRUE(removed.empty());
+}
+
+TEST(MessageDispatcher, DisconnectFromHandler)
+{
+  qi::MessageDispatcher dispatcher;
+  qi::SignalLink link = 0;
+  int calls = 0;
+  link = dispatcher.messagePendingConnect(1, 2, [&](const qi::Message&) {
+    ++calls;
+    EXPECT_TRUE(dispatcher.messagePendingDisconnect(1, 2, link));
+  });
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(8, 1, 2, 100)));
+  EXPECT_EQ(1, calls);
+}
+
+TEST(MessageDispatcher, FailsCallsPastTheirDeadline)
+{
+  qi::MessageDispatcher dispatcher;
+  std::vector<qi::Message> answers;
+  boost::mutex mutex;
+  qi::Promise<void> answered;
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message& msg) {
+    boost::mutex::scoped_lock lock(mutex);
+    answers.push_back(msg);
+    answered.setValue(0);
+  });
+
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(7, 1, 2, 100));
+  call.setDeadline(qi::SteadyClock::now() + qi::MilliSeconds(50));
+  dispatcher.sent(call);
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, answered.future().wait(5000));
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    ASSERT_EQ(1u, answers.size());
+    EXPECT_EQ(qi::Message::Type_Error, answers[0].type());
+    EXPECT_EQ(7u, answers[0].id());
+  }
+
+  // The answer that comes too late is dropped.
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  boost::mutex::scoped_lock lock(mutex);
+  EXPECT_EQ(1u, answers.size());
+}
+
+TEST(MessageDispatcher, AnsweredCallsDoNotExpire)
+{
+  qi::MessageDispatcher dispatcher;
+  std::vector<unsigned int> answers;
+  dispatcher.messagePendingConnect(1, 2, boost::bind(&record, _1, &answers));
+
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(7, 1, 2, 100));
+  call.setDeadline(qi::SteadyClock::now() + qi::MilliSeconds(20));
+  dispatcher.sent(call);
+  dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  qi::os::msleep(100);
+  EXPECT_EQ(1u, answers.size());
+}
+
+TEST(MessageDispatcher, DisconnectWaitsForRunningHandler)
+{
+  qi::MessageDispatcher dispatcher;
+  qi::Promise<void> entered;
+  qi::Promise<void> release;
+  qi::Atomic<bool> running(false);
+  qi::SignalLink link = dispatcher.messagePendingConnect(1, 2, [&](const qi::Message&) {
+    running = true;
+    entered.setValue(0);
+    release.future().wait();
+    running = false;
+  });
+  boost::thread dispatching([&] {
+    dispatcher.dispatch(qi::Message(qi::Message::Type_Reply, qi::MessageAddress(7, 1, 2, 100)));
+  });
+  entered.future().wait();
+
+  qi::Future<bool> disconnected = qi::getEventLoop()->async(
+      [&] { return dispatcher.messagePendingDisconnect(1, 2, link); });
+  qi::os::msleep(50);
+  EXPECT_TRUE(disconnected.isRunning());
+  release.setValue(0);
+  EXPECT_TRUE(disconnected.value());
+  EXPECT_FALSE(running.load());
+  dispatching.join();
+}
@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <qi/os.hpp>
+
+#include "src/messaging/tcptransportsocket.hpp"
+#include "src/messaging/transportserver.hpp"
+
+namespace {
+
+/// How the server side of a connection handles what it receives.
+enum class Peer
+{
+  Echo,    // sends every message back
+  Stalled, // does not read until the test says so
+};
+
+void onMessage(const qi::Message& msg, qi::TransportSocketPtr socket)
+{
+  socket->send(msg); // echo
+}
+
+void accept(qi::TransportSocketPtr socket, Peer peer, qi::Promise<qi::TransportSocketPtr> accepted)
+{
+  if (peer == Peer::Echo)
+  {
+    socket->messageReady.connect(&onMessage, _1, socket);
+    socket->ensureReading();
+  }
+  accepted.setValue(socket);
+}
+
+void sendCapabilities(qi::TransportSocketPtr socket)
+{
+  qi::Message msg;
+  msg.setType(qi::Message::Type_Capability);
+  msg.setValue(socket->localCapabilities(), qi::typeOf<qi::CapabilityMap>()->signature());
+  socket->send(msg);
+}
+
+#ifndef _WIN32
+std::string tempSocketPath()
+{
+  std::stringstream ss;
+  ss << "/tmp/qimessaging-test-socket-" << qi::os::getpid() << ".sock";
+  return ss.str();
+}
+#endif
+
+/// A client connected to a server of the tested protocol.
+class TestTransportSocket : public ::testing::Test
+{
+protected:
+  ~TestTransportSocket()
+  {
+    if (client_)
+      client_->disconnect();
+    server_.close();
+  }
+
+  /// Listens on \p url and connects client_ to it, peer_ is the server side
+  /// of the connection. Use with ASSERT_NO_FATAL_FAILURE.
+  void connectPair(const std::string& url, Peer peer = Peer::Echo)
+  {
+    qi::Promise<qi::TransportSocketPtr> accepted;
+    server_.newConnection.connect(&accept, _1, peer, accepted);
+    ASSERT_FALSE(server_.listen(url).hasError());
+
+    client_ = qi::makeTransportSocket(server_.endpoints()[0].protocol());
+    ASSERT_FALSE(client_->connect(server_.endpoints()[0]).hasError());
+    qi::Future<qi::TransportSocketPtr> f = accepted.future();
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, f.wait(10000));
+    peer_ = f.value();
+  }
+
+  /// Exchanges capabilities as the session handshake does. Messages are
+  /// handled in order, both sides have them once a later call is echoed.
+  void exchangeCapabilities()
+  {
+    sendCapabilities(client_);
+    sendCapabilities(peer_);
+    qi::Promise<void> echoed;
+    qi::SignalLink link = client_->messageReady.connect(
+        [echoed](const qi::Message&) mutable { echoed.setValue(0); });
+    qi::Message ping(qi::Message::Type_Call, qi::MessageAddress(0, 1, 2, 100));
+    ping.setValue(std::string("ping"), "s");
+    ASSERT_TRUE(client_->send(ping));
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, echoed.future().wait(10000));
+    client_->messageReady.disconnect(link);
+    ASSERT_TRUE(client_->hasReceivedRemoteCapabilities());
+    ASSERT_TRUE(peer_->hasReceivedRemoteCapabilities());
+  }
+
+  qi::TransportServer    server_;
+  qi::TransportSocketPtr client_;
+  qi::TransportSocketPtr peer_;
+};
+
+}
+
+#ifdef __linux__
+TEST_F(TestTransportSocket, ShmSendLargerThanRing)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("shm://"));
+
+  qi::Promise<qi::Message> reply;
+  client_->messageReady.connect([&](const qi::Message& msg) { reply.setValue(msg); });
+
+  // Several times the default ring size, so that both sides wait for room.
+  std::string payload(10 * 1024 * 1024, 'x');
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = static_cast<char>(i * 7);
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(0, 1, 2, 100));
+  msg.setValue(payload, "s");
+  ASSERT_TRUE(client_->send(msg));
+
+  qi::Future<qi::Message> f = reply.future();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, f.wait(10000));
+  EXPECT_EQ(payload, f.value().value("s", client_).to<std::string>());
+}
+#endif
+
+#ifndef _WIN32
+TEST_F(TestTransportSocket, UnixReplacesStaleSocket)
+{
+  const std::string path = tempSocketPath();
+  {
+    qi::TransportServer server;
+    ASSERT_FALSE(server.listen("unix://" + path).hasError());
+    // A live server keeps its socket.
+    qi::TransportServer other;
+    ASSERT_TRUE(other.listen("unix://" + path).hasError());
+  }
+  // Never remove something that is not a socket.
+  FILE* file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != 0);
+  fclose(file);
+  {
+    qi::TransportServer server;
+    ASSERT_TRUE(server.listen("unix://" + path).hasError());
+  }
+  std::remove(path.c_str());
+  // Leave a socket behind as a crashed server would.
+  {
+    boost::asio::io_service io;
+    boost::asio::local::stream_protocol::acceptor stale(io);
+    stale.open(boost::asio::local::stream_protocol());
+    stale.bind(boost::asio::local::stream_protocol::endpoint(path));
+  }
+
+  ASSERT_NO_FATAL_FAILURE(connectPair("unix://" + path));
+
+  qi::Promise<qi::Message> reply;
+  client_->messageReady.connect([&](const qi::Message& msg) { reply.setValue(msg); });
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(0, 1, 2, 100));
+  msg.setValue(std::string("hello"), "s");
+  ASSERT_TRUE(client_->send(msg));
+
+  qi::Future<qi::Message> f = reply.future();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, f.wait(10000));
+  EXPECT_EQ("hello", f.value().value("s", client_).to<std::string>());
+}
+#endif
+
+#ifdef __linux__
+TEST_F(TestTransportSocket, UnixPassesLargeBuffers)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("unix://" + tempSocketPath()));
+  ASSERT_NO_FATAL_FAILURE(exchangeCapabilities());
+  ASSERT_TRUE(client_->sharedCapability<bool>("FdPassing", false));
+
+  qi::Promise<qi::Message> reply;
+  client_->messageReady.connect([&](const qi::Message& msg) { reply.setValue(msg); });
+
+  std::vector<char> data(4 * 1024 * 1024);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<char>(i * 7);
+  qi::Buffer buffer;
+  buffer.write(data.data(), data.size());
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(0, 1, 2, 100));
+  msg.setValue(buffer, "r");
+  ASSERT_TRUE(client_->send(msg));
+
+  // Echoed back through the mapping the server received.
+  qi::Future<qi::Message> f = reply.future();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, f.wait(10000));
+  qi::Message answer = f.value();
+  ASSERT_EQ(0, answer.flags() & qi::Message::TypeFlag_PassedBuffers);
+  ASSERT_EQ(1u, answer.buffer().subBuffers().size());
+  qi::Buffer received = answer.value("r", client_).to<qi::Buffer>();
+  ASSERT_EQ(data.size(), received.size());
+  EXPECT_EQ(0, memcmp(data.data(), received.data(), data.size()));
+}
+#endif
+
+TEST_F(TestTransportSocket, TcpInterleavesChunksOfLargeMessages)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("tcp://127.0.0.1:0"));
+  ASSERT_NO_FATAL_FAILURE(exchangeCapabilities());
+  ASSERT_TRUE(client_->sharedCapability<bool>("MessageChunks", false));
+
+  boost::mutex mutex;
+  std::vector<qi::Message> replies;
+  qi::Promise<void> done;
+  client_->messageReady.connect([&](const qi::Message& msg) {
+    boost::mutex::scoped_lock lock(mutex);
+    replies.push_back(msg);
+    if (replies.size() == 3)
+      done.setValue(0);
+  });
+
+  // Large enough to fill the socket buffers, so that it is still being
+  // sent when the small messages are queued.
+  std::string payload(32 * 1024 * 1024, 'x');
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = static_cast<char>(i * 7);
+  qi::Message big(qi::Message::Type_Call, qi::MessageAddress(1, 1, 2, 100));
+  big.setValue(payload, "s");
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(2, 1, 2, 100));
+  call.setValue(std::string("hello"), "s");
+  qi::Message reply(qi::Message::Type_Reply, qi::MessageAddress(3, 1, 2, 100));
+  reply.setValue(std::string("hello"), "s");
+  ASSERT_TRUE(client_->send(big));
+  ASSERT_TRUE(client_->send(call));
+  ASSERT_TRUE(client_->send(reply));
+
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, done.future().wait(10000));
+  // The reply went through between the chunks of the big call, the second
+  // call waited for it.
+  EXPECT_EQ(3u, replies[0].id());
+  EXPECT_EQ(1u, replies[1].id());
+  EXPECT_EQ(2u, replies[2].id());
+  EXPECT_EQ(0u, replies[1].flags() & qi::Message::TypeFlag_Chunk);
+  EXPECT_TRUE(payload == replies[1].value("s", client_).to<std::string>());
+}
+
+TEST_F(TestTransportSocket, TcpBoundsSendQueueTowardStalledPeer)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("tcp://127.0.0.1:0", Peer::Stalled));
+  qi::TcpTransportSocketPtr client = boost::static_pointer_cast<qi::TcpTransportSocket>(client_);
+  client->setSendQueueLimits(0, 4);
+
+  // Far more than the kernel buffers, the queue has to fill up.
+  std::string payload(1024 * 1024, 'x');
+  std::vector<qi::Future<void> > events;
+  for (int i = 0; i < 64; ++i)
+  {
+    qi::Message event(qi::Message::Type_Event, qi::MessageAddress(0, 1, 2, 100 + i));
+    event.setValue(payload, "s");
+    events.push_back(client->sendAsync(event));
+  }
+  ASSERT_TRUE(events[63].isRunning());
+  // The oldest events still queued were dropped to make room.
+  EXPECT_TRUE(events[62].isRunning());
+  unsigned int dropped = 0;
+  for (unsigned i = 0; i < events.size(); ++i)
+    if (events[i].isFinished() && events[i].hasError())
+      ++dropped;
+  EXPECT_LT(0u, dropped);
+
+  client->setSendPolicy(qi::Message::Type_Call, qi::TransportSocket::SendPolicy::Fail);
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(1, 1, 2, 100));
+  call.setValue(payload, "s");
+  EXPECT_FALSE(client->send(call));
+  EXPECT_TRUE(client->sendAsync(call).hasError(0));
+
+  // What is still queued fails with the socket.
+  client->disconnect();
+  for (unsigned i = 0; i < events.size(); ++i)
+    EXPECT_NE(qi::FutureState_Running, events[i].wait(1000));
+  EXPECT_TRUE(events[63].hasError());
+}
+
+TEST_F(TestTransportSocket, TcpCallsOvertakeEventBacklog)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("tcp://127.0.0.1:0", Peer::Stalled));
+
+  boost::mutex mutex;
+  std::vector<unsigned int> received;
+  qi::Promise<void> done;
+  client_->messageReady.connect([&](const qi::Message& msg) {
+    boost::mutex::scoped_lock lock(mutex);
+    received.push_back(msg.id());
+    if (received.size() == 65)
+      done.setValue(0);
+  });
+
+  // The peer is not reading yet, the events pile up in the send queue.
+  std::string payload(256 * 1024, 'x');
+  for (unsigned int i = 0; i < 64; ++i)
+  {
+    qi::Message event(qi::Message::Type_Event, qi::MessageAddress(i, 1, 2, 100));
+    event.setValue(payload, "s");
+    ASSERT_TRUE(client_->send(event));
+  }
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(1000, 1, 2, 100));
+  call.setValue(std::string("hello"), "s");
+  ASSERT_TRUE(client_->send(call));
+
+  peer_->messageReady.connect(&onMessage, _1, peer_);
+  peer_->ensureReading();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, done.future().wait(10000));
+  // Only what was already written went before the call.
+  std::vector<unsigned int>::iterator it = std::find(received.begin(), received.end(), 1000u);
+  ASSERT_TRUE(it != received.end());
+  EXPECT_GT(received.size() - 1, static_cast<size_t>(it - received.begin()));
+}
+
+TEST_F(TestTransportSocket, TcpCarriesCallDeadlines)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("tcp://127.0.0.1:0", Peer::Stalled));
+
+  qi::Promise<qi::Message> received;
+  peer_->messageReady.connect([&](const qi::Message& msg) { received.setValue(msg); });
+  peer_->ensureReading();
+
+  qi::Message call(qi::Message::Type_Call, qi::MessageAddress(1, 1, 2, 100));
+  call.setValue(std::string("hello"), "s");
+  call.setDeadline(qi::SteadyClock::now() + qi::Seconds(10));
+  ASSERT_TRUE(client_->send(call));
+
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, received.future().wait(5000));
+  qi::Message msg = received.future().value();
+  ASSERT_TRUE(msg.hasDeadline());
+  EXPECT_LT(qi::SteadyClock::now() + qi::Seconds(5), msg.deadline());
+  EXPECT_GE(qi::SteadyClock::now() + qi::Seconds(10), msg.deadline());
+  // The deadline is not part of the payload seen by the receiver.
+  EXPECT_EQ(0u, msg.flags() & qi::Message::TypeFlag_Deadline);
+  EXPECT_EQ("hello", msg.value("s", peer_).to<std::string>());
+}
+
+TEST_F(TestTransportSocket, TcpSendAsyncCompletesOnceWritten)
+{
+  ASSERT_NO_FATAL_FAILURE(connectPair("tcp://127.0.0.1:0"));
+
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(1, 1, 2, 100));
+  msg.setValue(std::string("hello"), "s");
+  qi::Future<void> sent = client_->sendAsync(msg);
+  EXPECT_EQ(qi::FutureState_FinishedWithValue, sent.wait(1000));
+
+  client_->disconnect();
+  EXPECT_TRUE(client_->sendAsync(msg).hasError(0));
+}
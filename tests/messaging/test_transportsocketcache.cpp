@@ -7,6 +7,7 @@
 */
 
 #include <algorithm>
+#include <sstream>
 
 #include <gtest/gtest.h>
 
@@ -151,6 +152,82 @@ TEST_F(TestTransportSocketCache, SameMachinePublicIp)
   client->disconnect();
 }
 
+#ifdef __linux__
+TEST_F(TestTransportSocketCache, SameMachinePrefersSharedMemory)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  server_.listen("shm://").wait();
+  qi::UrlVector endpoints = server_.endpoints();
+  ASSERT_EQ(2u, endpoints.size());
+  ASSERT_EQ("shm", endpoints[1].protocol());
+
+  qi::ServiceInfo info;
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(endpoints);
+  qi::Future<qi::TransportSocketPtr> sockFut = cache_.socket(info, "");
+  qi::TransportSocketPtr sock = sockFut.value();
+  ASSERT_TRUE(sock->isConnected());
+  ASSERT_EQ(endpoints[1], sock->url());
+}
+
+TEST_F(TestTransportSocketCache, RemoteIgnoresSharedMemory)
+{
+  server_.listen("shm://").wait();
+
+  qi::ServiceInfo info;
+  info.setMachineId("not this machine");
+  info.setEndpoints(server_.endpoints());
+  qi::Future<qi::TransportSocketPtr> sockFut = cache_.socket(info, "");
+  ASSERT_TRUE(sockFut.hasError());
+}
+
+TEST_F(TestTransportSocketCache, SameMachineFallsBackFromSharedMemory)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  qi::UrlVector endpoints = server_.endpoints();
+  // Nobody listens there, as for a server of another user or namespace.
+  endpoints.push_back(qi::Url("shm://qi-test-unreachable:0"));
+
+  qi::ServiceInfo info;
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(endpoints);
+  qi::Future<qi::TransportSocketPtr> sockFut = cache_.socket(info, "");
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, sockFut.wait(10000));
+  ASSERT_EQ(endpoints[0], sockFut.value()->url());
+}
+#endif
+
+#ifndef _WIN32
+static std::string tempSocketPath()
+{
+  std::stringstream ss;
+  ss << "/tmp/qimessaging-test-" << qi::os::getpid() << ".sock";
+  return ss.str();
+}
+
+TEST_F(TestTransportSocketCache, SameMachinePrefersUnixSocket)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  ASSERT_FALSE(server_.listen("unix://" + tempSocketPath()).hasError());
+  qi::UrlVector endpoints = server_.endpoints();
+  ASSERT_EQ(2u, endpoints.size());
+  ASSERT_EQ("unix", endpoints[1].protocol());
+
+  qi::ServiceInfo info;
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(endpoints);
+  qi::Future<qi::TransportSocketPtr> sockFut = cache_.socket(info, "");
+  qi::TransportSocketPtr sock = sockFut.value();
+  ASSERT_TRUE(sock->isConnected());
+  ASSERT_EQ(endpoints[1], sock->url());
+
+  // Unreachable from another machine.
+  info.setMachineId("not this machine");
+  info.setEndpoints(qi::UrlVector(1, endpoints[1]));
+  ASSERT_TRUE(cache_.socket(info, "").hasError());
+}
+#endif
+
 TEST(TestCall, IPV6Accepted)
 {
   // todo: enable whenever qi::Url properly supports ipv6
@@ -166,7 +243,6 @@ TEST(TestCall, IPV6Accepted)
 
   ASSERT_FALSE(fut.hasError());
 
-
   qi::TransportSocketPtr socket = qi::makeTransportSocket("tcp");
   fut = socket->connect(ipv6Url);
 
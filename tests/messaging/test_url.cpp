@@ -136,6 +136,27 @@ TEST(TestURL, ValidUrl)
   EXPECT_EQ("tcp://example.com:5", url.str());
 }
 
+TEST(TestURL, UnixUrl)
+{
+  qi::Url url("unix:///run/qi/sd.sock");
+
+  EXPECT_EQ("unix", url.protocol());
+  EXPECT_EQ("/run/qi/sd.sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_TRUE(url.isValid());
+  EXPECT_EQ("unix:///run/qi/sd.sock", url.str());
+
+  url = "unix:///tmp/a:b.sock";
+  EXPECT_EQ("/tmp/a:b.sock", url.host());
+  EXPECT_TRUE(url.isValid());
+
+  url.setPort(5);
+  EXPECT_EQ("unix:///tmp/a:b.sock", url.str());
+
+  url = "unix://";
+  EXPECT_FALSE(url.isValid());
+}
+
 TEST(TestURL, CopyUrl)
 {
   qi::Url url("tcp://example.com:5");
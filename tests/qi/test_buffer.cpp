@@ -6,12 +6,14 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include <qi/buffer.hpp>
+#include <boost/bind.hpp>
 
 
 TEST(TestBuffer, TestReserveSpace)
@@ -80,3 +82,131 @@ TEST(TestBuffer, TestSubBuffer)
   ASSERT_EQ(buffer.size(), 0u);
   ASSERT_EQ(buffer.totalSize(), 0u);
 }
+
+TEST(TestBuffer, TestCapacity)
+{
+  qi::Buffer buffer;
+  std::string str("A dummy string");
+
+  ASSERT_TRUE(buffer.reserveCapacity(100000));
+  ASSERT_GE(buffer.capacity(), 100000u);
+  ASSERT_EQ(buffer.size(), 0u);
+
+  const void* data = buffer.data();
+  for (int i = 0; i < 1000; ++i)
+    buffer.write(str.c_str(), str.size());
+  // no reallocation should have happened
+  ASSERT_EQ(data, buffer.data());
+  ASSERT_EQ(buffer.size(), 1000 * str.size());
+
+  buffer.shrink();
+  ASSERT_GE(buffer.capacity(), buffer.size());
+  ASSERT_LT(buffer.capacity(), 100000u);
+  ASSERT_EQ(0, memcmp(buffer.data(), str.c_str(), str.size()));
+
+  buffer.clear();
+  buffer.write(str.c_str(), str.size());
+  buffer.shrink();
+  ASSERT_EQ(buffer.size(), str.size());
+  ASSERT_EQ(0, memcmp(buffer.data(), str.c_str(), str.size()));
+}
+
+TEST(TestBuffer, TestTruncate)
+{
+  qi::Buffer buffer;
+  qi::Buffer sub;
+  std::string str("A dummy string");
+  sub.write(str.c_str(), str.size());
+
+  buffer.write(str.c_str(), str.size());
+  buffer.addSubBuffer(sub);
+  buffer.write(str.c_str(), str.size());
+  ASSERT_EQ(buffer.totalSize(), 4 + 3 * str.size());
+
+  // Past the sub-buffer, it is kept.
+  buffer.truncate(str.size() + 4);
+  ASSERT_EQ(buffer.size(), str.size() + 4);
+  ASSERT_EQ(1u, buffer.subBuffers().size());
+  ASSERT_EQ(buffer.totalSize(), 4 + 2 * str.size());
+
+  // Not a larger size.
+  buffer.truncate(1000);
+  ASSERT_EQ(buffer.size(), str.size() + 4);
+
+  // Through the sub-buffer, it is removed.
+  buffer.truncate(str.size());
+  ASSERT_EQ(buffer.size(), str.size());
+  ASSERT_TRUE(buffer.subBuffers().empty());
+  ASSERT_EQ(buffer.totalSize(), str.size());
+  ASSERT_EQ(0, memcmp(buffer.data(), str.c_str(), str.size()));
+}
+
+TEST(TestBuffer, TestGeometricGrowth)
+{
+  qi::Buffer buffer;
+  char c = 'a';
+  size_t reallocations = 0;
+  size_t capacity = buffer.capacity();
+  for (int i = 0; i < 1000000; ++i)
+  {
+    buffer.write(&c, 1);
+    if (buffer.capacity() != capacity)
+    {
+      ++reallocations;
+      capacity = buffer.capacity();
+    }
+  }
+  ASSERT_EQ(buffer.size(), 1000000u);
+  ASSERT_LT(reallocations, 20u);
+}
+
+TEST(TestBuffer, TestMovedFrom)
+{
+  std::string str("A dummy string");
+  qi::Buffer buffer;
+  buffer.write(str.c_str(), str.size());
+
+  qi::Buffer moved(std::move(buffer));
+  ASSERT_EQ(moved.size(), str.size());
+  ASSERT_EQ(buffer.size(), 0u);
+  ASSERT_EQ(buffer.totalSize(), 0u);
+  ASSERT_TRUE(buffer.subBuffers().empty());
+  ASSERT_FALSE(buffer.hasSubBuffer(0));
+
+  buffer.write(str.c_str(), str.size());
+  ASSERT_EQ(buffer.size(), str.size());
+  ASSERT_EQ(0, memcmp(buffer.data(), str.c_str(), str.size()));
+
+  qi::Buffer other;
+  other = std::move(buffer);
+  ASSERT_EQ(other.size(), str.size());
+  ASSERT_EQ(buffer.size(), 0u);
+  buffer.addSubBuffer(other);
+  ASSERT_EQ(buffer.totalSize(), str.size() + sizeof(qi::uint32_t));
+}
+
+static void release(int* count)
+{
+  ++*count;
+}
+
+TEST(TestBuffer, TestExternalStorage)
+{
+  char storage[] = "external";
+  int released = 0;
+  {
+    qi::Buffer buffer(storage, 8, boost::bind(&release, &released));
+    ASSERT_EQ(buffer.size(), 8u);
+    ASSERT_EQ(buffer.data(), static_cast<void*>(storage));
+    qi::Buffer copy(buffer);
+    ASSERT_EQ(released, 0);
+  }
+  ASSERT_EQ(released, 1);
+
+  qi::Buffer buffer(storage, 8, boost::bind(&release, &released));
+  // Growing moves the content to storage of its own.
+  buffer.write("!", 1);
+  ASSERT_EQ(released, 2);
+  ASSERT_NE(buffer.data(), static_cast<void*>(storage));
+  ASSERT_EQ(0, memcmp(buffer.data(), "external!", 9));
+}
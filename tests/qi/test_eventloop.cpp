@@ -114,3 +114,13 @@ TEST(EventLoop, asyncFast)
     f.wait();
   }
 }
+
+TEST(EventLoop, networkEventLoopIsSeparateFromPool)
+{
+  qi::EventLoop* net = qi::getNetworkEventLoop();
+  ASSERT_TRUE(net);
+  EXPECT_NE(qi::getEventLoop(), net);
+  EXPECT_EQ(net, qi::getNetworkEventLoop());
+  EXPECT_TRUE(net->async([=]{ return net->isInThisContext(); }).value(1000));
+  EXPECT_FALSE(net->async([]{ return qi::getEventLoop()->isInThisContext(); }).value(1000));
+}